@@ -1,6 +1,251 @@
 // Generic read/write functions for ArcGIS Ascii files
 // 02 Jan 2012
 
+// -------------------------------------------------------------------------------
+// TEXT PARSING FUNCTIONS
+
+// space, tab, carriage return and newline all separate values
+inline bool is_blank (char c)
+{
+    return (unsigned char) c <= ' ';
+}
+
+// exact powers of ten, every one of these is representable as a double
+const double pow10_exact[23] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parse the number starting at p, and move p to the end of it. This does not depend on the
+// locale. Numbers with up to 15 significant digits and a small exponent (i.e., any sensible
+// elevation) are converted with a single multiply or divide of two exact doubles, which is
+// correctly rounded, so the result is identical to strtod. Anything else is passed to strtod.
+inline bool parse_number (const char *&p, const char *e, double &v)
+{
+    const char *s = p;
+    bool neg = false;
+    if (p < e && (*p == '-' || *p == '+'))
+    {
+        neg = (*p == '-');
+        p++;
+    }
+    unsigned long long mant = 0;        // significant digits
+    int ndig = 0;                       // number of significant digits
+    int exp10 = 0;                      // power of ten to apply to the digits
+    bool digits = false;
+    while (p < e && (unsigned) (*p - '0') < 10)
+    {
+        mant = mant * 10 + (*p - '0');
+        ndig += (mant != 0);
+        digits = true;
+        p++;
+        if (ndig > 18) break;
+    }
+    if (p < e && *p == '.')
+    {
+        p++;
+        while (p < e && (unsigned) (*p - '0') < 10 && ndig <= 18)
+        {
+            mant = mant * 10 + (*p - '0');
+            ndig += (mant != 0);
+            exp10--;
+            digits = true;
+            p++;
+        }
+    }
+    if (digits && p < e && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool eneg = false;
+        if (q < e && (*q == '-' || *q == '+'))
+        {
+            eneg = (*q == '-');
+            q++;
+        }
+        int ev = 0;
+        bool edigits = false;
+        while (q < e && (unsigned) (*q - '0') < 10)
+        {
+            if (ev < 10000) ev = ev * 10 + (*q - '0');
+            edigits = true;
+            q++;
+        }
+        if (edigits)
+        {
+            exp10 += eneg ? -ev : ev;
+            p = q;
+        }
+    }
+
+    // fast path: the whole token was consumed and the conversion is exact
+    if (digits && (p == e || is_blank (*p)) && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        v = (exp10 < 0) ? (double) mant / pow10_exact[-exp10] : (double) mant * pow10_exact[exp10];
+        if (neg) v = -v;
+        return true;
+    }
+
+    // slow path: copy the token and let strtod deal with it (long mantissas, nan, inf, ...)
+    p = s;
+    while (p < e && !is_blank (*p)) p++;
+    char buf[64];
+    size_t len = (size_t) (p - s);
+    if (len == 0 || len >= sizeof (buf))
+    {
+        return false;
+    }
+    memcpy (buf, s, len);
+    buf[len] = '\0';
+    char *stop = NULL;
+    v = strtod (buf, &stop);
+    return stop == buf + len;
+}
+
+// compare a token to a header key, ignoring case
+bool same_key (const char *tok, size_t len, const char *key)
+{
+    if (strlen (key) != len)
+    {
+        return false;
+    }
+    for (size_t k = 0; k < len; k++)
+    {
+        if (tolower ((unsigned char) tok[k]) != key[k])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// count the values in a block of text that starts and ends on a blank or the end of the file
+long long count_values (const char *p, const char *e)
+{
+    long long n = 0;
+    bool in_value = false;
+    for (; p < e; p++)
+    {
+        bool value = !is_blank (*p);
+        n += (value && !in_value);
+        in_value = value;
+    }
+    return n;
+}
+
+// parse the values k to kend (counted from the top left cell) from a block of text, values
+// equal to the nodata flag, or NaN, are stored as zero and their bits in the validity plane are clear
+template <typename T>
+bool parse_values (const char *p, const char *e, raster_view<T> in, bit_plane &valid, long long k,
+                   long long kend, double nodata)
+{
+    int i = (int) (k / in.ncols);
+    int j = (int) (k % in.ncols);
+    T *row = in[i];
+    bit_word bits = 0;          // bits for the word of the validity plane that j is in
+    for (; k < kend; k++)
+    {
+        while (p < e && is_blank (*p)) p++;
+        double v;
+        if (p == e || !parse_number (p, e, v))
+        {
+            return false;
+        }
+        const bool ok = (v == v && v != nodata);     // NaN is 'nodata' too
+        row[j] = ok ? cell_traits<T>::from_double (v) : (T) 0;
+        bits |= (bit_word) ok << (j & 63);
+        if ((j & 63) == 63 || j == in.ncols - 1 || k == kend - 1)
+        {
+            // the first and last words of the block can be shared with the blocks either side
+            #pragma omp atomic
+            valid[i][j >> 6] |= bits;
+            bits = 0;
+        }
+        if (++j == in.ncols)
+        {
+            j = 0;
+            row = in[++i];
+        }
+    }
+    return true;
+}
+
+// parse the text of each block, dispatched on the cell type of the input grid
+bool parse_blocks (const vector<const char *> &cut, const vector<long long> &first, long long ncells)
+{
+    const int nblocks = (int) cut.size() - 1;
+    int ok = 1;
+    #pragma omp parallel for schedule (dynamic, 1)
+    for (int b = 0; b < nblocks; b++)
+    {
+        long long kend = min (first[b + 1], ncells);
+        if (first[b] >= kend)
+        {
+            continue;
+        }
+        bool good;
+        switch (in.type)
+        {
+            case cell_int16: good = parse_values (cut[b], cut[b + 1], in.view<short>(), in.valid, first[b], kend, nodataflag); break;
+            case cell_int32: good = parse_values (cut[b], cut[b + 1], in.view<int>(), in.valid, first[b], kend, nodataflag); break;
+            case cell_float32: good = parse_values (cut[b], cut[b + 1], in.view<float>(), in.valid, first[b], kend, nodataflag); break;
+            default: good = parse_values (cut[b], cut[b + 1], in.view<double>(), in.valid, first[b], kend, nodataflag); break;
+        }
+        if (!good)
+        {
+            #pragma omp atomic write
+            ok = 0;
+        }
+    }
+    return ok == 1;
+}
+
+// -------------------------------------------------------------------------------
+// HEADER FUNCTION: reads the pairs of key and value at the start of an ArcGIS Ascii file,
+// up until the first number (which may be 'nan' or 'inf'), and leaves p at the start of the body
+void parse_ArcAscii_header (const char *&p, const char *e)
+{
+    bool got_ncols = false, got_nrows = false, got_xll = false, got_yll = false;
+    bool got_cellsize = false, got_nodata = false;
+    for (int fail_cntr = 0; ; fail_cntr++)
+    {
+        while (p < e && is_blank (*p)) p++;
+        const char *q = p;
+        double first = 0.0;
+        if (p == e || fail_cntr == 100 || parse_number (q, e, first))
+        {
+            break;      // this is the start of the body
+        }
+        const char *key = p;
+        while (p < e && !is_blank (*p)) p++;
+        size_t key_len = (size_t) (p - key);
+        while (p < e && is_blank (*p)) p++;
+        const char *val = p;
+        while (p < e && !is_blank (*p)) p++;
+        string value (val, p);
+
+        if (same_key (key, key_len, "ncols")) { ncols = atoi (value.c_str()); got_ncols = true; }
+        else if (same_key (key, key_len, "nrows")) { nrows = atoi (value.c_str()); got_nrows = true; }
+        else if (same_key (key, key_len, "xllcorner")) { snprintf (xllcorner, sizeof (xllcorner), "%s", value.c_str()); got_xll = true; }
+        else if (same_key (key, key_len, "yllcorner")) { snprintf (yllcorner, sizeof (yllcorner), "%s", value.c_str()); got_yll = true; }
+        else if (same_key (key, key_len, "cellsize")) { snprintf (cellsize, sizeof (cellsize), "%s", value.c_str()); got_cellsize = true; }
+        else if (same_key (key, key_len, "nodata_value")) { nodataflag = atof (value.c_str()); got_nodata = true; }
+    }
+    if (!got_ncols) { cout << "FILE READ FAILURE!, need 'ncols'" << endl; exit(2); }
+    if (!got_nrows) { cout << "FILE READ FAILURE!, need 'nrows'" << endl; exit(2); }
+    if (!got_xll) { cout << "FILE READ FAILURE!, need 'xllcorner'" << endl; exit(2); }
+    if (!got_yll) { cout << "FILE READ FAILURE!, need 'yllcorner'" << endl; exit(2); }
+    if (!got_cellsize) { cout << "FILE READ FAILURE!, need 'cellsize'" << endl; exit(2); }
+    if (!got_nodata) { cout << "FILE READ FAILURE!, need 'nodata flag'" << endl; exit(2); }
+
+    // Check the size of the array
+    if (nrows <= 0 || ncols <= 0)
+    {
+        cout << "ERROR: invalid number of rows or columns in the file header!" << endl;
+        exit (7);
+    }
+}
+
 // -------------------------------------------------------------------------------
 // READ ARCGIS ASCII FUNCTION
 void read_ArcAscii_double ()
@@ -11,243 +256,432 @@ void read_ArcAscii_double ()
     believe it will work safely with arcGIS Ascii rasters created by this
     program and created by ArcGIS 10.
 
+    The file is memory mapped and the header is read in a single pass. The body is then
+    split into blocks at line breaks, and the blocks are parsed in parallel: first each
+    block counts its values, so it knows which cell it starts on, then it parses them.
+
     Global variable requirements:
     This program will also write to global variables:
-    in = input array, which is initialized with dimensions much bigger than necessary
+    in = input array, which is allocated here to the dimensions in the file header
     nrows = number of rows
     ncols = number of columns
-    ascii_header = a string that contains GIS info, this gets written out again in the output file
     infile = ostringstream with the location of the file
     xllcorner, yllcorner, cellsize, nodataflag = projection parameters
-    max_ncol, max_nrow = maximum size of in array
     */
     cout << "-------------------------------------------------------------" << endl;
     cout << "Beginning ArcGIS Ascii file read . . ." << endl;
-    FILE *pFile;
-    int scan = 0;       // dummy scan variable
-    pFile = fopen ( infile.str().c_str() , "r");
-    if (pFile == NULL)
+    double t_start = omp_get_wtime();
+
+    mapped_file file;
+    if (!file.open_read (infile.str().c_str()))
     {
         cout << "ERROR: cannot find input file!" << endl;
         exit (10);
     }
+    const char *p = file.data;
+    const char *e = file.data + file.size;
 
     //=========================================================================================
-    // Search 1: look for the number of columns
-    int fail_cntr = 0;
-    char read1[4];
-    do
+    // Read the header, and check the size of the array and allocate the input grid to match
+    parse_ArcAscii_header (p, e);
+    in.allocate (celltype, nrows, ncols);
+    in.valid.allocate (nrows, ncols);
+    in.first_touch ();          // the blocks of text do not follow the rows (see raster.hpp)
+
+    //=========================================================================================
+    // Split the body into blocks, each block ends at a line break (or if there are no line
+    // breaks nearby, at a space) so no number is ever split between two blocks
+    const char *body = p;
+    const size_t body_len = (size_t) (e - body);
+    const int nblocks = max (1, min (omp_get_max_threads() * 8, (int) (body_len >> 16) + 1));
+    vector<const char *> cut (nblocks + 1);
+    cut[0] = body;
+    cut[nblocks] = e;
+    for (int b = 1; b < nblocks; b++)
     {
-        scan = fscanf (pFile, "%s", read1);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'ncols'" << endl; exit(2); }
+        const char *q = max (cut[b - 1], body + body_len / nblocks * b);
+        const char *nl = (const char *) memchr (q, '\n', min ((size_t) (e - q), (size_t) 1 << 20));
+        if (nl != NULL)
+        {
+            q = nl + 1;
+        }
+        else
+        {
+            while (q < e && !is_blank (*q)) q++;
+        }
+        cut[b] = q;
     }
-    while ( strcmp (read1, "ncols") != 0 &&
-           strcmp (read1, "NCOLS") != 0);
 
-    // The next integer should be the number of columns
-    scan = fscanf (pFile, "%d", &ncols);
-
-    //=========================================================================================
-    // Search 2: look for the number of rows
-    rewind(pFile);      // rewind to the beginning again
-    fail_cntr = 0;
-    char read2[4];
-    do
+    // Count the values in each block, then the starting cell of each block is the running total
+    vector<long long> first (nblocks + 1, 0);
+    #pragma omp parallel for schedule (dynamic, 1)
+    for (int b = 0; b < nblocks; b++)
+    {
+        first[b + 1] = count_values (cut[b], cut[b + 1]);
+    }
+    for (int b = 0; b < nblocks; b++)
+    {
+        first[b + 1] += first[b];
+    }
+    const long long ncells = (long long) nrows * ncols;
+    if (first[nblocks] < ncells)
     {
-        scan = fscanf (pFile, "%s", read2);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'nrows'" << endl; exit(2); }
+        cout << "ERROR #2: problem with input file, expected " << ncells << " values but found "
+             << first[nblocks] << endl;
+        exit(2);
     }
-    while ( strcmp (read2, "nrows") != 0 &&
-           strcmp (read2, "NROWS") != 0);
-    // The next integer should be the number of rows
-    scan = fscanf (pFile, "%d", &nrows);
 
-    //=========================================================================================
-    // Search 3: look for the xllcorner
-    rewind(pFile);      // rewind to the beginning again
-    fail_cntr = 0;
-    char read3[9];
-    do
+    // Parse the blocks in parallel, marking which cells have values as they are stored
+    if (!parse_blocks (cut, first, ncells))
     {
-        scan = fscanf (pFile, "%s", read3);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'xllcorner'" << endl; exit(2); }
+        cout << "ERROR #2: problem with input file" << endl;
+        exit(2);
     }
-    while ( strcmp (read3, "xllcorner") != 0 &&
-           strcmp (read3, "XLLCORNER") != 0);
-    // The next string should be the xll corner
-    scan = fscanf (pFile, "%s", xllcorner);
+    const double megabytes = (double) file.size / (1024.0 * 1024.0);
+    file.close ();
+    in.build_index ();          // values in each tile (see raster.hpp)
 
-    //=========================================================================================
-    // Search 4: look for the yllcorner
-    rewind(pFile);      // rewind to the beginning again
-    fail_cntr = 0;
-    char read4[9];
-    do
+    // Print the operation to the console
+    double t_read = omp_get_wtime() - t_start;
+    time_t nowTime;
+    struct tm * timeString;
+    time (&nowTime);
+    timeString = localtime (&nowTime);
+
+    cout << "FILE read into memory successfully, Time: " << asctime(timeString) << endl;
+    cout << "Read " << megabytes << " MB in " << t_read << " s (" << megabytes / max (t_read, 1e-9)
+         << " MB/s)" << endl;
+    cout << "Number of rows: " << nrows << endl;
+    cout << "Number of columns: " << ncols << endl;
+    cout << "XLL corner: " << xllcorner << endl;
+    cout << "YLL corner: " << yllcorner << endl;
+    cout << "Cellsize: " << cellsize << endl;
+    cout << "NODATA_value: " << nodataflag << endl;
+    cout << "Cell type: " << cell_type_name (in.type) << endl;
+    cout << "First number read: " << in.get (0, 0) << endl;
+    cout << "-------------------------------------------------------------" << endl;
+}
+
+// -------------------------------------------------------------------------------
+// ARCGIS ASCII ROW READER: reads the rows one after another, for streaming
+class ascii_row_reader
+{
+public:
+    double megabytes;           // size of the file
+
+    // map the file and read the header, this sets the global dimensions and projection parameters
+    void open (const char *path)
     {
-        scan = fscanf (pFile, "%s", read4);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'yllcorner'" << endl; exit(2); }
+        if (!file.open_read (path))
+        {
+            cout << "ERROR: cannot find input file!" << endl;
+            exit (10);
+        }
+        file.sequential ();
+        p = file.data;
+        e = file.data + file.size;
+        parse_ArcAscii_header (p, e);
+        nodata = nodataflag;
+        dropped = 0;
+        megabytes = (double) file.size / (1024.0 * 1024.0);
     }
-    while ( strcmp (read4, "yllcorner") != 0 &&
-           strcmp (read4, "YLLCORNER") != 0);
-    // The next string should be the yll corner
-    scan = fscanf (pFile, "%s", yllcorner);
 
-    //=========================================================================================
-    // Search 5: look for the cellsize
-    rewind(pFile);      // rewind to the beginning again
-    fail_cntr = 0;
-    char read5[9];
-    do
+    // read the next 'count' rows into 'band', starting at row 'dst' of the band
+    void read_rows (raster_buffer &band, int dst, int count)
     {
-        scan = fscanf (pFile, "%s", read5);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'yllcorner'" << endl; exit(2); }
+        vector<double> row (band.ncols);
+        for (int r = 0; r < count; r++)
+        {
+            for (int j = 0; j < band.ncols; j++)
+            {
+                while (p < e && is_blank (*p)) p++;
+                if (p == e || !parse_number (p, e, row[j]))
+                {
+                    cout << "ERROR #2: problem with input file" << endl;
+                    exit(2);
+                }
+            }
+            band.put_row (dst + r, &row[0], nodata);
+        }
+        size_t used = (size_t) (p - file.data);
+        file.drop (dropped, used);      // the text behind us is finished with
+        dropped = used;
     }
-    while ( strcmp (read5, "cellsize") != 0 &&
-           strcmp (read5, "CELLSIZE") != 0);
-    // The next float should be the yll corner
-    scan = fscanf (pFile, "%s", cellsize);
 
-    //=========================================================================================
-    // Search 6: look for the nodata flag value (which should be -9999.0)
-    rewind(pFile);      // rewind to the beginning again
-    fail_cntr = 0;
-    char read6[9];
+private:
+    mapped_file file;
+    const char *p;              // next character to read
+    const char *e;              // end of the file
+    double nodata;              // nodata flag in the file
+    size_t dropped;             // bytes of the file already released
+};
+
+// -------------------------------------------------------------------------------
+// TEXT FORMATTING FUNCTIONS
+
+// write the digits of n, returns the end of the text
+inline char * format_uint (char *dst, unsigned long long n)
+{
+    char tmp[24];
+    int len = 0;
     do
     {
-        scan = fscanf (pFile, "%s", read6);
-        fail_cntr++;
-        if (fail_cntr == 100) { cout << "FILE READ FAILURE!, need 'nodata flag'" << endl; exit(2); }
+        tmp[len++] = (char) ('0' + n % 10);
+        n /= 10;
     }
-    while ( strcmp (read6, "nodata_value") != 0 &&
-           strcmp (read6, "NODATA_value") != 0 &&
-           strcmp (read6, "NODATA_VALUE") != 0);
-    // The next float should be the yll corner
-    scan = fscanf (pFile, "%lf", &nodataflag);
-
-    //=========================================================================================
-    // Check the size of the array to make sure its not too big
-    if (nrows > max_nrow || ncols > max_ncol)
+    while (n != 0);
+    while (len > 0)
     {
-        cout << "ERROR!!!: too many rows or columns: contact Tom and/or recompile with larger memory allocation" << endl;
-        exit (7);
+        *dst++ = tmp[--len];
     }
+    return dst;
+}
 
-    //=========================================================================================
-    // OK, now we should be situated correctly to start reading in the body of the file
-    // Read in the body of the file starting here, the next piece of text should be the start of the file
-    for (int i = 0; i < nrows; i++)
+// Write v with 'precision' decimals, identical to printf ("%.*f"), returns the end of the text.
+// The whole and fractional parts are split exactly, and the fraction is scaled and rounded
+// with integers. The scaling can be off by a rounding error, so when the fraction is too
+// close to a half to be sure which way printf would round it, printf does the work instead.
+inline char * format_value (char *dst, double v, int precision)
+{
+    double a = fabs (v);
+    if (precision <= 9 && a < 1e15)
     {
-        for (int j = 0; j < ncols; j++)
+        unsigned long long whole = (unsigned long long) a;
+        double scaled = (a - (double) whole) * pow10_exact[precision];
+        unsigned long long frac = (unsigned long long) scaled;
+        double rem = scaled - (double) frac;
+        if (fabs (rem - 0.5) > 1e-6)
         {
-            scan = fscanf (pFile, "%lf", &in[i][j]);
-            if (scan != 1)
+            if (rem > 0.5)
+            {
+                frac++;
+                if (frac == (unsigned long long) pow10_exact[precision])
+                {
+                    frac = 0;
+                    whole++;
+                }
+            }
+            if (signbit (v))
             {
-                cout << "ERROR #2: problem with input file" << endl;
-                exit(2);
+                *dst++ = '-';
             }
+            dst = format_uint (dst, whole);
+            if (precision > 0)
+            {
+                *dst++ = '.';
+                char *end = dst + precision;
+                for (char *q = end - 1; q >= dst; q--)
+                {
+                    *q = (char) ('0' + frac % 10);
+                    frac /= 10;
+                }
+                dst = end;
+            }
+            return dst;
         }
     }
-    fclose (pFile);
+    return dst + sprintf (dst, "%.*f", precision, v);
+}
+
+// the nodata value with as few digits as read back exactly, e.g. -9999 or -3.4028234663852886e+38
+string nodata_text ()
+{
+    char text[40];
+    for (int digits = 6; digits <= 17; digits++)
+    {
+        sprintf (text, "%.*g", digits, nodataflag);
+        if (strtod (text, NULL) == nodataflag)
+        {
+            break;
+        }
+    }
+    return text;
+}
+
+// -------------------------------------------------------------------------------
+// ARCGIS ASCII WRITER: formats rows in parallel and writes them in order
+class ascii_grid_writer
+{
+public:
+    double bytes;               // number of bytes written
+
+    ascii_grid_writer () : bytes (0.0), pFile (NULL), precision (6) {}
+    ~ascii_grid_writer () { close (); }
+
+    bool open (const char *path, int decimals)
+    {
+        close ();
+        pFile = fopen (path, "w");
+        precision = decimals;
+        bytes = 0.0;
+        return pFile != NULL;
+    }
+
+    void write_text (const string &text)
+    {
+        fwrite (text.data(), 1, text.size(), pFile);
+        bytes += (double) text.size();
+    }
 
-    // Check and potentially correct a nodata flag that is something other than -9999.0
-    if (nodataflag != -9999.0)
+    // write rows r0 to r1 of 'grid': blocks of rows are formatted into separate buffers
+    // by each thread, then the buffers are written out in order
+    void write_rows (const raster_buffer &grid, int r0, int r1)
     {
-        for (int i = 0; i < nrows; i++)
+        const int nrow = r1 - r0;
+        if (nrow <= 0)
+        {
+            return;
+        }
+        const int nblocks = min (nrow, omp_get_max_threads() * 4);
+        if ((int) text.size() < nblocks)
+        {
+            text.resize (nblocks);
+        }
+
+        // 'nodata' cells are written as the header's nodata value: in the same fixed notation as
+        // the other cells if that reads back as the same number (e.g. -9999.000000), otherwise
+        // the same as the header (e.g. -3.4e+38, rather than 39 digits)
+        const double nodata_cell = grid.stored (nodataflag);
+        char nodata[400];
+        char *end = format_value (nodata, nodataflag, precision);
+        *end = '\0';
+        if (!(fabs (nodataflag) < 1e15) || strtod (nodata, NULL) != nodataflag)
         {
-            for (int j = 0; j < ncols; j++)
+            strcpy (nodata, nodata_text().c_str());
+        }
+        const size_t nodata_len = strlen (nodata);
+
+        #pragma omp parallel
+        {
+            vector<double> row (grid.ncols);
+            char cell[400];         // enough for any double in fixed notation
+            #pragma omp for schedule (dynamic, 1)
+            for (int b = 0; b < nblocks; b++)
             {
-                if (in[i][j] == nodataflag)
+                string &buf = text[b];
+                buf.clear ();
+                for (int i = r0 + (int) ((long long) nrow * b / nblocks);
+                     i < r0 + (int) ((long long) nrow * (b + 1) / nblocks); i++)
                 {
-                    in[i][j] = -9999.0;
+                    grid.get_row (i, &row[0]);
+                    for (int j = 0; j < grid.ncols; j++)
+                    {
+                        char *end;
+                        if (row[j] == nodata_cell)
+                        {
+                            memcpy (cell, nodata, nodata_len);
+                            end = cell + nodata_len;
+                        }
+                        else
+                        {
+                            end = format_value (cell, row[j], precision);
+                        }
+                        *end++ = (j == grid.ncols - 1) ? '\n' : ' ';
+                        buf.append (cell, end - cell);
+                    }
                 }
             }
         }
-        cout << "WARNING: your Arc ASCII file has a nodata value of " << nodataflag << endl;
-        cout << "Please note: I've changed it to -9999.0" << endl;
-        nodataflag = -9999.0;
+        for (int b = 0; b < nblocks; b++)
+        {
+            write_text (text[b]);
+        }
     }
 
-    // Print the operation to the console
-    time_t nowTime;
-    struct tm * timeString;
-    time (&nowTime);
-    timeString = localtime (&nowTime);
+    bool close ()
+    {
+        bool ok = true;
+        if (pFile != NULL)
+        {
+            ok = (ferror (pFile) == 0);
+            ok = (fclose (pFile) == 0) && ok;
+        }
+        pFile = NULL;
+        return ok;
+    }
 
-    cout << "FILE read into memory successfully, Time: " << asctime(timeString) << endl;
-    cout << "Number of rows: " << nrows << endl;
-    cout << "Number of columns: " << ncols << endl;
-    cout << "XLL corner: " << xllcorner << endl;
-    cout << "YLL corner: " << yllcorner << endl;
-    cout << "Cellsize: " << cellsize << endl;
-    cout << "NODATA_value: " << nodataflag << endl;
-    cout << "First number read: " << in[0][0] << endl;
-    cout << "-------------------------------------------------------------" << endl;
+private:
+    FILE *pFile;
+    int precision;              // number of decimals
+    vector<string> text;        // formatted rows, one buffer per block
+};
+
+// header text of an ArcGIS Ascii file for the global projection parameters
+string arc_ascii_header ()
+{
+    ostringstream header;
+    header << "ncols " << ncols << "\n";
+    header << "nrows " << nrows << "\n";
+    header << "xllcorner " << xllcorner << "\n";
+    header << "yllcorner " << yllcorner << "\n";
+    header << "cellsize " << cellsize << "\n";
+    header << "NODATA_value " << nodata_text() << "\n";
+    return header.str();
 }
 
 // -------------------------------------------------------------------------------
 // OUTPUT FUNCTION
-void oput_ArcAscii_float()
+void oput_ArcAscii_float (const raster_buffer &grid, const string &name)
 {
     /*
-    Arguments: the main argument is a stringstream of the output file
+    Arguments: the grid to write (normally the 'out' array) and the name of the output file
 
     The ArcGIS Ascii file has a header that consists of 6 rows of header info
     The file format is not standardized, so this tool may go haywire, but I
     believe it will work safely with arcGIS Ascii rasters created by this
     program and created by ArcGIS 10.
 
+    The rows are written in batches of roughly 32 MB of text, the rows of each batch are
+    formatted in parallel and then written out in order with large writes.
+
     Global requirements:
-    This program will write out files from the 'out' array.
     The number of rows and columns are required in objects 'nrows' and 'ncols'
     The GIS data are required, in the following global variables
     xllcorner = x lower left corner
     yllcorner = y lower left cornter
     cellsize = cellsize
-    nodataflag = should be -9999.0
+    nodataflag = the nodata value of the input file, written for the 'nodata' cells
+    precision = number of decimals written for each value
     */
     cout << "-------------------------------------------------------------" << endl;
     cout << "Beginning ArcGIS Ascii file output . . ." << endl;
+    double t_start = omp_get_wtime();
+
     // output the file
-    FILE * pFile;
-    pFile = fopen ( outfile.str().c_str() , "w");
+    ascii_grid_writer writer;
+    if (!writer.open (name.c_str(), precision))
+    {
+        cout << "ERROR: cannot open output file!" << endl;
+        exit (10);
+    }
 
     // Write the header
-    ostringstream header;
-    header << "ncols " << ncols << "\n";
-    header << "nrows " << nrows << "\n";
-    header << "xllcorner " << xllcorner << "\n";
-    header << "yllcorner " << yllcorner << "\n";
-    header << "cellsize " << cellsize << "\n";
-    header << "NODATA_value " << nodataflag << "\n";
-
-    // write header to the file stream
-    fprintf (pFile, "%s", header.str().c_str());
+    string header = arc_ascii_header ();
+    writer.write_text (header);
 
     // Now, write the rest of the file out
-    for (int i = 0; i < nrows; i++)
+    const int batch = max (1, (int) ((32 << 20) / ((long long) ncols * (precision + 8))));
+    for (int i = 0; i < nrows; i += batch)
     {
-        for (int j = 0; j < (ncols - 2); j++)
-        {
-            fprintf (pFile, "%f ", out[i][j]);
-        }
-        fprintf (pFile, "%f", out[i][ncols - 2]);
-        fprintf (pFile, " %f", out[i][ncols - 1]);
-        fprintf (pFile, "%s", "\n");    // endline character
+        writer.write_rows (grid, i, min (nrows, i + batch));
+    }
+    double megabytes = writer.bytes / (1024.0 * 1024.0);
+    if (!writer.close ())
+    {
+        cout << "ERROR: problem writing the output file!" << endl;
+        exit (10);
     }
-    fclose (pFile);
 
     // Print the operation to the console
+    double t_write = omp_get_wtime() - t_start;
     time_t nowTime;
     struct tm * timeString;
     time (&nowTime);
     timeString = localtime (&nowTime);
 
-    cout << "Header values:\n" << header.str().c_str();
+    cout << "Header values:\n" << header.c_str();
+    cout << "Wrote " << megabytes << " MB in " << t_write << " s (" << megabytes / max (t_write, 1e-9)
+         << " MB/s)" << endl;
     cout << "FILE output to hard disk successfully, Time: " << asctime(timeString) << endl;
     cout << "-------------------------------------------------------------" << endl;
 }
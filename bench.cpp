@@ -0,0 +1,600 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Benchmarks on synthetic terrain
+
+/*
+Times the filter on synthetic grids (see tfil_synth.hpp) over a sweep of grid sizes,
+proportions of 'nodata' cells, radii, function codes and numbers of threads, so changes to
+the calculation modules can be measured and compared, and slowdowns caught, without any real
+data. Build it with 'make bench', then e.g.:
+
+bench.exe --sizes=1000,4000 --radii=5,25,100 --codes=m,f,e,mdr --nodata=0,0.3 --threads=1,2,4,8
+
+Each grid is generated once and written to a temporary file (--io=flt, the default, or asc).
+Every run then goes through the same steps as filter.exe: the file is read, filtered and the
+output written, each step timed on its own with the OpenMP wall clock. With --io=none the grid
+is generated straight into memory and only the calculations are timed. Every run is repeated
+(--repeat=N, default 3) and the fastest time of each step is kept.
+
+The report (--report=FILE, default bench.csv) has one line for each run: the sweep point, the
+read, compute and write times in seconds, the cells filtered per second of calculation, and the
+speedup and parallel efficiency of the calculations over the fewest threads of the sweep for
+the same grid, radius and code. A report name ending in .json is written as JSON instead. The
+messages of the modules go to a log file (--log=FILE, default bench.log), the console has one
+line for each run.
+
+Options:
+--sizes=LIST      grid sizes, N for N x N or ROWSxCOLS (default 2000)
+--radii=LIST      radii in cells (default 5,25)
+--codes=LIST      function codes, as for filter.exe (default m,f,d,e)
+--nodata=LIST     proportions of 'nodata' cells, 0.0 to 1.0 (default 0,0.3)
+--threads=LIST    numbers of threads (default 1, 2, 4 ... up to the number of processors)
+--repeat=N        runs of each point, the fastest is reported (default 3)
+--seed=N          seed of the synthetic terrain (default 1)
+--io=FORMAT       flt (default), asc or none
+--dir=DIR         directory for the temporary grids (default the current directory)
+--report=FILE     the report, CSV or (ending in .json) JSON
+--log=FILE        the messages of the modules
+--dem=FILE        only write the synthetic grid of the first size and proportion to FILE
+and --celltype, --simd, --minmax, --edges and --hugepages, the same as for filter.exe.
+*/
+
+#define CHUNKSIZE 100      // define parallel chunksize for dynamic scheduling in OpenMP
+
+#include <string.h>
+#include <ctype.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/time.h>
+#include <math.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>        // file mapping
+#else
+#include <sys/mman.h>       // file mapping
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TFIL_X86_SIMD               // vectorised sums for x86 processors (tfil_simd.hpp)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Include header files
+#include "raster.hpp"               // runtime-sized raster storage
+#include "tfil_mask.hpp"            // filter mask and sliding window lookups
+#include "tfil_globals.hpp"         // global variable declarations
+#include "tfil_probe.hpp"           // run report and progress
+#include "mapped_file.hpp"          // memory-mapped files
+#include "ascii_readwrite.hpp"      // functions for reading and writing ArcGIS ascii files
+#include "flt_readwrite.hpp"        // functions for reading and writing ESRI binary grids
+#include "tfil_tiles.hpp"           // cache-blocked tile scheduling
+#include "tfil_simd.hpp"            // vectorised sliding sums
+#include "tfil_extreme.hpp"         // minimum and maximum with monotonic deques
+#include "tfil_stats.hpp"           // several statistics in one pass
+#include "tfil_rect.hpp"            // rectangular window modules
+#include "tfil_order.hpp"           // median and percentiles
+#include "tfil_class.hpp"           // majority, minority and variety
+#include "tfil_border.hpp"          // partial windows at the edges
+#include "tfil_func.hpp"            // main filter function
+#include "tfil_batch.hpp"           // multi-radius batch mode
+#include "tfil_synth.hpp"           // synthetic terrain
+
+// -------------------------------------------------------------------------------
+// BENCHMARK SETTINGS
+vector<int> bench_rows;                 // rows and columns of each grid size
+vector<int> bench_cols;
+vector<double> bench_radii;             // radii, smallest first
+vector<string> bench_codes;             // function codes
+vector<double> bench_missing;           // proportions of 'nodata' cells
+vector<int> bench_threads;              // numbers of threads
+int bench_repeat = 3;                   // runs of each point
+unsigned int bench_seed = 1;            // seed of the synthetic terrain
+string bench_io = "flt";                // format of the temporary grids: flt, asc or none
+string bench_dir = ".";                 // directory of the temporary grids
+string bench_report = "bench.csv";      // the report
+string bench_log = "bench.log";         // the messages of the modules
+string bench_dem;                       // only write the synthetic grid to this file
+
+// one run of the sweep, with the fastest time of each step
+struct bench_run
+{
+    int nrows;
+    int ncols;
+    double missing;
+    double radius;
+    string code;
+    int threads;
+    double t_read;
+    double t_compute;
+    double t_write;
+    double speedup;                     // of the calculations, over the fewest threads
+    double efficiency;                  // speedup for each extra thread
+};
+
+// -------------------------------------------------------------------------------
+// OPTION FUNCTIONS
+
+// split a comma separated list into its items
+void split_list (const char *text, vector<string> &items)
+{
+    items.clear ();
+    string item;
+    for (const char *p = text; ; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            items.push_back (item);
+            item.clear ();
+            if (*p == '\0')
+            {
+                break;
+            }
+        }
+        else
+        {
+            item += *p;
+        }
+    }
+}
+
+// a whole number of at least 'least', or exits
+int bench_int (const string &text, int least, const char *what)
+{
+    char *stop = NULL;
+    const long v = strtol (text.c_str(), &stop, 10);
+    if (text.empty() || *stop != '\0' || v < least || v > 1000000000L)
+    {
+        cout << "ERROR: invalid " << what << ": " << text << endl;
+        exit(5);
+    }
+    return (int) v;
+}
+
+// parses a single '--name=value' option
+void parse_bench_option (const char *opt)
+{
+    const char *eq = strchr (opt, '=');
+    string name = eq ? string (opt + 2, eq) : string (opt + 2);
+    const char *val = eq ? eq + 1 : "";
+    vector<string> items;
+    split_list (val, items);
+
+    if (name == "sizes")
+    {
+        bench_rows.clear ();
+        bench_cols.clear ();
+        for (size_t k = 0; k < items.size(); k++)
+        {
+            const size_t x = items[k].find ('x');
+            const int nr = bench_int (items[k].substr (0, x), 1, "grid size");
+            bench_rows.push_back (nr);
+            bench_cols.push_back (x == string::npos ? nr : bench_int (items[k].substr (x + 1), 1, "grid size"));
+        }
+    }
+    else if (name == "radii")
+    {
+        if (!parse_radii (val, bench_radii))
+        {
+            cout << "ERROR: the radii must be a list of numbers separated by commas" << endl;
+            exit(5);
+        }
+    }
+    else if (name == "codes")
+    {
+        bench_codes = items;
+        for (size_t k = 0; k < items.size(); k++)
+        {
+            vector<tfil_stat> s;
+            vector<double> p;
+            if (!parse_stats (items[k], s, p))
+            {
+                cout << "ERROR: unknown function code: " << items[k] << endl;
+                exit(5);
+            }
+        }
+    }
+    else if (name == "nodata")
+    {
+        bench_missing.clear ();
+        for (size_t k = 0; k < items.size(); k++)
+        {
+            char *stop = NULL;
+            const double v = strtod (items[k].c_str(), &stop);
+            if (items[k].empty() || *stop != '\0' || !(v >= 0.0 && v <= 1.0))
+            {
+                cout << "ERROR: the proportion of nodata cells must be between 0.0 and 1.0" << endl;
+                exit(5);
+            }
+            bench_missing.push_back (v);
+        }
+    }
+    else if (name == "threads")
+    {
+        bench_threads.clear ();
+        for (size_t k = 0; k < items.size(); k++)
+        {
+            bench_threads.push_back (bench_int (items[k], 1, "number of threads"));
+        }
+        sort (bench_threads.begin(), bench_threads.end());
+        bench_threads.erase (unique (bench_threads.begin(), bench_threads.end()), bench_threads.end());
+    }
+    else if (name == "repeat")
+    {
+        bench_repeat = bench_int (val, 1, "number of repeats");
+    }
+    else if (name == "seed")
+    {
+        bench_seed = (unsigned int) bench_int (val, 0, "seed");
+    }
+    else if (name == "io")
+    {
+        bench_io = val;
+        if (bench_io != "flt" && bench_io != "asc" && bench_io != "none")
+        {
+            cout << "ERROR: unknown grid format: " << val << endl;
+            exit(5);
+        }
+    }
+    else if (name == "dir")
+    {
+        bench_dir = val;
+    }
+    else if (name == "report")
+    {
+        bench_report = val;
+    }
+    else if (name == "log")
+    {
+        bench_log = val;
+    }
+    else if (name == "dem")
+    {
+        bench_dem = val;
+    }
+    else if (name == "celltype")
+    {
+        if (!parse_cell_type (val, celltype))
+        {
+            cout << "ERROR: unknown cell type: " << val << endl;
+            exit(5);
+        }
+    }
+    else if (name == "simd")
+    {
+        const string v = val;
+        simd_lanes = (v == "avx512") ? 8 : (v == "avx2") ? 4 : (v == "off") ? 1 : -1;
+        if (v != "auto" && simd_lanes < 0)
+        {
+            cout << "ERROR: unknown instruction set: " << val << endl;
+            exit(5);
+        }
+    }
+    else if (name == "minmax" && (strcmp (val, "cache") == 0 || strcmp (val, "deque") == 0))
+    {
+        extreme_deque = (strcmp (val, "deque") == 0);
+    }
+    else if (name == "edges" && (strcmp (val, "nodata") == 0 || strcmp (val, "partial") == 0))
+    {
+        edge_partial = (strcmp (val, "partial") == 0);
+    }
+    else if (name == "hugepages" && (strcmp (val, "off") == 0 || strcmp (val, "thp") == 0
+                                     || strcmp (val, "explicit") == 0))
+    {
+        raster_huge_pages = (strcmp (val, "off") == 0) ? 0 : (strcmp (val, "thp") == 0) ? 1 : 2;
+    }
+    else
+    {
+        cout << "ERROR: unknown option: " << opt << endl;
+        exit(5);
+    }
+}
+
+// -------------------------------------------------------------------------------
+// GRID FILE FUNCTIONS
+
+// writes 'grid' (with 'nodata' in the cells without a value) to 'name', in the format of its name
+void oput_grid (raster_buffer &grid, const string &name)
+{
+    if (is_binary_grid_name (name))
+    {
+        oput_EsriFlt (grid, name);
+    }
+    else
+    {
+        oput_ArcAscii_float (grid, name);
+    }
+}
+
+// removes the file(s) of grid 'name'
+void remove_grid (const string &name)
+{
+    if (is_binary_grid_name (name))
+    {
+        remove (binary_grid_file (name, ".hdr").c_str());
+        remove (binary_grid_file (name, ".flt").c_str());
+    }
+    else
+    {
+        remove (name.c_str());
+    }
+}
+
+// sets the header globals of a synthetic grid of nr rows and nc columns
+void synth_header (int nr, int nc)
+{
+    nrows = nr;
+    ncols = nc;
+    nodataflag = -9999.0;
+    strcpy (xllcorner, "0");
+    strcpy (yllcorner, "0");
+    strcpy (cellsize, "1");
+}
+
+// -------------------------------------------------------------------------------
+// RUN FUNCTION: filters the grid once, the same way as filter.exe, with the function code,
+// radius and files already in the globals, and the time of each step
+void bench_once (double &t_read, double &t_compute, double &t_write)
+{
+    const bool files = (bench_io != "none");
+    const double t0 = omp_get_wtime();
+    if (files)
+    {
+        if (in_binary)
+        {
+            read_EsriFlt();
+        }
+        else
+        {
+            read_ArcAscii_double();
+        }
+    }
+    const double t1 = omp_get_wtime();
+
+    vector<raster_buffer> outs;
+    if (stats.size() > 1)
+    {
+        calc_tfil_batch (outs);
+    }
+    else
+    {
+        init_tfil();
+        run_tfil();
+    }
+    const double t2 = omp_get_wtime();
+
+    if (!files)
+    {
+        outs.clear ();
+        out.release ();
+    }
+    else if (stats.size() > 1)
+    {
+        oput_tfil_batch (outs);
+    }
+    else
+    {
+        oput_grid (out, outfile.str());
+        out.release ();
+    }
+    const double t3 = omp_get_wtime();
+
+    if (files)
+    {
+        in.release ();
+        flt_in_map.close ();
+    }
+    t_read = t1 - t0;
+    t_compute = t2 - t1;
+    t_write = t3 - t2;
+}
+
+// -------------------------------------------------------------------------------
+// REPORT FUNCTIONS
+
+// writes the runs as CSV
+void report_csv (ostream &f, const vector<bench_run> &runs)
+{
+    f << "rows,cols,nodata,radius,code,threads,celltype,io,read_s,compute_s,write_s,total_s,"
+      << "cells_per_s,speedup,efficiency\n";
+    for (size_t k = 0; k < runs.size(); k++)
+    {
+        const bench_run &r = runs[k];
+        f << r.nrows << "," << r.ncols << "," << r.missing << "," << r.radius << "," << r.code << ","
+          << r.threads << "," << cell_type_name (celltype) << "," << bench_io << "," << r.t_read << ","
+          << r.t_compute << "," << r.t_write << "," << r.t_read + r.t_compute + r.t_write << ","
+          << (double) r.nrows * r.ncols / max (r.t_compute, 1e-9) << "," << r.speedup << ","
+          << r.efficiency << "\n";
+    }
+}
+
+// writes the runs as JSON, with the settings shared by all of them
+void report_json (ostream &f, const vector<bench_run> &runs)
+{
+    f << "{\n  \"processors\": " << omp_get_num_procs() << ",\n"
+      << "  \"simd\": \"" << simd_name (simd_lanes_used ()) << "\",\n"
+      << "  \"celltype\": \"" << cell_type_name (celltype) << "\",\n"
+      << "  \"io\": \"" << bench_io << "\",\n"
+      << "  \"seed\": " << bench_seed << ",\n"
+      << "  \"repeat\": " << bench_repeat << ",\n"
+      << "  \"runs\": [\n";
+    for (size_t k = 0; k < runs.size(); k++)
+    {
+        const bench_run &r = runs[k];
+        f << "    {\"rows\": " << r.nrows << ", \"cols\": " << r.ncols << ", \"nodata\": " << r.missing
+          << ", \"radius\": " << r.radius << ", \"code\": \"" << r.code << "\", \"threads\": " << r.threads
+          << ", \"read_s\": " << r.t_read << ", \"compute_s\": " << r.t_compute << ", \"write_s\": "
+          << r.t_write << ", \"cells_per_s\": " << (double) r.nrows * r.ncols / max (r.t_compute, 1e-9)
+          << ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency << "}"
+          << (k + 1 < runs.size() ? "," : "") << "\n";
+    }
+    f << "  ]\n}\n";
+}
+
+// -------------------------------------------------------------------------------
+// MAIN
+int main(int nArgs, char *pszArgs[])
+{
+    // The defaults, then the options
+    bench_rows.push_back (2000);
+    bench_cols.push_back (2000);
+    bench_radii.push_back (5);
+    bench_radii.push_back (25);
+    split_list ("m,f,d,e", bench_codes);
+    bench_missing.push_back (0.0);
+    bench_missing.push_back (0.3);
+    for (int p = 1; p < omp_get_num_procs(); p *= 2)
+    {
+        bench_threads.push_back (p);
+    }
+    bench_threads.push_back (omp_get_num_procs());
+    for (int a = 1; a < nArgs; a++)
+    {
+        if (strncmp (pszArgs[a], "--", 2) != 0)
+        {
+            cout << "ERROR: unknown argument: " << pszArgs[a] << " (see bench.cpp for the options)" << endl;
+            exit(5);
+        }
+        parse_bench_option (pszArgs[a]);
+    }
+    const string ext = (bench_io == "asc") ? ".asc" : ".flt";
+    const string dem_name = bench_dir + "/bench_dem" + ext;
+    const bool files = (bench_io != "none");
+
+    // Only the synthetic grid
+    if (!bench_dem.empty())
+    {
+        raster_buffer dem;
+        synth_header (bench_rows[0], bench_cols[0]);
+        synth_grid (dem, celltype, nrows, ncols, bench_seed, bench_missing[0], nodataflag, false);
+        oput_grid (dem, bench_dem);
+        return 0;
+    }
+
+    // The messages of the modules go to the log, the console has one line for each run
+    ofstream log (bench_log.c_str());
+    if (!log)
+    {
+        cout << "ERROR: cannot open the log file: " << bench_log << endl;
+        exit(5);
+    }
+    ostream console (cout.rdbuf (log.rdbuf()));
+    console << "Benchmarks on synthetic terrain, " << omp_get_num_procs() << " processors, vector instructions: "
+            << simd_name (simd_lanes_used ()) << ", cell type: " << cell_type_name (celltype) << endl;
+    console << "   rows    cols nodata  radius code     threads  read_s   compute_s  write_s  Mcells/s efficiency"
+            << endl;
+
+    vector<bench_run> runs;
+    infile.str (dem_name);
+    outfile.str (bench_dir + "/bench_out" + ext);
+    in_binary = is_binary_grid_name (dem_name);
+    out_binary = in_binary;
+    for (size_t g = 0; g < bench_rows.size(); g++)
+    {
+        for (size_t q = 0; q < bench_missing.size(); q++)
+        {
+            // The grid, in memory or written to the temporary file
+            synth_header (bench_rows[g], bench_cols[g]);
+            if (files)
+            {
+                raster_buffer dem;
+                synth_grid (dem, cell_float32, nrows, ncols, bench_seed, bench_missing[q], nodataflag, false);
+                oput_grid (dem, dem_name);
+            }
+            else
+            {
+                synth_grid (in, celltype, nrows, ncols, bench_seed, bench_missing[q], nodataflag, true);
+            }
+
+            for (size_t k = 0; k < bench_radii.size(); k++)
+            {
+                for (size_t c = 0; c < bench_codes.size(); c++)
+                {
+                    rad = bench_radii[k];
+                    radii.assign (1, rad);
+                    funcode.str (bench_codes[c]);
+                    parse_stats (bench_codes[c], stats, percentiles);
+                    filter_mask m;
+                    int req_valcount = 0;
+                    const char *problem = build_window (m, req_valcount, command_line_spec (), rad, nrows, ncols);
+                    if (problem != NULL)
+                    {
+                        console << "Skipped radius " << rad << " on " << nrows << " x " << ncols << ": " << problem
+                                << endl;
+                        continue;
+                    }
+                    const size_t first = runs.size();
+                    for (size_t p = 0; p < bench_threads.size(); p++)
+                    {
+                        omp_set_num_threads (bench_threads[p]);
+                        bench_run r;
+                        r.nrows = nrows;
+                        r.ncols = ncols;
+                        r.missing = bench_missing[q];
+                        r.radius = rad;
+                        r.code = bench_codes[c];
+                        r.threads = bench_threads[p];
+                        r.t_read = r.t_compute = r.t_write = numeric_limits<double>::max();
+                        for (int n = 0; n < bench_repeat; n++)
+                        {
+                            double t_read, t_compute, t_write;
+                            bench_once (t_read, t_compute, t_write);
+                            r.t_read = min (r.t_read, t_read);
+                            r.t_compute = min (r.t_compute, t_compute);
+                            r.t_write = min (r.t_write, t_write);
+                        }
+                        const bench_run &base = (p == 0) ? r : runs[first];
+                        r.speedup = base.t_compute / max (r.t_compute, 1e-9);
+                        r.efficiency = r.speedup * base.threads / r.threads;
+                        runs.push_back (r);
+
+                        char line[200];
+                        sprintf (line, "%7d %7d %6.3f %7g %-8s %7d %9.4f %9.4f %9.4f %9.2f %9.3f", r.nrows, r.ncols,
+                                 r.missing, r.radius, r.code.c_str(), r.threads, r.t_read, r.t_compute, r.t_write,
+                                 (double) r.nrows * r.ncols / max (r.t_compute, 1e-9) / 1e6, r.efficiency);
+                        console << line << endl;
+                    }
+                    for (size_t s = 0; files && s < stats.size(); s++)
+                    {
+                        remove_grid (batch_file_name (0, s));
+                    }
+                }
+            }
+            if (files)
+            {
+                remove_grid (dem_name);
+            }
+        }
+    }
+    cout.rdbuf (console.rdbuf());
+
+    // The report
+    ofstream report (bench_report.c_str());
+    const size_t dot = bench_report.find_last_of ('.');
+    if (dot != string::npos && bench_report.substr (dot) == ".json")
+    {
+        report_json (report, runs);
+    }
+    else
+    {
+        report_csv (report, runs);
+    }
+    if (!report)
+    {
+        cout << "ERROR: problem writing the report: " << bench_report << endl;
+        exit(10);
+    }
+    cout << "Report written to " << bench_report << ", messages of the modules to " << bench_log << endl;
+    return 0;
+}
@@ -0,0 +1,253 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Checks of the calculation modules against the reference filter
+
+/*
+Filters synthetic grids (see tfil_synth.hpp) with the cases below, each one a grid, a window,
+a function code and the settings of the command line, and checks every output against the
+reference filter of --verify (see tfil_verify.hpp). The cases are the ones the sliding modules
+have got wrong before, or could: grids with more different values than a histogram of the
+whole grid could hold, windows one cell high or wide, high values with 'nodata' cells,
+integer variances of exactly a half.
+Build and run it with 'make check'. Each case prints one line, with the messages of the
+modules and the verify report only if it fails, and the program exits with status 11 if any
+case fails.
+*/
+
+#define CHUNKSIZE 100      // define parallel chunksize for dynamic scheduling in OpenMP
+
+#include <string.h>
+#include <ctype.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/time.h>
+#include <math.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>        // file mapping
+#else
+#include <sys/mman.h>       // file mapping
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TFIL_X86_SIMD               // vectorised sums for x86 processors (tfil_simd.hpp)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Include header files
+#include "raster.hpp"               // runtime-sized raster storage
+#include "tfil_mask.hpp"            // filter mask and sliding window lookups
+#include "tfil_globals.hpp"         // global variable declarations
+#include "tfil_probe.hpp"           // run report and progress
+#include "mapped_file.hpp"          // memory-mapped files
+#include "ascii_readwrite.hpp"      // functions for reading and writing ArcGIS ascii files
+#include "flt_readwrite.hpp"        // functions for reading and writing ESRI binary grids
+#include "tfil_tiles.hpp"           // cache-blocked tile scheduling
+#include "tfil_simd.hpp"            // vectorised sliding sums
+#include "tfil_extreme.hpp"         // minimum and maximum with monotonic deques
+#include "tfil_stats.hpp"           // several statistics in one pass
+#include "tfil_rect.hpp"            // rectangular window modules
+#include "tfil_order.hpp"           // median and percentiles
+#include "tfil_class.hpp"           // majority, minority and variety
+#include "tfil_border.hpp"          // partial windows at the edges
+#include "tfil_func.hpp"            // main filter function
+#include "tfil_batch.hpp"           // multi-radius batch mode
+#include "tfil_verify.hpp"          // reference filter and --verify
+#include "tfil_synth.hpp"           // synthetic terrain
+
+// -------------------------------------------------------------------------------
+// CASES
+struct check_case
+{
+    const char *what;                   // what the case checks
+    int nrows;                          // the synthetic grid
+    int ncols;
+    double missing;                     // proportion of 'nodata' cells
+    double offset;                      // added to the elevations (200 to 1200)
+    const char *celltype;
+    const char *radii;                  // the radius, or a list of radii
+    const char *code;                   // function code
+    double frac;                        // nontoxic proportion
+    const char *window;                 // window shape
+    bool partial;                       // --edges=partial
+    long long cells;                    // cells checked (0 for every cell)
+    int levels;                         // integer cells cut down to this many values (0 for all)
+};
+
+const check_case check_cases[] =
+{
+    {"median and percentiles, more than 2^20 values", 1500, 1200, 0.1, 0.0, "float64", "4", "ep10p90", 0.5, "circle",
+     false, 200000, 0},
+    {"classes, more than 2^20 values, partial edges", 1500, 1200, 0.1, 0.0, "float64", "3", "eoy", 0.3, "circle",
+     true, 200000, 0},
+    {"every statistic, float32", 300, 400, 0.2, 0.0, "float32", "5", "msfcvdrnep25oiy", 0.6, "circle", false, 0, 0},
+    {"every statistic, int16, partial edges", 300, 400, 0.2, 0.0, "int16", "4", "msfcvdrnep25oiy", 0.4, "circle",
+     true, 0, 0},
+    {"batch of radii", 300, 400, 0.2, 0.0, "float64", "2,5,9", "mfe", 0.7, "circle", false, 0, 0},
+    {"one-row window", 300, 400, 0.2, 0.0, "float32", "0", "msvep90oy", 0.5, "1x21", false, 0, 0},
+    {"one-column window", 300, 400, 0.2, 0.0, "float32", "0", "msvep90oy", 0.5, "21x1", false, 0, 0},
+    {"one-row window, mean alone", 300, 400, 0.2, 0.0, "int32", "0", "m", 0.5, "1x31", false, 0, 0},
+    {"one-column window, maximum alone", 300, 400, 0.2, 0.0, "int32", "0", "c", 0.5, "31x1", false, 0, 0},
+    {"variance, high values with nodata", 600, 500, 0.1, 1e7, "float64", "3", "vd", 1.0, "circle", false, 0, 0},
+    {"variance, high values, fewer valid cells", 600, 500, 0.1, 1e7, "float64", "3", "vd", 0.3, "circle", false, 0,
+     0},
+    {"variance, high values, radius 12", 600, 500, 0.1, 1e7, "float64", "12", "vd", 0.3, "circle", false, 0, 0},
+    {"variance, high values, square window", 600, 500, 0.1, 1e7, "float64", "5", "vd", 0.5, "square", false, 0, 0},
+    {"variance, high values, partial edges", 600, 500, 0.1, 1e7, "float64", "4", "vd", 0.3, "circle", true, 0, 0},
+    {"variance, .5 ties, int16", 300, 400, 0.5, 0.0, "int16", "1", "vd", 0.0, "square", false, 0, 4},
+    {"variance, .5 ties, int32, partial edges", 300, 400, 0.5, 0.0, "int32", "2.5", "vd", 0.0, "circle", true, 0, 4},
+};
+
+// -------------------------------------------------------------------------------
+// CHECK FUNCTIONS
+
+// cuts the values of integer grid g down to the values 0 to levels - 1, so that many windows
+// have a variance of exactly a half of something, which has to round up
+template <typename T>
+void cut_levels (raster_view<T> g, int levels)
+{
+    for (int i = 0; i < g.nrows; i++)
+    {
+        for (int j = 0; j < g.ncols; j++)
+        {
+            if (g.has (i, j))
+            {
+                g[i][j] = (T) ((g[i][j] % levels + levels) % levels);
+            }
+        }
+    }
+}
+
+// the number of different values of the input
+long long distinct_values ()
+{
+    vector<double> v;
+    raster_view<double> g = in.view<double>();
+    for (int i = 0; i < nrows; i++)
+    {
+        for (int j = 0; j < ncols; j++)
+        {
+            if (g.has (i, j))
+            {
+                v.push_back (g[i][j]);
+            }
+        }
+    }
+    sort (v.begin(), v.end());
+    return (long long) (unique (v.begin(), v.end()) - v.begin());
+}
+
+// runs case c the same way as filter.exe, and checks it against the reference, 'log' has the
+// messages of the modules
+bool run_check (const check_case &c, ostream &log, string &note)
+{
+    // The settings of the command line
+    if (!parse_cell_type (c.celltype, celltype) || !parse_window_shape (c.window, window, window_rows, window_cols)
+        || !parse_radii (c.radii, radii) || !parse_stats (c.code, stats, percentiles))
+    {
+        note = "bad case";
+        return false;
+    }
+    rad = radii[0];
+    funcode.str (c.code);
+    nontoxic_frac = c.frac;
+    edge_partial = c.partial;
+
+    // The grid
+    nrows = c.nrows;
+    ncols = c.ncols;
+    nodataflag = -9999.0;
+    synth_grid (in, celltype, nrows, ncols, 1, c.missing, nodataflag, true);
+    if (c.offset != 0.0)
+    {
+        raster_view<double> g = in.view<double>();
+        for (int i = 0; i < nrows; i++)
+        {
+            for (int j = 0; j < ncols; j++)
+            {
+                g[i][j] += g.has (i, j) ? c.offset : 0.0;
+            }
+        }
+    }
+    if (c.levels > 0 && celltype == cell_int16)
+    {
+        cut_levels (in.view<short>(), c.levels);
+    }
+    if (c.levels > 0 && celltype == cell_int32)
+    {
+        cut_levels (in.view<int>(), c.levels);
+    }
+    if (celltype == cell_float64)
+    {
+        ostringstream n;
+        n << distinct_values () << " values";
+        note = n.str();
+    }
+
+    // The outputs, and the reference
+    vector<raster_buffer> outs;
+    vector<raster_buffer *> grids;
+    if (radii.size() > 1 || stats.size() > 1)
+    {
+        calc_tfil_batch (outs);
+        for (size_t k = 0; k < outs.size(); k++)
+        {
+            grids.push_back (&outs[k]);
+        }
+    }
+    else
+    {
+        init_tfil();
+        run_tfil();
+        grids.push_back (&out);
+    }
+    string json;
+    const bool passed = verify_tfil (grids, c.cells > 0 ? c.cells : (long long) nrows * ncols, json);
+    log << json << endl;
+    out.release ();
+    in.release ();
+    return passed;
+}
+
+// -------------------------------------------------------------------------------
+// MAIN
+int main ()
+{
+    const int ncases = (int) (sizeof (check_cases) / sizeof (check_cases[0]));
+    int failed = 0;
+    for (int k = 0; k < ncases; k++)
+    {
+        // The messages of the modules are kept, and only printed if the case fails
+        ostringstream log;
+        streambuf *console = cout.rdbuf (log.rdbuf());
+        string note;
+        const double t_start = omp_get_wtime();
+        const bool passed = run_check (check_cases[k], log, note);
+        cout.rdbuf (console);
+
+        char line[200];
+        sprintf (line, "%-6s %-50s %-16s %6.2f s", passed ? "ok" : "FAILED", check_cases[k].what, note.c_str(),
+                 omp_get_wtime() - t_start);
+        cout << line << endl;
+        if (!passed)
+        {
+            cout << log.str();
+            failed++;
+        }
+    }
+    cout << (failed == 0 ? "All checks passed" : "CHECKS FAILED") << " (" << ncases - failed << " of " << ncases
+         << ")" << endl;
+    return (failed == 0) ? 0 : 11;
+}
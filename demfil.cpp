@@ -0,0 +1,162 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// C interface of the filter engine (libdemfil), see demfil.h
+
+/*
+The calculation modules are compiled into namespace demfil, so their names (and the globals
+of the command line program, which the engine does not use) stay out of the way of the
+program they are linked into. Only the functions of demfil.h are exported from the shared
+library.
+*/
+
+#define CHUNKSIZE 100      // define parallel chunksize for dynamic scheduling in OpenMP
+
+#include <string.h>
+#include <ctype.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/time.h>
+#include <math.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+#include <stddef.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>        // file mapping
+#else
+#include <sys/mman.h>       // file mapping
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TFIL_X86_SIMD               // vectorised sums for x86 processors (tfil_simd.hpp)
+#include <immintrin.h>
+#endif
+
+#include "demfil.h"
+
+namespace demfil
+{
+using namespace std;
+
+#include "raster.hpp"               // runtime-sized raster storage
+#include "tfil_mask.hpp"            // filter mask and sliding window lookups
+#include "tfil_globals.hpp"         // global variable declarations
+#include "tfil_probe.hpp"           // run report and progress
+#include "mapped_file.hpp"          // memory-mapped files
+#include "ascii_readwrite.hpp"      // functions for reading and writing ArcGIS ascii files
+#include "flt_readwrite.hpp"        // functions for reading and writing ESRI binary grids
+#include "tfil_tiles.hpp"           // cache-blocked tile scheduling
+#include "tfil_simd.hpp"            // vectorised sliding sums
+#include "tfil_extreme.hpp"         // minimum and maximum with monotonic deques
+#include "tfil_stats.hpp"           // several statistics in one pass
+#include "tfil_rect.hpp"            // rectangular window modules
+#include "tfil_order.hpp"           // median and percentiles
+#include "tfil_class.hpp"           // majority, minority and variety
+#include "tfil_border.hpp"          // partial windows at the edges
+#include "tfil_func.hpp"            // main filter function
+#include "tfil_engine.hpp"          // filter engine for grids in memory
+}
+
+// -------------------------------------------------------------------------------
+// C INTERFACE
+struct demfil_filter
+{
+    demfil::tfil_engine engine;
+    std::vector<std::string> names;     // output names, kept for demfil_output_name
+};
+
+// copies message msg into err (err_len bytes), if there is an err
+static void demfil_error (const char *msg, char *err, size_t err_len)
+{
+    if (err != NULL && err_len > 0)
+    {
+        strncpy (err, msg, err_len - 1);
+        err[err_len - 1] = '\0';
+    }
+}
+
+demfil_filter * demfil_create (const char *code, double radius, const char *window,
+                               double nontoxic_frac, int partial_edges, char *err, size_t err_len)
+{
+    demfil_filter *f = new demfil_filter;
+    const char *problem = f->engine.configure (code, radius, window, nontoxic_frac, partial_edges != 0);
+    if (problem != NULL)
+    {
+        demfil_error (problem, err, err_len);
+        delete f;
+        return NULL;
+    }
+    for (int s = 0; s < f->engine.outputs(); s++)
+    {
+        f->names.push_back (f->engine.output_tag (s));
+    }
+    return f;
+}
+
+int demfil_outputs (const demfil_filter *f)
+{
+    return f->engine.outputs();
+}
+
+const char * demfil_output_name (const demfil_filter *f, int s)
+{
+    if (s < 0 || s >= (int) f->names.size())
+    {
+        return NULL;
+    }
+    return f->names[s].c_str();
+}
+
+int demfil_run (const demfil_filter *f, int cell_type, const void *in, ptrdiff_t in_stride,
+                int nrows, int ncols, double nodata, void *const *outs,
+                const ptrdiff_t *out_strides, char *err, size_t err_len)
+{
+    demfil::cell_type t;
+    switch (cell_type)
+    {
+        case DEMFIL_INT16: t = demfil::cell_int16; break;
+        case DEMFIL_INT32: t = demfil::cell_int32; break;
+        case DEMFIL_FLOAT32: t = demfil::cell_float32; break;
+        case DEMFIL_FLOAT64: t = demfil::cell_float64; break;
+        default:
+            demfil_error ("unknown cell type", err, err_len);
+            return -1;
+    }
+
+    // The strides in cells
+    const ptrdiff_t size = (ptrdiff_t) demfil::cell_type_size (t);
+    std::vector<ptrdiff_t> strides (f->engine.outputs());
+    bool aligned = (in_stride % size == 0);
+    for (int s = 0; s < f->engine.outputs(); s++)
+    {
+        aligned = aligned && (out_strides[s] % size == 0);
+        strides[s] = out_strides[s] / size;
+    }
+    if (!aligned)
+    {
+        demfil_error ("the row strides must be whole numbers of cells", err, err_len);
+        return -1;
+    }
+
+    const char *problem = f->engine.run (t, in, in_stride / size, nrows, ncols, nodata, outs,
+                                         strides.empty() ? NULL : &strides[0]);
+    if (problem != NULL)
+    {
+        demfil_error (problem, err, err_len);
+        return -1;
+    }
+    return 0;
+}
+
+void demfil_destroy (demfil_filter *f)
+{
+    delete f;
+}
@@ -0,0 +1,78 @@
+/* Generic filter program for performing 'focal statistics' in parallel with OpenMP
+   C interface of the filter engine, for grids in memory (libdemfil) */
+
+/*
+Build with 'make lib' (libdemfil.a and libdemfil.so), link with -fopenmp.
+
+A filter is created once, with the same settings as the command line program, and can then
+filter any number of grids. The grids belong to the caller: 'in' points at the first cell,
+the rows are 'in_stride' bytes apart, and the cells equal to 'nodata' have no value. There is
+one output grid for each statistic of the function code, in the same cell type as the input,
+written in place (outs[s], with rows out_strides[s] bytes apart). The output cells without a
+value are set to 'nodata'. Filters can run at the same time from different threads, and one
+filter can run several grids at the same time; each run uses all the OpenMP threads.
+
+Example: the mean and standard deviation in a circle of radius 25 cells
+
+    char err[200];
+    demfil_filter *f = demfil_create ("md", 25.0, NULL, 0.0, 0, err, sizeof (err));
+    void *outs[2] = { mean, stdev };
+    ptrdiff_t strides[2] = { ncols * sizeof (float), ncols * sizeof (float) };
+    demfil_run (f, DEMFIL_FLOAT32, dem, ncols * sizeof (float), nrows, ncols, -9999.0,
+                outs, strides, err, sizeof (err));
+    demfil_destroy (f);
+*/
+
+#ifndef DEMFIL_H
+#define DEMFIL_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define DEMFIL_API
+#else
+#define DEMFIL_API __attribute__ ((visibility ("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* cell types of the grids */
+enum demfil_cell_type
+{
+    DEMFIL_INT16 = 0,
+    DEMFIL_INT32 = 1,
+    DEMFIL_FLOAT32 = 2,
+    DEMFIL_FLOAT64 = 3
+};
+
+typedef struct demfil_filter demfil_filter;
+
+/* creates a filter: the function code (one letter for each statistic, e.g. "m" or "mdr", as
+   for the command line program), the radius in cells, the window shape ("circle", "square"
+   or ROWSxCOLS, NULL for a circle), the proportion of the window required to have values and
+   partial windows at the edges (0 or 1). Returns NULL if the settings are wrong, with the
+   reason in err (err_len bytes, err can be NULL) */
+DEMFIL_API demfil_filter * demfil_create (const char *code, double radius, const char *window,
+                                          double nontoxic_frac, int partial_edges,
+                                          char *err, size_t err_len);
+
+/* number of output grids, one for each statistic */
+DEMFIL_API int demfil_outputs (const demfil_filter *f);
+
+/* short name of the statistic of output s, e.g. "mean" or "p90" */
+DEMFIL_API const char * demfil_output_name (const demfil_filter *f, int s);
+
+/* filters a grid, returns 0, or -1 with the reason in err (err_len bytes, err can be NULL) */
+DEMFIL_API int demfil_run (const demfil_filter *f, int cell_type, const void *in, ptrdiff_t in_stride,
+                           int nrows, int ncols, double nodata, void *const *outs,
+                           const ptrdiff_t *out_strides, char *err, size_t err_len);
+
+DEMFIL_API void demfil_destroy (demfil_filter *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,429 @@
+// Generic read/write functions for ESRI binary float grids (.flt/.hdr)
+
+/*
+An ESRI binary grid is a pair of files with the same name: a small text header (.hdr) with
+the same keys as an ArcGIS Ascii header plus 'byteorder', and the cells (.flt) as raw 32 bit
+floats, row by row from the top. Either file name can be given on the command line.
+
+The .flt file is memory mapped. If the grid is stored as float32 cells (--celltype=float32)
+and the file is in the byte order of this computer, the input grid is the mapping itself:
+the cells are never copied or converted. The 'nodata' cells are set to zero in place for
+the validity plane (see raster.hpp), which only copies the pages that contain nodata (the
+file itself is never changed).
+Likewise a float32 output grid is mapped from the output file, so the filter writes its
+results straight into the file. Other cell types are converted row by row, in parallel.
+*/
+
+mapped_file flt_in_map;             // mapping of the input cells
+mapped_file flt_out_map;            // mapping of the output cells
+
+// -------------------------------------------------------------------------------
+// FILE NAME FUNCTIONS
+
+// true if the file name ends with .flt or .hdr (any case)
+bool is_binary_grid_name (const string &path)
+{
+    if (path.size() < 4)
+    {
+        return false;
+    }
+    const char *ext = path.c_str() + path.size() - 4;
+    return same_key (ext, 4, ".flt") || same_key (ext, 4, ".hdr");
+}
+
+// file name with the extension replaced by 'ext'
+string binary_grid_file (const string &path, const char *ext)
+{
+    return path.substr (0, path.size() - 4) + ext;
+}
+
+// true if this computer stores the least significant byte first
+bool host_lsb_first ()
+{
+    const unsigned int one = 1;
+    return *(const unsigned char *) &one == 1;
+}
+
+inline float swap_float (float f)
+{
+    unsigned char b[4], r[4];
+    memcpy (b, &f, 4);
+    r[0] = b[3];
+    r[1] = b[2];
+    r[2] = b[1];
+    r[3] = b[0];
+    memcpy (&f, r, 4);
+    return f;
+}
+
+// -------------------------------------------------------------------------------
+// HEADER FUNCTION: reads the pairs of key and value in a .hdr file, returns true if the
+// cells are stored least significant byte first
+bool read_EsriFlt_header (const string &hdrname)
+{
+    FILE *pFile = fopen (hdrname.c_str(), "r");
+    if (pFile == NULL)
+    {
+        cout << "ERROR: cannot find input header file: " << hdrname << endl;
+        exit (10);
+    }
+    bool got_ncols = false, got_nrows = false, got_xll = false, got_yll = false, got_cellsize = false;
+    bool lsb_first = true;          // ESRI's default byte order
+    nodataflag = -9999.0;           // the nodata flag is optional in a .hdr file
+    char key[100], value[100];
+    while (fscanf (pFile, "%99s %99s", key, value) == 2)
+    {
+        size_t key_len = strlen (key);
+        if (same_key (key, key_len, "ncols")) { ncols = atoi (value); got_ncols = true; }
+        else if (same_key (key, key_len, "nrows")) { nrows = atoi (value); got_nrows = true; }
+        else if (same_key (key, key_len, "xllcorner")) { snprintf (xllcorner, sizeof (xllcorner), "%s", value); got_xll = true; }
+        else if (same_key (key, key_len, "yllcorner")) { snprintf (yllcorner, sizeof (yllcorner), "%s", value); got_yll = true; }
+        else if (same_key (key, key_len, "cellsize")) { snprintf (cellsize, sizeof (cellsize), "%s", value); got_cellsize = true; }
+        else if (same_key (key, key_len, "nodata_value")) { nodataflag = atof (value); }
+        else if (same_key (key, key_len, "byteorder")) { lsb_first = (toupper ((unsigned char) value[0]) != 'M'); }
+    }
+    fclose (pFile);
+    if (!got_ncols) { cout << "FILE READ FAILURE!, need 'ncols'" << endl; exit(2); }
+    if (!got_nrows) { cout << "FILE READ FAILURE!, need 'nrows'" << endl; exit(2); }
+    if (!got_xll) { cout << "FILE READ FAILURE!, need 'xllcorner'" << endl; exit(2); }
+    if (!got_yll) { cout << "FILE READ FAILURE!, need 'yllcorner'" << endl; exit(2); }
+    if (!got_cellsize) { cout << "FILE READ FAILURE!, need 'cellsize'" << endl; exit(2); }
+    if (nrows <= 0 || ncols <= 0)
+    {
+        cout << "ERROR: invalid number of rows or columns in the file header!" << endl;
+        exit (7);
+    }
+    return lsb_first;
+}
+
+// -------------------------------------------------------------------------------
+// READ ESRI BINARY GRID FUNCTION
+void read_EsriFlt ()
+{
+    /*
+    Global variable requirements:
+    This program will also write to global variables:
+    in = input array, either the mapped file or allocated here
+    nrows = number of rows
+    ncols = number of columns
+    infile = ostringstream with the location of the file
+    xllcorner, yllcorner, cellsize, nodataflag = projection parameters
+    */
+    cout << "-------------------------------------------------------------" << endl;
+    cout << "Beginning ESRI binary grid file read . . ." << endl;
+    double t_start = omp_get_wtime();
+
+    //=========================================================================================
+    // Read the header
+    string hdrname = binary_grid_file (infile.str(), ".hdr");
+    string fltname = binary_grid_file (infile.str(), ".flt");
+    bool lsb_first = read_EsriFlt_header (hdrname);
+
+    //=========================================================================================
+    // Map the cells, copy-on-write if they have to be changed in place
+    const bool swap = (lsb_first != host_lsb_first());
+    const bool direct = (celltype == cell_float32);
+    bool mapped = direct ? flt_in_map.open_copy (fltname.c_str())
+                         : flt_in_map.open_read (fltname.c_str());
+    if (!mapped)
+    {
+        cout << "ERROR: cannot find input file: " << fltname << endl;
+        exit (10);
+    }
+    if (flt_in_map.size < (size_t) nrows * ncols * sizeof (float))
+    {
+        cout << "ERROR #2: problem with input file, it is smaller than the header says" << endl;
+        exit (2);
+    }
+    float *cells = (float *) flt_in_map.data;
+    const float nodata_cell = (float) nodataflag;
+
+    if (direct)
+    {
+        // The mapping is the input grid, fix the byte order and zero the 'nodata' cells in place,
+        // the rows are shared out the same way as the work, so the pages copied here and the
+        // validity bits are first touched where they are used (see raster.hpp)
+        in.attach (cell_float32, cells, nrows, ncols, ncols);
+        in.valid.allocate (nrows, ncols);
+        #pragma omp parallel for schedule (static)
+        for (int i = 0; i < nrows; i++)
+        {
+            float *row = cells + (size_t) i * ncols;
+            bit_word *bits = in.valid[i];
+            bit_word w = 0;
+            for (int j = 0; j < ncols; j++)
+            {
+                float v = swap ? swap_float (row[j]) : row[j];
+                const bool ok = (v == v && v != nodata_cell);    // NaN is 'nodata' too
+                if (!ok)
+                {
+                    v = 0.0f;
+                }
+                if (swap || v != row[j])
+                {
+                    row[j] = v;         // only touch (and copy) pages that change
+                }
+                w |= (bit_word) ok << (j & 63);
+                if ((j & 63) == 63 || j == ncols - 1)
+                {
+                    bits[j >> 6] = w;
+                    w = 0;
+                }
+            }
+        }
+    }
+    else
+    {
+        // Convert each row to the cell type of the input grid, the rows are shared out the same
+        // way as the work, so this is their first touch (see raster.hpp)
+        in.allocate (celltype, nrows, ncols);
+        in.valid.allocate (nrows, ncols);
+        #pragma omp parallel
+        {
+            vector<double> row (ncols);
+            #pragma omp for schedule (static)
+            for (int i = 0; i < nrows; i++)
+            {
+                const float *src = cells + (size_t) i * ncols;
+                for (int j = 0; j < ncols; j++)
+                {
+                    row[j] = swap ? swap_float (src[j]) : src[j];
+                }
+                in.put_row (i, &row[0], nodata_cell);
+            }
+        }
+        flt_in_map.close ();
+    }
+    in.build_index ();          // values in each tile (see raster.hpp)
+
+    // Print the operation to the console
+    double t_read = omp_get_wtime() - t_start;
+    double megabytes = (double) nrows * ncols * sizeof (float) / (1024.0 * 1024.0);
+    time_t nowTime;
+    struct tm * timeString;
+    time (&nowTime);
+    timeString = localtime (&nowTime);
+
+    cout << "FILE read into memory successfully, Time: " << asctime(timeString) << endl;
+    cout << "Read " << megabytes << " MB in " << t_read << " s (" << megabytes / max (t_read, 1e-9)
+         << " MB/s)" << (direct ? ", mapped directly" : "") << endl;
+    cout << "Number of rows: " << nrows << endl;
+    cout << "Number of columns: " << ncols << endl;
+    cout << "XLL corner: " << xllcorner << endl;
+    cout << "YLL corner: " << yllcorner << endl;
+    cout << "Cellsize: " << cellsize << endl;
+    cout << "NODATA_value: " << nodataflag << endl;
+    cout << "Byte order: " << (lsb_first ? "LSBFIRST" : "MSBFIRST") << endl;
+    cout << "Cell type: " << cell_type_name (in.type) << endl;
+    cout << "First number read: " << in.get (0, 0) << endl;
+    cout << "-------------------------------------------------------------" << endl;
+}
+
+// -------------------------------------------------------------------------------
+// ESRI BINARY ROW READER: reads the rows one after another, for streaming
+class flt_row_reader
+{
+public:
+    double megabytes;           // size of the cells
+
+    // map the file and read the header, this sets the global dimensions and projection parameters
+    void open (const string &path)
+    {
+        string fltname = binary_grid_file (path, ".flt");
+        swap = (read_EsriFlt_header (binary_grid_file (path, ".hdr")) != host_lsb_first());
+        nodata_cell = (float) nodataflag;
+        if (!file.open_read (fltname.c_str()))
+        {
+            cout << "ERROR: cannot find input file: " << fltname << endl;
+            exit (10);
+        }
+        if (file.size < (size_t) nrows * ncols * sizeof (float))
+        {
+            cout << "ERROR #2: problem with input file, it is smaller than the header says" << endl;
+            exit (2);
+        }
+        file.sequential ();
+        next = 0;
+        megabytes = (double) nrows * ncols * sizeof (float) / (1024.0 * 1024.0);
+    }
+
+    // read the next 'count' rows into 'band', starting at row 'dst' of the band
+    void read_rows (raster_buffer &band, int dst, int count)
+    {
+        const float *cells = (const float *) file.data;
+        const int nc = band.ncols;
+        #pragma omp parallel
+        {
+            vector<double> row (nc);
+            #pragma omp for schedule (dynamic, 1)
+            for (int r = 0; r < count; r++)
+            {
+                const float *src = cells + (size_t) (next + r) * nc;
+                for (int j = 0; j < nc; j++)
+                {
+                    row[j] = swap ? swap_float (src[j]) : src[j];
+                }
+                band.put_row (dst + r, &row[0], nodata_cell);
+            }
+        }
+        file.drop ((size_t) next * nc * sizeof (float), (size_t) (next + count) * nc * sizeof (float));
+        next += count;
+    }
+
+private:
+    mapped_file file;
+    bool swap;                  // true if the bytes of each cell must be reversed
+    float nodata_cell;          // nodata flag in the file
+    int next;                   // next row to read
+};
+
+// -------------------------------------------------------------------------------
+// ESRI BINARY ROW WRITER: writes the rows one after another, for streaming
+class flt_row_writer
+{
+public:
+    double bytes;               // number of bytes written
+
+    flt_row_writer () : bytes (0.0), pFile (NULL) {}
+    ~flt_row_writer () { close (); }
+
+    bool open (const string &path)
+    {
+        close ();
+        pFile = fopen (binary_grid_file (path, ".flt").c_str(), "wb");
+        bytes = 0.0;
+        return pFile != NULL;
+    }
+
+    // write rows r0 to r1 of 'grid' as floats in the byte order of this computer
+    void write_rows (const raster_buffer &grid, int r0, int r1)
+    {
+        const int nc = grid.ncols;
+        const double nodata_cell = grid.stored (nodataflag);      // 'nodata' in the grid
+        vector<double> row (nc);
+        vector<float> cells ((size_t) (r1 - r0) * nc);
+        for (int i = r0; i < r1; i++)
+        {
+            grid.get_row (i, &row[0]);
+            for (int j = 0; j < nc; j++)
+            {
+                cells[(size_t) (i - r0) * nc + j] = (float) ((row[j] == nodata_cell) ? nodataflag : row[j]);
+            }
+        }
+        fwrite (&cells[0], sizeof (float), cells.size(), pFile);
+        bytes += (double) cells.size() * sizeof (float);
+    }
+
+    bool close ()
+    {
+        bool ok = true;
+        if (pFile != NULL)
+        {
+            ok = (ferror (pFile) == 0);
+            ok = (fclose (pFile) == 0) && ok;
+        }
+        pFile = NULL;
+        return ok;
+    }
+
+private:
+    FILE *pFile;
+};
+
+// -------------------------------------------------------------------------------
+// HEADER OUTPUT FUNCTION: writes the .hdr file, in the byte order of this computer, and
+// returns the header text
+string write_EsriFlt_header (const string &hdrname)
+{
+    string header = arc_ascii_header ();
+    header += host_lsb_first() ? "byteorder LSBFIRST\n" : "byteorder MSBFIRST\n";
+    FILE *pFile = fopen (hdrname.c_str(), "w");
+    if (pFile == NULL)
+    {
+        cout << "ERROR: cannot open output file: " << hdrname << endl;
+        exit (10);
+    }
+    fprintf (pFile, "%s", header.c_str());
+    fclose (pFile);
+    return header;
+}
+
+// -------------------------------------------------------------------------------
+// MAP OUTPUT FUNCTION: for a float32 binary output, the output grid is the output file
+bool map_EsriFlt_output ()
+{
+    if (!out_binary || celltype != cell_float32)
+    {
+        return false;
+    }
+    string fltname = binary_grid_file (outfile.str(), ".flt");
+    if (!flt_out_map.create (fltname.c_str(), (size_t) nrows * ncols * sizeof (float)))
+    {
+        cout << "ERROR: cannot create output file: " << fltname << endl;
+        exit (10);
+    }
+    out.attach (cell_float32, flt_out_map.data, nrows, ncols, ncols);
+    return true;
+}
+
+// -------------------------------------------------------------------------------
+// OUTPUT ESRI BINARY GRID FUNCTION: writes 'grid' (normally the 'out' array) to the binary
+// grid 'name'
+void oput_EsriFlt (raster_buffer &grid, const string &name)
+{
+    cout << "-------------------------------------------------------------" << endl;
+    cout << "Beginning ESRI binary grid file output . . ." << endl;
+    double t_start = omp_get_wtime();
+
+    // Write the header, in the byte order of this computer
+    string header = write_EsriFlt_header (binary_grid_file (name, ".hdr"));
+    string fltname = binary_grid_file (name, ".flt");
+
+    // If the output grid is not already the mapped file, convert each row into it
+    bool direct = (flt_out_map.data != NULL && grid.data == flt_out_map.data);
+    if (!direct)
+    {
+        if (!flt_out_map.create (fltname.c_str(), (size_t) nrows * ncols * sizeof (float)))
+        {
+            cout << "ERROR: cannot create output file: " << fltname << endl;
+            exit (10);
+        }
+        float *cells = (float *) flt_out_map.data;
+        const double nodata_cell = grid.stored (nodataflag);      // 'nodata' in the output grid
+        #pragma omp parallel
+        {
+            // the rows are shared out the same way as the work, so each processor reads the rows
+            // of the output grid it wrote, and first touches the same rows of the file
+            vector<double> row (ncols);
+            #pragma omp for schedule (static)
+            for (int i = 0; i < nrows; i++)
+            {
+                grid.get_row (i, &row[0]);
+                float *dst = cells + (size_t) i * ncols;
+                for (int j = 0; j < ncols; j++)
+                {
+                    dst[j] = (float) ((row[j] == nodata_cell) ? nodataflag : row[j]);
+                }
+            }
+        }
+    }
+    else
+    {
+        grid.release ();        // the output grid is the mapping, which is about to close
+    }
+    flt_out_map.close ();       // the operating system writes the pages back to the file
+
+    // Print the operation to the console
+    double t_write = omp_get_wtime() - t_start;
+    double megabytes = (double) nrows * ncols * sizeof (float) / (1024.0 * 1024.0);
+    time_t nowTime;
+    struct tm * timeString;
+    time (&nowTime);
+    timeString = localtime (&nowTime);
+
+    cout << "Header values:\n" << header.c_str();
+    cout << "Wrote " << megabytes << " MB in " << t_write << " s (" << megabytes / max (t_write, 1e-9)
+         << " MB/s)" << (direct ? ", mapped directly" : "") << endl;
+    cout << "FILE output to hard disk successfully, Time: " << asctime(timeString) << endl;
+    cout << "-------------------------------------------------------------" << endl;
+}
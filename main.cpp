@@ -14,7 +14,7 @@ Compiler flags (recomended) for windows:
 -Wall -pedantic -O3 -fopenmp
 
 Compiler flags (recomended) for linux:
--Wall -pedantic -O3 -fopenmp -no-stack-protector
+-Wall -pedantic -O3 -fopenmp -fno-stack-protector
 
 Linked libraries:
 On Codeblocks you have to make sure the library 'libgomp-1.dll' is in the local copy
@@ -31,19 +31,104 @@ be issues with accuracy, there originally was a bug with the function when ArcGI
 I'd check ArcGIS closely.
 
 Arguments:
-1) input file name
-2) radius of test circle in cells
+1) input file name: an ArcGIS ASCII raster, or an ESRI binary float grid if the name ends
+    in .flt or .hdr (the .hdr and .flt files must sit side by side). Binary grids are
+    memory mapped, with --celltype=float32 the cells are used without any copy at all.
+2) radius of test circle in cells, or a comma separated list of radii (no spaces!), e.g.
+    5,10,25,50, to filter the grid with every radius in one run. The grid is read once and
+    one output is written for each radius, named with '_r' and the radius before the
+    extension of the output file name (out.asc gives out_r5.asc, out_r10.asc, ...).
 3) function code:
     m = mean
     s = sum
     f = minimum
     c = maximum
-4) output file
+    v = variance
+    d = standard deviation
+    r = range (maximum - minimum)
+    n = count (the number of values in the window)
+    e = median (the mean of the two middle values if the number of values is even)
+    pNN = percentile NN, from 0 to 100, e.g. p90 or p2.5 (the nearest rank)
+    o = majority (the most common value, the smallest if several are)
+    i = minority (the least common value in the window, the smallest if several are)
+    y = variety (the number of different values)
+    The last three are for grids of classes, e.g. land cover.
+    Several letters calculate several statistics in one pass, e.g. 'mdr' for the mean,
+    standard deviation and range, or 'ep10p90' for the median and the 10th and 90th
+    percentiles. One output is written for each statistic, named with the
+    statistic before the extension of the output file name (out.asc gives out_mean.asc,
+    out_std.asc and out_range.asc).
+4) output file: the format is chosen from the name, the same way as the input file
 5) required nontoxic proportion: the proportion of the filter circle required
     to be non-missing to output a value. This is optional, it is always set to 1.0,
     meaning all the circle is required to have values to report the output. The value must be between
     0.0 and 1.0. e.g., if nontoxic proportion is 1.0 and there is one missing value in the
-    sliding circle, the output value will be missing (-9999.0).
+    sliding circle, the output value will be missing (the nodata value of the input file).
+
+Options:
+Options start with '--' and can go anywhere on the command line.
+--celltype=TYPE
+    storage type of the input and output cells: int16, int32, float32 or float64 (default).
+    Smaller cells halve or quarter the memory use. Integer cells are rounded to the nearest
+    whole number, and saturate at the limits of the type (e.g. a large sum in int16).
+--precision=N
+    number of decimals written for each value in the output file, 0 to 17 (default 6).
+--stream or --stream=ROWS
+    stream the grid through memory instead of reading all of it: only a band of rows
+    a little taller than the filter circle is held at once, so grids much larger than
+    memory can be filtered. ROWS is the number of new rows read each step (the default
+    depends on the radius and the number of processors). The output of integer grids is the
+    same, and so are the minimum, maximum, range, count, median, percentiles, majority,
+    minority and variety of any grid. The mean, sum, variance and standard deviation of
+    floating point grids are summed from the start of each band rather than of each block
+    of rows, and can differ in the last digit.
+--window=SHAPE
+    shape of the filter window: 'circle' (default), 'square' (the radius is half of the side,
+    so radius 2 gives a 5 x 5 square), or ROWSxCOLS for a rectangle, e.g. 5x11 (odd numbers
+    of cells, the radius is then not used). Rectangles are calculated with summed-area tables
+    (mean, sum) and the van Herk / Gil-Werman method (minimum, maximum), the time taken
+    does not depend on the size of the window.
+--minmax=ENGINE
+    how the minimum and maximum of a circle are found: 'cache' (default) keeps the sliding
+    extremes of each input row for each width of the circle and reuses them for later output
+    rows, 'deque' slides a monotonic deque along each row of the circle. Both take the same
+    time on smooth or rough terrain. Where fewer than a quarter of the rows would be found
+    in the cache (very long rows, or few of them) 'cache' uses the deques instead.
+--minmaxcache=MB
+    memory for the 'cache' engine on each processor (default: what the circle needs, up to
+    64 MB). Less memory still works, but more of the rows are calculated twice.
+--tilecache=KB
+    the processors work on tiles of the grid (blocks of rows, stripes of columns) sized so
+    the input each tile reads stays in the cache. By default this is half of the level 2
+    cache reported by the operating system, set it to tune for a particular processor.
+--simd=SET
+    instruction set for the mean and sum of circles: 'auto' (default, the best the processor
+    has), 'avx512', 'avx2' or 'off'. Groups of 8 (AVX-512) or 4 (AVX2) rows slide together,
+    the output is exactly the same as 'off'.
+--edges=MODE
+    what to do with the cells closer to the edge of the grid than the radius: 'nodata'
+    (default) leaves them as 'nodata', 'partial' calculates them from the part of the window
+    inside the grid, and the nontoxic proportion is then of that part. With 'partial' the
+    window may be larger than the grid.
+--hugepages=MODE
+    page size for the large grids: 'off' (default), 'thp' asks the operating system for
+    transparent huge pages, 'explicit' takes them from the pool reserved by the administrator
+    (e.g. vm.nr_hugepages on linux), or transparent ones if there are not enough. Huge pages
+    save address translations when the circle reaches across many rows.
+--report or --report=FILE
+    keep count of what the run did and write it as JSON, next to the output (out.asc gives
+    out_report.json) or to FILE: the time of each phase (read, prepare, compute, write), and for
+    each thread the cells and tiles it calculated, the window sums it started from scratch,
+    the rows the minimum/maximum cache calculated again, the cells with 'nodata' in their
+    windows, and the time it was busy and waiting for the others (see tfil_probe.hpp).
+--progress or --progress=SECONDS
+    print the proportion of the work done and an estimate of the time left every 10 seconds
+    (or SECONDS) while the calculations run.
+--verify or --verify=N or --verify=full
+    check the output against a slow, simple reference filter before it is written, on 10000
+    cells spread over the grid (or N cells, or every cell with 'full'), and print the largest
+    errors and the cells that do not match. The program exits with status 11 if any cell does
+    not match (see tfil_verify.hpp). Not with --stream.
 
 All arguments are space separated in both linux and windows, for example, to run the program in
 windows (assuming you compiled it with binary name: filter.exe) with the input file 'input.asc',
@@ -60,6 +145,7 @@ Or in Linux, sometimes you need to add './' to the beginning:
 #define CHUNKSIZE 100      // define parallel chunksize for dynamic scheduling in OpenMP
 
 #include <string.h>
+#include <ctype.h>
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
@@ -67,26 +153,81 @@ Or in Linux, sometimes you need to add './' to the beginning:
 #include <sstream>
 #include <sys/time.h>
 #include <math.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <limits>
+#include <algorithm>
 #include <omp.h>            // note: for windows OpenMP requires special libraries, not
                             // found in stripped down versions of MinGW
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>        // file mapping
+#else
+#include <sys/mman.h>       // file mapping
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TFIL_X86_SIMD               // vectorised sums for x86 processors (tfil_simd.hpp)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 // Include header files
+#include "raster.hpp"               // runtime-sized raster storage
+#include "tfil_mask.hpp"            // filter mask and sliding window lookups
 #include "tfil_globals.hpp"         // global variable declarations
+#include "tfil_probe.hpp"           // run report and progress
+#include "mapped_file.hpp"          // memory-mapped files
 #include "ascii_readwrite.hpp"      // functions for reading and writing ArcGIS ascii files
+#include "flt_readwrite.hpp"        // functions for reading and writing ESRI binary grids
+#include "tfil_tiles.hpp"           // cache-blocked tile scheduling
+#include "tfil_simd.hpp"            // vectorised sliding sums
+#include "tfil_extreme.hpp"         // minimum and maximum with monotonic deques
+#include "tfil_stats.hpp"           // several statistics in one pass
+#include "tfil_rect.hpp"            // rectangular window modules
+#include "tfil_order.hpp"           // median and percentiles
+#include "tfil_class.hpp"           // majority, minority and variety
+#include "tfil_border.hpp"          // partial windows at the edges
 #include "tfil_func.hpp"            // main filter function
+#include "tfil_batch.hpp"           // multi-radius batch mode
+#include "tfil_verify.hpp"          // reference filter and --verify
+#include "tfil_stream.hpp"          // streaming (out-of-core) filter
 
 void print_man()
 {
     // Print some help on the arguments if there are issues with the input file
     cout << "This program requires 4 arguments:\n"
-        << "1) input file name (no spaces!), ArcGIS ASCII raster format\n"
-        << "2) radius of filter circle in cells\n"
-        << "3) function code, a single letter that is one of the following:\n"
+        << "1) input file name (no spaces!), ArcGIS ASCII raster format, or ESRI binary\n"
+        << "   grid format if the name ends in .flt or .hdr\n"
+        << "2) radius of filter circle in cells, or a list of radii e.g. 5,10,25 for one\n"
+        << "   output per radius, named e.g. oput_r5.asc, oput_r10.asc, oput_r25.asc\n"
+        << "3) function code, a letter that is one of the following:\n"
         << "  m = mean\n  s = sum\n  f = minimum (floor)\n  c = maximum (ceiling)\n"
-        << "4) output file name (no spaces!), ArcGIS ASCII raster format\n"
+        << "  v = variance\n  d = standard deviation\n  r = range\n  n = count of values\n"
+        << "  e = median\n  pNN = percentile NN (0 to 100), e.g. p90\n"
+        << "  o = majority\n  i = minority\n  y = variety (number of different values)\n"
+        << "   or several letters for several statistics in one pass, e.g. mdr\n"
+        << "4) output file name (no spaces!), format chosen the same way as the input\n"
         << "5) optional last argument is proportion of filter window required to report a value\n\n"
+        << "Options (anywhere on the command line, no spaces!):\n"
+        << "  --celltype=TYPE  storage for the input and output cells, one of int16, int32,\n"
+        << "                   float32 or float64 (default). Integer cells are rounded.\n"
+        << "  --precision=N    number of decimals in the output file (default 6)\n"
+        << "  --stream[=ROWS]  filter a band of rows at a time, for grids larger than memory\n"
+        << "  --window=SHAPE   circle (default), square, or ROWSxCOLS e.g. 5x11 (odd sizes)\n"
+        << "  --minmax=ENGINE  minimum/maximum engine for circles: cache (default) or deque\n"
+        << "  --minmaxcache=MB memory for the minimum/maximum cache on each processor\n"
+        << "  --tilecache=KB   cache size used to size the tiles of work (default automatic)\n"
+        << "  --simd=SET       vector instructions for mean and sum: auto, avx512, avx2 or off\n"
+        << "  --edges=MODE     edge cells: nodata (default) or partial (the window inside the grid)\n"
+        << "  --hugepages=MODE huge pages for the grids: off (default), thp or explicit\n"
+        << "  --report[=FILE]  write a JSON report of the run (default next to the output)\n"
+        << "  --progress[=S]   print the progress and time left every 10 (or S) seconds\n"
+        << "  --verify[=N]     check 10000 (or N, or 'full' for every) cells against a reference\n\n"
         << "Example:\nI want to filter the file 'test.asc', with a mean filter with circle\n"
         << "with radius 30 cells, and output file name 'oput.asc', I also don't\n"
         << "care if up to half of the filter circle is missing data.\n"
@@ -95,6 +236,223 @@ void print_man()
         << "filter.exe test.asc 30 m oput.asc 0.5\n\n" << endl;
 }
 
+// -------------------------------------------------------------------------------
+// OPTION FUNCTION: parses a single '--name=value' option
+void parse_option (const char *opt)
+{
+    const char *eq = strchr (opt, '=');
+    string name = eq ? string (opt + 2, eq) : string (opt + 2);
+    const char *val = eq ? eq + 1 : "";
+
+    if (name == "celltype")
+    {
+        if (!parse_cell_type (val, celltype))
+        {
+            cout << "ERROR: unknown cell type: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "precision")
+    {
+        precision = atoi (val);
+        if (precision < 0 || precision > 17 || *val == '\0')
+        {
+            cout << "ERROR: precision must be between 0 and 17 decimals" << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "stream")
+    {
+        stream_mode = true;
+        if (eq)
+        {
+            stream_margin = atoi (val);
+            if (stream_margin < 1)
+            {
+                cout << "ERROR: the streaming band must grow by at least 1 row" << endl;
+                print_man();
+                exit(5);
+            }
+        }
+    }
+    else if (name == "window")
+    {
+        if (!parse_window_shape (val, window, window_rows, window_cols))
+        {
+            cout << "ERROR: unknown window shape: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "minmax")
+    {
+        if (strcmp (val, "cache") == 0)
+        {
+            extreme_deque = false;
+        }
+        else if (strcmp (val, "deque") == 0)
+        {
+            extreme_deque = true;
+        }
+        else
+        {
+            cout << "ERROR: unknown minimum/maximum engine: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "minmaxcache")
+    {
+        extreme_cache_mb = atoi (val);
+        if (extreme_cache_mb < 1)
+        {
+            cout << "ERROR: the minimum/maximum cache must be at least 1 MB" << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "tilecache")
+    {
+        tile_cache_kb = atoi (val);
+        if (tile_cache_kb < 1)
+        {
+            cout << "ERROR: the tile cache size must be at least 1 KB" << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "simd")
+    {
+        if (strcmp (val, "auto") == 0)
+        {
+            simd_lanes = -1;
+        }
+        else if (strcmp (val, "avx512") == 0)
+        {
+            simd_lanes = 8;
+        }
+        else if (strcmp (val, "avx2") == 0)
+        {
+            simd_lanes = 4;
+        }
+        else if (strcmp (val, "off") == 0)
+        {
+            simd_lanes = 1;
+        }
+        else
+        {
+            cout << "ERROR: unknown instruction set: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "hugepages")
+    {
+        if (strcmp (val, "off") == 0)
+        {
+            raster_huge_pages = 0;
+        }
+        else if (strcmp (val, "thp") == 0)
+        {
+            raster_huge_pages = 1;
+        }
+        else if (strcmp (val, "explicit") == 0)
+        {
+            raster_huge_pages = 2;
+        }
+        else
+        {
+            cout << "ERROR: unknown huge page mode: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "report")
+    {
+        probe_on = true;
+        report_name = val;
+    }
+    else if (name == "progress")
+    {
+        probe_interval = eq ? atof (val) : 10.0;
+        if (!(probe_interval > 0.0))
+        {
+            cout << "ERROR: the progress interval must be more than 0 seconds" << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "verify")
+    {
+        verify_cells = !eq ? verify_sample : (strcmp (val, "full") == 0) ? numeric_limits<long long>::max() : atoll (val);
+        if (verify_cells < 1)
+        {
+            cout << "ERROR: the number of cells to verify must be at least 1, or 'full'" << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else if (name == "edges")
+    {
+        if (strcmp (val, "nodata") == 0)
+        {
+            edge_partial = false;
+        }
+        else if (strcmp (val, "partial") == 0)
+        {
+            edge_partial = true;
+        }
+        else
+        {
+            cout << "ERROR: unknown edge mode: " << val << endl;
+            print_man();
+            exit(5);
+        }
+    }
+    else
+    {
+        cout << "ERROR: unknown option: " << opt << endl;
+        print_man();
+        exit(5);
+    }
+}
+
+// -------------------------------------------------------------------------------
+// REPORT FUNCTION: writes the report of the run (see tfil_probe.hpp), with its arguments and
+// what --verify found ('verified' is a JSON array, empty without --verify)
+void write_report (const vector<char *> &args, const string &verified)
+{
+    probe_mark (NULL);
+    vector< pair<string, string> > fields;
+    fields.push_back (make_pair (string ("input"), probe_quote (infile.str())));
+    fields.push_back (make_pair (string ("output"), probe_quote (outfile.str())));
+    fields.push_back (make_pair (string ("radius"), probe_quote (args[1])));
+    fields.push_back (make_pair (string ("function_code"), probe_quote (funcode.str())));
+    ostringstream frac;
+    frac << nontoxic_frac;
+    fields.push_back (make_pair (string ("nontoxic_fraction"), frac.str()));
+    fields.push_back (make_pair (string ("cell_type"), probe_quote (cell_type_name (celltype))));
+    ostringstream size;
+    size << "{\"rows\": " << nrows << ", \"cols\": " << ncols << "}";
+    fields.push_back (make_pair (string ("grid"), size.str()));
+    fields.push_back (make_pair (string ("simd"), probe_quote (simd_name (simd_lanes_used ()))));
+    fields.push_back (make_pair (string ("streaming"), string (stream_mode ? "true" : "false")));
+    if (!verified.empty())
+    {
+        fields.push_back (make_pair (string ("verify"), verified));
+    }
+
+    const string name = report_name.empty() ? probe_file_name (outfile.str()) : report_name;
+    if (!probe_write (name, fields))
+    {
+        cout << "ERROR: cannot write the report: " << name << endl;
+        exit (10);
+    }
+    cout << "Report written to: " << name << endl;
+}
+
 // -------------------------------------------------------------------------------
 // MAIN
 int main(int nArgs, char *pszArgs[])
@@ -107,8 +465,22 @@ int main(int nArgs, char *pszArgs[])
     toxicity code = float, the proportion of the circle that must be present
                     to report a value in the output raster
     */
+    // Separate the options, which start with '--', from the positional arguments
+    vector<char *> args;
+    for (int a = 1; a < nArgs; a++)
+    {
+        if (strncmp (pszArgs[a], "--", 2) == 0)
+        {
+            parse_option (pszArgs[a]);
+        }
+        else
+        {
+            args.push_back (pszArgs[a]);
+        }
+    }
+
     // Argument check
-    if (nArgs < 5)
+    if (args.size() < 4)
     {
         cout << "ERROR: not enough arguments!" << endl;
         print_man();
@@ -116,13 +488,34 @@ int main(int nArgs, char *pszArgs[])
     }
 
     // Read in the arguments
-    infile << pszArgs[1];
-    rad = atof (pszArgs[2]);
-    funcode << pszArgs[3];
-    outfile << pszArgs[4];
-    if (nArgs > 5)      // ensure, if we are going to record the nontoxic fraction
-    {                   // that the user actually input the value
-        nontoxic_frac = atof (pszArgs[5]);
+    infile << args[0];
+    if (!parse_radii (args[1], radii))
+    {
+        cout << "ERROR: the radius must be a number, or a list of numbers separated by commas" << endl;
+        print_man();
+        exit(5);
+    }
+    if (radii.size() > 1 && window == window_rect)
+    {
+        cout << "ERROR: a rectangular window has no radius, it cannot take a list of radii" << endl;
+        print_man();
+        exit(5);
+    }
+    if (stream_mode && verify_cells > 0)
+    {
+        cout << "ERROR: --verify needs the whole output in memory, it cannot be used with --stream" << endl;
+        print_man();
+        exit(5);
+    }
+    rad = radii[0];
+    funcode << args[2];
+    parse_stats (funcode.str(), stats, percentiles);     // no statistics if the code is not recognized
+    outfile << args[3];
+    in_binary = is_binary_grid_name (infile.str());
+    out_binary = is_binary_grid_name (outfile.str());
+    if (args.size() > 4)    // ensure, if we are going to record the nontoxic fraction
+    {                       // that the user actually input the value
+        nontoxic_frac = atof (args[4]);
     }
     else
     {
@@ -140,16 +533,113 @@ int main(int nArgs, char *pszArgs[])
     cout << "at the University of Lethbridge, Lethbridge, AB, Canada" << endl;
     cout << "Version compiled at: " << __TIMESTAMP__ << endl;
     cout << "This program has no warranty! It may not work as expected!" << endl;
-    cout << "Arguments:\n  Input file: " << infile.str().c_str() << endl;
-    cout << "  Radius of filter circle: " << rad << endl;
+    cout << "Arguments:\n  Input file: " << infile.str().c_str() << (in_binary ? " (ESRI binary grid)" : "") << endl;
+    cout << "  Radius of filter circle: " << args[1] << endl;
+    if (window == window_square)
+    {
+        cout << "  Window: square" << endl;
+    }
+    else if (window == window_rect)
+    {
+        cout << "  Window: " << window_rows << " x " << window_cols << " rectangle" << endl;
+    }
     cout << "  Function code: " << funcode.str().c_str() << endl;
-    cout << "  Output file: " << outfile.str().c_str() << endl;
+    cout << "  Output file: " << outfile.str().c_str() << (out_binary ? " (ESRI binary grid)" : "") << endl;
     cout << "  Required nontoxic fraction: " << nontoxic_frac << endl;
+    if (edge_partial)
+    {
+        cout << "  Edges: partial windows" << endl;
+    }
+    cout << "  Cell type: " << cell_type_name (celltype) << endl;
+    if (raster_huge_pages > 0)
+    {
+        cout << "  Huge pages: " << (raster_huge_pages == 1 ? "transparent" : "explicit") << endl;
+    }
+    cout << "  Output precision: " << precision << endl;
+    if (stream_mode)
+    {
+        cout << "  Streaming: " << (stream_margin > 0 ? "on" : "on (automatic band)") << endl;
+    }
+
+    if (probe_on)
+    {
+        cout << "  Report: " << (report_name.empty() ? probe_file_name (outfile.str()) : report_name) << endl;
+    }
+    probe_start ();
+
+    // in streaming mode the grid is read, filtered and written one band of rows at a time
+    if (stream_mode)
+    {
+        run_tfil_stream();
+        if (probe_on)
+        {
+            write_report (args, "");
+        }
+        return 0;
+    }
+
+    // read in the data from the file
+    bool verify_passed = true;
+    string verified;            // what --verify found, for the report
+    probe_mark ("read");
+    if (in_binary)
+    {
+        read_EsriFlt();
+    }
+    else
+    {
+        read_ArcAscii_double();
+    }
+    if (radii.size() > 1 || stats.size() > 1)      // a batch writes one output for each
+    {                                               // radius and statistic
+        vector<raster_buffer> outs;
+        probe_mark ("compute");
+        calc_tfil_batch (outs);
+        if (verify_cells > 0 && !stats.empty())
+        {
+            probe_mark ("verify");
+            vector<raster_buffer *> grids;
+            for (size_t k = 0; k < outs.size(); k++)
+            {
+                grids.push_back (&outs[k]);
+            }
+            verify_passed = verify_tfil (grids, verify_cells, verified);
+        }
+        probe_mark ("write");
+        oput_tfil_batch (outs);
+    }
+    else
+    {
+        probe_mark ("prepare");
+        init_tfil();                // initialize the output from the input dimensions
+        probe_mark ("compute");
+        run_tfil();                 // run
+        if (verify_cells > 0 && !stats.empty())
+        {
+            probe_mark ("verify");
+            verify_passed = verify_tfil (vector<raster_buffer *> (1, &out), verify_cells, verified);
+        }
 
-    init_tfil();                // initialize
-    read_ArcAscii_double();     // read in the data from the file
-    run_tfil();                 // run
-    oput_ArcAscii_float();      // output the data in ArcAscii format
+        // output the data in the same format as the output file name
+        probe_mark ("write");
+        if (out_binary)
+        {
+            oput_EsriFlt (out, outfile.str());
+        }
+        else
+        {
+            oput_ArcAscii_float (out, outfile.str());
+        }
+    }
+    if (probe_on)
+    {
+        write_report (args, verified);
+    }
+    if (!verify_passed)
+    {
+        cout << "VERIFY FAILED: the output was written, but it does not match the reference" << endl;
+        exit (11);
+    }
 
     return 0;
 }
@@ -0,0 +1,202 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Memory-mapped files
+
+/*
+A mapped file is read straight out of the operating system's page cache, there are
+no intermediate buffers and no copies. There are three ways to map a file:
+open_read = read only
+open_copy = readable and writable, but changes are private copies of the pages that
+            are never written back to the file (copy-on-write)
+create    = a new file of a fixed size, changes are written back to the file
+*/
+
+// -------------------------------------------------------------------------------
+// MAPPED FILE
+class mapped_file
+{
+public:
+    char *data;             // first byte of the file
+    size_t size;            // size of the file in bytes
+
+    mapped_file () : data (NULL), size (0)
+    {
+#ifdef _WIN32
+        hfile = INVALID_HANDLE_VALUE;
+        hmap = NULL;
+#endif
+    }
+    ~mapped_file () { close (); }
+
+    // map the whole file read only, returns false if the file cannot be opened or mapped
+    bool open_read (const char *path)
+    {
+        return open_existing (path, false);
+    }
+
+    // map the whole file copy-on-write, returns false if the file cannot be opened or mapped
+    bool open_copy (const char *path)
+    {
+        return open_existing (path, true);
+    }
+
+    // create (or overwrite) a file of 'bytes' bytes and map it for writing
+    bool create (const char *path, size_t bytes)
+    {
+        close ();
+        if (bytes == 0)
+        {
+            return false;
+        }
+#ifdef _WIN32
+        hfile = CreateFileA (path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        unsigned long long len = bytes;
+        hmap = CreateFileMappingA (hfile, NULL, PAGE_READWRITE, (DWORD) (len >> 32),
+                                   (DWORD) (len & 0xffffffffULL), NULL);
+        if (hmap == NULL)
+        {
+            close ();
+            return false;
+        }
+        data = (char *) MapViewOfFile (hmap, FILE_MAP_WRITE, 0, 0, 0);
+        if (data == NULL)
+        {
+            close ();
+            return false;
+        }
+#else
+        int fd = ::open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (ftruncate (fd, (off_t) bytes) != 0)
+        {
+            ::close (fd);
+            return false;
+        }
+        void *p = mmap (NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close (fd);           // the mapping keeps its own reference to the file
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        data = (char *) p;
+#endif
+        size = bytes;
+        return true;
+    }
+
+    // tell the operating system the file will be read from start to finish
+    void sequential ()
+    {
+#ifndef _WIN32
+        if (data != NULL)
+        {
+            madvise (data, size, MADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    // tell the operating system the bytes from 'begin' to 'end' are no longer needed, so
+    // reading a file much larger than memory does not fill memory with the pages behind us
+    // (the page holding 'begin' is included, the page holding 'end' is not)
+    void drop (size_t begin, size_t end)
+    {
+#ifndef _WIN32
+        const size_t page = (size_t) sysconf (_SC_PAGESIZE);
+        begin = begin / page * page;        // whole pages, never past 'end'
+        end = end / page * page;
+        if (data != NULL && end > begin)
+        {
+            madvise (data + begin, end - begin, MADV_DONTNEED);
+        }
+#else
+        (void) begin;
+        (void) end;
+#endif
+    }
+
+    void close ()
+    {
+#ifdef _WIN32
+        if (data != NULL) UnmapViewOfFile (data);
+        if (hmap != NULL) CloseHandle (hmap);
+        if (hfile != INVALID_HANDLE_VALUE) CloseHandle (hfile);
+        hmap = NULL;
+        hfile = INVALID_HANDLE_VALUE;
+#else
+        if (data != NULL) munmap (data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE hfile;
+    HANDLE hmap;
+#endif
+
+    bool open_existing (const char *path, bool writable)
+    {
+        close ();
+#ifdef _WIN32
+        hfile = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hfile == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER len;
+        if (!GetFileSizeEx (hfile, &len) || len.QuadPart == 0)
+        {
+            close ();
+            return false;
+        }
+        hmap = CreateFileMappingA (hfile, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        if (hmap == NULL)
+        {
+            close ();
+            return false;
+        }
+        data = (char *) MapViewOfFile (hmap, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        if (data == NULL)
+        {
+            close ();
+            return false;
+        }
+        size = (size_t) len.QuadPart;
+#else
+        int fd = ::open (path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat (fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close (fd);
+            return false;
+        }
+        int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void *p = mmap (NULL, (size_t) st.st_size, prot, MAP_PRIVATE, fd, 0);
+        ::close (fd);           // the mapping keeps its own reference to the file
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        data = (char *) p;
+        size = (size_t) st.st_size;
+        madvise (p, size, MADV_WILLNEED);
+#endif
+        return true;
+    }
+
+    mapped_file (const mapped_file &);          // one owner per mapping: no copies
+    mapped_file & operator= (const mapped_file &);
+};
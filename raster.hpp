@@ -0,0 +1,754 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Runtime-sized raster storage
+
+/*
+Rasters are allocated at run time from the 'ncols' and 'nrows' read from the file
+header, so there is no compile time size limit and the memory use matches the data.
+Every row starts on a 64 byte boundary (one cache line), so the row 'stride' (the
+distance between rows, measured in cells) can be slightly larger than ncols. Index
+the raster the same way as a static 2D array: grid[i][j], row i, column j.
+
+The input and output grids can be stored as int16, int32, float32 or float64 cells,
+selected at run time. Smaller cells mean more of the raster fits in memory and the
+sliding window lookups move fewer bytes. Each cell type has its own accumulator for
+running sums: int64 for the integer types (exact), and double for the float types.
+
+An input grid also has a validity plane: one bit for each cell, set if the cell has a
+value and clear if it is 'nodata'. The 'nodata' cells themselves are stored as zero, so a
+running sum can add and subtract every cell without testing it, and the number of values
+in a run of cells is a population count of the bits. The file's own nodata value is kept
+for the output, there is no special value inside the grid.
+
+Once an input grid is read, the number of values in each tile of 64 x 64 cells is counted
+into a validity index. The kernels use it to skip the regions where no window can have
+enough values (e.g. the sea around a coastal DEM), and to run without counting at all where
+every cell a window can reach has a value.
+
+The memory of a raster is not written when it is allocated. The operating system places
+each page on the memory of the processor socket that first writes it, so the rows are first
+written (zeroed, filled or read into) in parallel, with the same even split of rows between
+the processors as the tiles of work (see tfil_tiles.hpp). Each processor then mostly reads
+and writes memory on its own socket. Large rasters can also be given huge pages (see
+--hugepages in main.cpp), which take far fewer address translations for the long strides
+between the rows of a window.
+*/
+
+const size_t raster_align = 64;         // row alignment in bytes
+const size_t huge_page = 2 * 1024 * 1024;   // size of a huge page
+int raster_huge_pages = 0;              // huge pages for large rasters: 0 = off, 1 = transparent,
+                                        // 2 = explicit (from the reserved pool)
+
+// -------------------------------------------------------------------------------
+// ALIGNED ALLOCATION FUNCTIONS: each block starts with a header of one cache line that says
+// how it was allocated, the cells start after it
+struct raster_block
+{
+    size_t mapped;          // length of the mapping of explicit huge pages, 0 for the heap
+};
+
+void * raster_alloc (size_t bytes)
+{
+    void *p = NULL;
+    if (bytes == 0)
+    {
+        return NULL;
+    }
+    const size_t total = bytes + raster_align;
+    size_t mapped = 0;
+#ifdef _WIN32
+    p = _aligned_malloc (total, raster_align);
+#else
+#ifdef MAP_HUGETLB
+    if (raster_huge_pages == 2 && bytes >= huge_page)
+    {
+        // Explicit huge pages, if enough are reserved, otherwise transparent ones below
+        const size_t len = (total + huge_page - 1) / huge_page * huge_page;
+        void *m = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (m != MAP_FAILED)
+        {
+            p = m;
+            mapped = len;
+        }
+    }
+#endif
+    if (p == NULL)
+    {
+        const bool huge = (raster_huge_pages > 0 && bytes >= huge_page);
+        if (posix_memalign (&p, huge ? huge_page : raster_align, total) != 0)
+        {
+            p = NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        else if (huge)
+        {
+            madvise (p, total / huge_page * huge_page, MADV_HUGEPAGE);
+        }
+#endif
+    }
+#endif
+    if (p == NULL)
+    {
+        cout << "ERROR: cannot allocate " << bytes / (1024 * 1024) << " MB of memory!" << endl;
+        exit (7);
+    }
+    ((raster_block *) p)->mapped = mapped;
+    return (char *) p + raster_align;
+}
+
+void raster_free (void *p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    char *block = (char *) p - raster_align;
+#ifdef _WIN32
+    _aligned_free (block);
+#else
+    const size_t mapped = ((raster_block *) block)->mapped;
+    if (mapped > 0)
+    {
+        munmap (block, mapped);
+    }
+    else
+    {
+        free (block);
+    }
+#endif
+}
+
+// -------------------------------------------------------------------------------
+// BIT FUNCTIONS: the validity plane packs the bits of 64 cells into each word
+typedef unsigned long long bit_word;
+
+inline int bit_count (bit_word w)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll (w);
+#else
+    int n = 0;
+    for (; w != 0; w &= w - 1)
+    {
+        n++;
+    }
+    return n;
+#endif
+}
+
+// position of the lowest bit set in w (w must not be zero)
+inline int bit_first (bit_word w)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll (w);
+#else
+    int n = 0;
+    for (; (w & 1) == 0; w >>= 1)
+    {
+        n++;
+    }
+    return n;
+#endif
+}
+
+// the 64 bits of a row of words from bit b, the row must have a word to spare after bit b
+inline bit_word bits_from (const bit_word *row, int b)
+{
+    const int w = b >> 6;
+    const int s = b & 63;
+    return (s == 0) ? row[w] : (row[w] >> s) | (row[w + 1] << (64 - s));
+}
+
+// number of bits set in a row of words, from bit c0 to bit c1 - 1
+inline int bit_count_range (const bit_word *row, int c0, int c1)
+{
+    if (c1 <= c0)
+    {
+        return 0;
+    }
+    const int w0 = c0 >> 6;
+    const int w1 = (c1 - 1) >> 6;
+    const bit_word first = ~0ULL << (c0 & 63);
+    const bit_word last = ~0ULL >> (63 - ((c1 - 1) & 63));
+    if (w0 == w1)
+    {
+        return bit_count (row[w0] & first & last);
+    }
+    int n = bit_count (row[w0] & first);
+    for (int w = w0 + 1; w < w1; w++)
+    {
+        n += bit_count (row[w]);
+    }
+    return n + bit_count (row[w1] & last);
+}
+
+class valid_index;
+
+// -------------------------------------------------------------------------------
+// RASTER VIEW: a non-owning window onto rows of cells
+template <typename T>
+struct raster_view
+{
+    T *data;                // first cell of row zero
+    int nrows;              // number of rows
+    int ncols;              // number of columns
+    ptrdiff_t stride;       // distance between rows, in cells
+    const bit_word *valid;  // validity plane, NULL if the grid has none (e.g. an output grid)
+    ptrdiff_t valid_stride; // distance between its rows, in words
+    const valid_index *index;   // values in each tile of the validity plane, NULL if not counted
+
+    T * operator[] (ptrdiff_t i) const { return data + i * stride; }
+
+    // true if cell (i, j) has a value, false if it is 'nodata'
+    bool has (ptrdiff_t i, int j) const { return (valid[i * valid_stride + (j >> 6)] >> (j & 63)) & 1; }
+
+    // the number of cells with values in row i, from column c0 to c1 - 1
+    int count (ptrdiff_t i, int c0, int c1) const { return bit_count_range (valid + i * valid_stride, c0, c1); }
+};
+
+// -------------------------------------------------------------------------------
+// RASTER: owns a block of aligned rows
+template <typename T>
+class raster
+{
+public:
+    T *data;
+    int nrows;
+    int ncols;
+    ptrdiff_t stride;
+
+    raster () : data (NULL), nrows (0), ncols (0), stride (0) {}
+    ~raster () { release (); }
+
+    // allocate (or reallocate) for nr rows and nc columns, contents are undefined
+    void allocate (int nr, int nc)
+    {
+        release ();
+        if (nr <= 0 || nc <= 0)
+        {
+            cout << "ERROR: invalid raster dimensions: " << nr << " x " << nc << endl;
+            exit (7);
+        }
+        const size_t per_line = raster_align / sizeof (T) > 0 ? raster_align / sizeof (T) : 1;
+        nrows = nr;
+        ncols = nc;
+        stride = (ptrdiff_t) (((size_t) nc + per_line - 1) / per_line * per_line);
+        data = (T *) raster_alloc ((size_t) nr * (size_t) stride * sizeof (T));
+    }
+
+    void release ()
+    {
+        raster_free (data);
+        data = NULL;
+        nrows = 0;
+        ncols = 0;
+        stride = 0;
+    }
+
+    // set every cell to 'val'
+    void fill (T val)
+    {
+        for (int i = 0; i < nrows; i++)
+        {
+            T *row = (*this)[i];
+            for (int j = 0; j < ncols; j++)
+            {
+                row[j] = val;
+            }
+        }
+    }
+
+    T * operator[] (ptrdiff_t i) const { return data + i * stride; }
+
+    raster_view<T> view () const
+    {
+        raster_view<T> v;
+        v.data = data;
+        v.nrows = nrows;
+        v.ncols = ncols;
+        v.stride = stride;
+        v.valid = NULL;
+        v.valid_stride = 0;
+        v.index = NULL;
+        return v;
+    }
+
+private:
+    raster (const raster &);                // rasters are large: no copies
+    raster & operator= (const raster &);
+};
+
+// -------------------------------------------------------------------------------
+// CELL TYPES
+enum cell_type
+{
+    cell_int16,
+    cell_int32,
+    cell_float32,
+    cell_float64
+};
+
+const char * cell_type_name (cell_type t)
+{
+    switch (t)
+    {
+        case cell_int16: return "int16";
+        case cell_int32: return "int32";
+        case cell_float32: return "float32";
+        default: return "float64";
+    }
+}
+
+size_t cell_type_size (cell_type t)
+{
+    switch (t)
+    {
+        case cell_int16: return 2;
+        case cell_int32: return 4;
+        case cell_float32: return 4;
+        default: return 8;
+    }
+}
+
+// parse a cell type name, returns false if the name is not recognized
+bool parse_cell_type (const char *name, cell_type &t)
+{
+    if (strcmp (name, "int16") == 0) { t = cell_int16; return true; }
+    if (strcmp (name, "int32") == 0) { t = cell_int32; return true; }
+    if (strcmp (name, "float32") == 0) { t = cell_float32; return true; }
+    if (strcmp (name, "float64") == 0) { t = cell_float64; return true; }
+    return false;
+}
+
+// Conversions for integer cells round to the nearest value and saturate at the limits
+// of the type, so a sum that overflows an int16 grid is clamped rather than wrapped. A NaN
+// is never a value of the grid (the NaN cells of a file are 'nodata', see put_row), it can
+// only be the nodata value of the file, which an integer grid holds as the lowest value of
+// the type (the cells it is filled with and the cells the writers look for are the same)
+template <typename T>
+T round_to_cell (double v)
+{
+    const double lo = (double) numeric_limits<T>::min();
+    const double hi = (double) numeric_limits<T>::max();
+    if (!(v == v))
+    {
+        return numeric_limits<T>::min();
+    }
+    v = floor (v + 0.5);
+    if (v < lo) return numeric_limits<T>::min();
+    if (v > hi) return numeric_limits<T>::max();
+    return (T) v;
+}
+
+template <typename T> struct cell_traits;
+
+template <> struct cell_traits<short>
+{
+    typedef long long accum_type;
+    static const cell_type type = cell_int16;
+    static short from_double (double v) { return round_to_cell<short> (v); }
+};
+
+template <> struct cell_traits<int>
+{
+    typedef long long accum_type;
+    static const cell_type type = cell_int32;
+    static int from_double (double v) { return round_to_cell<int> (v); }
+};
+
+template <> struct cell_traits<float>
+{
+    typedef double accum_type;
+    static const cell_type type = cell_float32;
+    static float from_double (double v) { return (float) v; }
+};
+
+template <> struct cell_traits<double>
+{
+    typedef double accum_type;
+    static const cell_type type = cell_float64;
+    static double from_double (double v) { return v; }
+};
+
+// -------------------------------------------------------------------------------
+// VALIDITY PLANE: one bit for each cell, set if the cell has a value, in rows of whole
+// cache lines with at least one word to spare at the end (see bits_from)
+class bit_plane
+{
+public:
+    bit_word *words;
+    int nrows;
+    ptrdiff_t stride;       // distance between rows, in words
+
+    bit_plane () : words (NULL), nrows (0), stride (0) {}
+    ~bit_plane () { release (); }
+
+    // allocate (or reallocate) for nr rows and nc columns, with every bit clear
+    void allocate (int nr, int nc)
+    {
+        release ();
+        const size_t per_line = raster_align / sizeof (bit_word);
+        nrows = nr;
+        stride = (ptrdiff_t) ((((size_t) nc + 64 + 63) / 64 + per_line - 1) / per_line * per_line);
+        words = (bit_word *) raster_alloc ((size_t) nr * (size_t) stride * sizeof (bit_word));
+
+        // Clear the rows in parallel, the first touch places them (see above)
+        #pragma omp parallel for schedule (static)
+        for (int i = 0; i < nr; i++)
+        {
+            memset (words + i * stride, 0, stride * sizeof (bit_word));
+        }
+    }
+
+    void release ()
+    {
+        raster_free (words);
+        words = NULL;
+        nrows = 0;
+        stride = 0;
+    }
+
+    bit_word * operator[] (ptrdiff_t i) const { return words + i * stride; }
+
+    // move 'count' rows starting at row 'src' up or down to row 'dst'
+    void move_rows (int src, int dst, int count)
+    {
+        memmove (words + dst * stride, words + src * stride, count * stride * sizeof (bit_word));
+    }
+
+private:
+    bit_plane (const bit_plane &);                  // owns the words: no copies
+    bit_plane & operator= (const bit_plane &);
+};
+
+// -------------------------------------------------------------------------------
+// VALIDITY INDEX: the number of values in each tile of index_tile x index_tile cells, kept as
+// running totals so the values of any rectangle of tiles take four lookups
+const int index_tile = 64;              // one word of the validity plane wide
+
+class valid_index
+{
+public:
+    valid_index () : nrows (0), ncols (0), ti (0), tj (0) {}
+
+    bool built () const { return !total.empty(); }
+
+    // count the values of each tile of the nr x nc cells of validity plane 'valid'
+    void build (const bit_plane &valid, int nr, int nc)
+    {
+        nrows = nr;
+        ncols = nc;
+        ti = (nr + index_tile - 1) / index_tile;
+        tj = (nc + index_tile - 1) / index_tile;
+        total.assign ((size_t) (ti + 1) * (tj + 1), 0);
+        #pragma omp parallel for schedule (dynamic, 1)
+        for (int a = 0; a < ti; a++)
+        {
+            long long *cnt = &total[(size_t) (a + 1) * (tj + 1) + 1];
+            for (int i = a * index_tile; i < min (nr, (a + 1) * index_tile); i++)
+            {
+                const bit_word *row = valid[i];
+                for (int b = 0; b < tj; b++)
+                {
+                    cnt[b] += bit_count (row[b]);
+                }
+            }
+        }
+
+        // Running totals down and across: total[a][b] is the values of the tiles above and
+        // to the left of tile (a, b)
+        for (int a = 1; a <= ti; a++)
+        {
+            for (int b = 1; b <= tj; b++)
+            {
+                total[at (a, b)] += total[at (a - 1, b)] + total[at (a, b - 1)] - total[at (a - 1, b - 1)];
+            }
+        }
+    }
+
+    void release () { total.clear(); }
+
+    // the number of values in the tiles that rows r0 to r1 - 1 and columns c0 to c1 - 1 touch
+    // (clipped to the grid), at least the number of values in the rectangle itself
+    long long values (int r0, int r1, int c0, int c1) const
+    {
+        int a0, a1, b0, b1;
+        if (!tiles (r0, r1, c0, c1, a0, a1, b0, b1))
+        {
+            return 0;
+        }
+        return total[at (a1, b1)] - total[at (a0, b1)] - total[at (a1, b0)] + total[at (a0, b0)];
+    }
+
+    // true if every cell of the tiles that the rectangle touches has a value
+    bool full (int r0, int r1, int c0, int c1) const
+    {
+        int a0, a1, b0, b1;
+        if (!tiles (r0, r1, c0, c1, a0, a1, b0, b1))
+        {
+            return true;
+        }
+        const long long cells = (long long) (min (nrows, a1 * index_tile) - a0 * index_tile)
+                              * (min (ncols, b1 * index_tile) - b0 * index_tile);
+        return values (r0, r1, c0, c1) == cells;
+    }
+
+private:
+    int nrows, ncols;
+    int ti, tj;                     // tiles down and across
+    vector<long long> total;        // (ti + 1) x (tj + 1) running totals
+
+    size_t at (int a, int b) const { return (size_t) a * (tj + 1) + b; }
+
+    // the tiles a0 to a1 - 1 down and b0 to b1 - 1 across that the rectangle touches, false
+    // if it is outside the grid
+    bool tiles (int r0, int r1, int c0, int c1, int &a0, int &a1, int &b0, int &b1) const
+    {
+        r0 = max (r0, 0);
+        c0 = max (c0, 0);
+        r1 = min (r1, nrows);
+        c1 = min (c1, ncols);
+        if (r1 <= r0 || c1 <= c0)
+        {
+            return false;
+        }
+        a0 = r0 / index_tile;
+        a1 = (r1 - 1) / index_tile + 1;
+        b0 = c0 / index_tile;
+        b1 = (c1 - 1) / index_tile + 1;
+        return true;
+    }
+};
+
+// -------------------------------------------------------------------------------
+// RASTER BUFFER: owns a block of aligned rows with a cell type chosen at run time
+class raster_buffer
+{
+public:
+    cell_type type;
+    void *data;
+    int nrows;
+    int ncols;
+    ptrdiff_t stride;       // distance between rows, in cells
+    bool owner;             // false if the cells belong to someone else (e.g. a mapped file)
+    bit_plane valid;        // which cells have values, allocated by the readers of an input grid
+    valid_index index;      // values in each tile of 'valid', counted once the grid is read
+
+    raster_buffer () : type (cell_float64), data (NULL), nrows (0), ncols (0), stride (0), owner (false) {}
+    ~raster_buffer () { release (); }
+
+    // allocate (or reallocate) for nr rows and nc columns of type t, contents are undefined
+    void allocate (cell_type t, int nr, int nc)
+    {
+        release ();
+        if (nr <= 0 || nc <= 0)
+        {
+            cout << "ERROR: invalid raster dimensions: " << nr << " x " << nc << endl;
+            exit (7);
+        }
+        const size_t size = cell_type_size (t);
+        const size_t per_line = raster_align / size;
+        type = t;
+        nrows = nr;
+        ncols = nc;
+        stride = (ptrdiff_t) (((size_t) nc + per_line - 1) / per_line * per_line);
+        data = raster_alloc ((size_t) nr * (size_t) stride * size);
+        owner = true;
+    }
+
+    // use cells that are owned elsewhere, without copying them
+    void attach (cell_type t, void *cells, int nr, int nc, ptrdiff_t row_stride)
+    {
+        release ();
+        type = t;
+        data = cells;
+        nrows = nr;
+        ncols = nc;
+        stride = row_stride;
+        owner = false;
+    }
+
+    void release ()
+    {
+        if (owner)
+        {
+            raster_free (data);
+        }
+        data = NULL;
+        owner = false;
+        nrows = 0;
+        ncols = 0;
+        stride = 0;
+        valid.release ();
+        index.release ();
+    }
+
+    // count the values in each tile of the validity plane, once every row has been read
+    void build_index ()
+    {
+        index.build (valid, nrows, ncols);
+    }
+
+    // typed view of the cells, T must match the cell type
+    template <typename T>
+    raster_view<T> view () const
+    {
+        raster_view<T> v;
+        v.data = (T *) data;
+        v.nrows = nrows;
+        v.ncols = ncols;
+        v.stride = stride;
+        v.valid = valid.words;
+        v.valid_stride = valid.stride;
+        v.index = index.built() ? &index : NULL;
+        return v;
+    }
+
+    // store a row of values, converting to the cell type
+    void put_row (int i, const double *vals)
+    {
+        switch (type)
+        {
+            case cell_int16: put_row_typed<short> (i, vals); break;
+            case cell_int32: put_row_typed<int> (i, vals); break;
+            case cell_float32: put_row_typed<float> (i, vals); break;
+            default: put_row_typed<double> (i, vals); break;
+        }
+    }
+
+    // store a row of values of an input grid and set their bits in the validity plane, the
+    // values equal to 'nodata', or NaN, are stored as zero with their bits clear
+    void put_row (int i, const double *vals, double nodata)
+    {
+        switch (type)
+        {
+            case cell_int16: put_values_typed<short> (i, vals, nodata); break;
+            case cell_int32: put_values_typed<int> (i, vals, nodata); break;
+            case cell_float32: put_values_typed<float> (i, vals, nodata); break;
+            default: put_values_typed<double> (i, vals, nodata); break;
+        }
+    }
+
+    // fetch a row of values, converting from the cell type
+    void get_row (int i, double *vals) const
+    {
+        switch (type)
+        {
+            case cell_int16: get_row_typed<short> (i, vals); break;
+            case cell_int32: get_row_typed<int> (i, vals); break;
+            case cell_float32: get_row_typed<float> (i, vals); break;
+            default: get_row_typed<double> (i, vals); break;
+        }
+    }
+
+    // fetch a single value
+    double get (int i, int j) const
+    {
+        switch (type)
+        {
+            case cell_int16: return view<short>()[i][j];
+            case cell_int32: return view<int>()[i][j];
+            case cell_float32: return view<float>()[i][j];
+            default: return view<double>()[i][j];
+        }
+    }
+
+    // the value 'v' once it is stored in a cell, e.g. rounded for an integer cell
+    double stored (double v) const
+    {
+        switch (type)
+        {
+            case cell_int16: return (double) cell_traits<short>::from_double (v);
+            case cell_int32: return (double) cell_traits<int>::from_double (v);
+            case cell_float32: return (double) cell_traits<float>::from_double (v);
+            default: return v;
+        }
+    }
+
+    // set every cell to 'val'
+    void fill (double val)
+    {
+        fill_rows (0, nrows, val);
+    }
+
+    // set every cell of rows r0 to r1 to 'val', in parallel (for a new raster this is the
+    // first touch, see above)
+    void fill_rows (int r0, int r1, double val)
+    {
+        #pragma omp parallel
+        {
+            vector<double> row (ncols, val);
+            #pragma omp for schedule (static)
+            for (int i = r0; i < r1; i++)
+            {
+                put_row (i, &row[0]);
+            }
+        }
+    }
+
+    // write every row once in parallel before a reader that fills the cells in some other
+    // order, so the pages are placed with the rows (see above)
+    void first_touch ()
+    {
+        const size_t row_bytes = (size_t) stride * cell_type_size (type);
+        #pragma omp parallel for schedule (static)
+        for (int i = 0; i < nrows; i++)
+        {
+            memset ((char *) data + i * row_bytes, 0, row_bytes);
+        }
+    }
+
+    // move 'count' rows starting at row 'src' up or down to row 'dst'
+    void move_rows (int src, int dst, int count)
+    {
+        const size_t row_bytes = (size_t) stride * cell_type_size (type);
+        memmove ((char *) data + dst * row_bytes, (char *) data + src * row_bytes, count * row_bytes);
+        if (valid.words != NULL)
+        {
+            valid.move_rows (src, dst, count);
+        }
+        index.release ();               // the tiles have moved
+    }
+
+private:
+    template <typename T>
+    void put_row_typed (int i, const double *vals)
+    {
+        T *row = view<T>()[i];
+        for (int j = 0; j < ncols; j++)
+        {
+            row[j] = cell_traits<T>::from_double (vals[j]);
+        }
+    }
+
+    template <typename T>
+    void put_values_typed (int i, const double *vals, double nodata)
+    {
+        T *row = view<T>()[i];
+        bit_word *bits = valid[i];
+        bit_word w = 0;
+        for (int j = 0; j < ncols; j++)
+        {
+            const bool ok = (vals[j] == vals[j] && vals[j] != nodata);
+            row[j] = ok ? cell_traits<T>::from_double (vals[j]) : (T) 0;
+            w |= (bit_word) ok << (j & 63);
+            if ((j & 63) == 63 || j == ncols - 1)
+            {
+                bits[j >> 6] = w;
+                w = 0;
+            }
+        }
+    }
+
+    template <typename T>
+    void get_row_typed (int i, double *vals) const
+    {
+        const T *row = view<T>()[i];
+        for (int j = 0; j < ncols; j++)
+        {
+            vals[j] = (double) row[j];
+        }
+    }
+
+    raster_buffer (const raster_buffer &);          // rasters are large: no copies
+    raster_buffer & operator= (const raster_buffer &);
+};
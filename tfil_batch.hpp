@@ -0,0 +1,476 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Multi-radius batch mode
+
+/*
+Multi-scale terrain analysis filters the same grid with a list of radii. Given a comma
+separated list of radii (e.g. 5,10,25,50), the grid is read once and one output grid is
+written for each radius, named with '_r' and the radius before the extension of the output
+file name (out.asc gives out_r5.asc, out_r10.asc, ...).
+
+For the mean and sum of circles all the radii are calculated in one traversal of the grid:
+the tiles are sized for the largest circle (see tfil_tiles.hpp), and every circle slides
+across a tile while its input is in the cache, so the input is loaded from memory once for
+all of them. Each circle keeps its own running sums, sliding with its own lookups.
+
+The circles are nested, each one holds every cell of the smaller ones. The anchor rows of each
+block are the only places a window is summed over the whole mask (see slide_anchor), there a
+circle can start from the window of the next smaller circle instead: slide it right to the
+first column of the larger circle, then add the ring of cells between the two circles. That
+is only done when it is cheaper than summing the whole mask, i.e. for radii close together.
+The sums are the same values added in a different order, so float grids can differ from
+separate runs in the last digits, integer grids are identical.
+
+Other statistics and windows run the modules for each radius in turn, on the same input.
+With several statistics (see tfil_stats.hpp) each radius has one output for each statistic,
+named with the radius and then the statistic, e.g. out_r25_std.asc.
+*/
+
+// -------------------------------------------------------------------------------
+// RADIUS LIST FUNCTIONS
+
+// parse a comma separated list of radii, e.g. '5,10,25', into 'list' smallest first (without
+// repeats), returns false if it is not a list of numbers
+bool parse_radii (const char *text, vector<double> &list)
+{
+    list.clear ();
+    const char *p = text;
+    while (true)
+    {
+        char *stop = NULL;
+        const double r = strtod (p, &stop);
+        if (stop == p || (*stop != ',' && *stop != '\0'))
+        {
+            return false;
+        }
+        list.push_back (r);
+        if (*stop == '\0')
+        {
+            break;
+        }
+        p = stop + 1;
+    }
+    sort (list.begin(), list.end());
+    list.erase (unique (list.begin(), list.end()), list.end());
+    return true;
+}
+
+// file name with '_' and 'tag' before the extension, e.g. out.asc and 'r25' gives out_r25.asc
+// (a name with no extension has it on the end)
+string tagged_file_name (const string &path, const string &tag)
+{
+    const size_t dot = path.find_last_of ('.');
+    const size_t slash = path.find_last_of ("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+    {
+        return path + "_" + tag;
+    }
+    return path.substr (0, dot) + "_" + tag + path.substr (dot);
+}
+
+// output file of radius k and statistic s of a batch, tagged with the radius if there are
+// several radii and with the statistic if there are several statistics
+string batch_file_name (size_t k, size_t s)
+{
+    string name = outfile.str();
+    if (radii.size() > 1)
+    {
+        ostringstream tag;
+        tag << "r" << radii[k];
+        name = tagged_file_name (name, tag.str());
+    }
+    if (stats.size() > 1)
+    {
+        name = tagged_file_name (name, stat_tag (stats[s], percentiles[s]));
+    }
+    return name;
+}
+
+// number of output grids of a batch: one for each statistic of each radius
+size_t batch_outputs ()
+{
+    return radii.size() * max (stats.size(), (size_t) 1);
+}
+
+// -------------------------------------------------------------------------------
+// NESTED CIRCLES: a circle's window from the window of the next smaller circle
+struct radius_nest
+{
+    bool used;                  // true if the row starts come from the smaller circle
+    int shift;                  // columns from the first column of the smaller circle to this one
+    vector<int> ann_i;          // runs of the ring between the circles: row offset, and the
+    vector<int> ann_lo;         // first and one past the last column offsets from the focal cell
+    vector<int> ann_hi;
+
+    radius_nest () : used (false), shift (0) {}
+};
+
+// the ring of cells in circle 'big' that are not in circle 'small', as runs along the rows
+void build_radius_nest (const filter_mask &small, const filter_mask &big, radius_nest &n)
+{
+    n.ann_i.clear();
+    n.ann_lo.clear();
+    n.ann_hi.clear();
+    n.shift = big.edge_guard_j - small.edge_guard_j;
+    for (int k = 0; k < big.len_lkups; k++)
+    {
+        const int di = big.leading_i[k];
+        const int lo = big.trailing_j[k] + 1;
+        const int hi = big.leading_j[k] + 1;
+        const int ks = di + small.edge_guard;       // the same row of the smaller circle
+        int cut_lo = hi, cut_hi = hi;               // the part of the row in the smaller circle
+        if (ks >= 0 && ks < small.len_lkups)
+        {
+            cut_lo = small.trailing_j[ks] + 1;
+            cut_hi = small.leading_j[ks] + 1;
+        }
+        if (cut_lo > lo)
+        {
+            n.ann_i.push_back (di);
+            n.ann_lo.push_back (lo);
+            n.ann_hi.push_back (cut_lo);
+        }
+        if (hi > cut_hi)
+        {
+            n.ann_i.push_back (di);
+            n.ann_lo.push_back (cut_hi);
+            n.ann_hi.push_back (hi);
+        }
+    }
+
+    // Sliding the smaller window across costs two runs of 'shift' cells for each of its rows,
+    // summing it again costs every one of its cells
+    n.used = (2 * n.shift * small.len_lkups < small.mask_sum);
+}
+
+// -------------------------------------------------------------------------------
+// BATCH: the masks of every radius
+struct radius_batch
+{
+    vector<double> radii;           // radius of each circle, smallest first
+    vector<filter_mask> masks;      // filter mask of each radius
+    vector<int> req_valcounts;      // number of values required in each window
+    vector<radius_nest> nests;      // how each circle starts from the next smaller one
+    filter_spec spec;               // the statistics and window of every radius
+
+    radius_batch (const vector<double> &r)
+        : radii (r), masks (r.size()), req_valcounts (r.size()), nests (r.size()), spec (command_line_spec ()) {}
+};
+
+// creates the mask of every radius and checks they fit the grid
+void setup_tfil_batch (radius_batch &b)
+{
+    for (size_t k = 0; k < b.radii.size(); k++)
+    {
+        setup_tfil (b.masks[k], b.req_valcounts[k], b.radii[k]);
+        if (k > 0 && b.spec.window == window_circle)
+        {
+            build_radius_nest (b.masks[k - 1], b.masks[k], b.nests[k]);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: MEAN AND SUM OF SEVERAL CIRCLES, in one traversal, OP is mean_op or sum_op
+// (see tfil_simd.hpp)
+template <typename T, typename OP>
+void tfil_batch_sum (raster_view<T> in, const vector< raster_view<T> > &outs, const radius_batch &b,
+                     int row_st, int row_end)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;     // running sum type
+    const int nrad = (int) b.masks.size();
+
+    // Each circle is calculated out to its own edge guard, so the smallest circle covers the
+    // most rows and columns, and the tiles are sized for the largest circle
+    const filter_mask &smallest = b.masks[0];
+    const int i_lo = max (smallest.edge_guard, row_st);
+    const int i_hi = min (in.nrows - smallest.edge_guard, row_end);
+    const int j_lo = smallest.edge_guard_j;
+    const int j_hi = in.ncols - smallest.edge_guard_j;
+    tile_schedule tiles (i_lo, i_hi, j_lo, j_hi, b.masks[nrad - 1], sizeof (T));
+    const int lanes = simd_lanes_used ();     // rows slid together (see tfil_simd.hpp)
+
+    #pragma omp parallel
+    {
+        // For each circle, the sliding state of each row of the block, carried from one stripe
+        // to the next, and the window at the start of each row
+        vector< vector< slide_state<accum_type> > > state (nrad, vector< slide_state<accum_type> > (tiles.block_rows));
+        vector< vector< slide_state<accum_type> > > starts (nrad, vector< slide_state<accum_type> > (tiles.block_rows));
+        vector<int> delta ((size_t) max (lanes, 1) * tiles.stripe_cols);     // count changes (see slide_counts)
+        int blk_st, blk_end;        // rows of the block
+        while (tiles.next_block (blk_st, blk_end))
+        {
+            for (int s = 0; s < tiles.nstripes; s++)
+            {
+                const int s_st = tiles.stripe_start (s);      // columns of the stripe
+                const int s_end = tiles.stripe_end (s);
+
+                // Every circle slides across the stripe in turn, smallest first
+                for (int k = 0; k < nrad; k++)
+                {
+                    const filter_mask &m = b.masks[k];
+                    const raster_view<T> out = outs[k];
+                    const int req_valcount = max (1, b.req_valcounts[k]);      // at least one value
+                    const int j_st = m.edge_guard_j;
+                    const int j_end = in.ncols - m.edge_guard_j;
+                    const int r0 = max (blk_st, max (m.edge_guard, row_st));     // rows of the block for this circle
+                    const int r1 = min (blk_end, min (in.nrows - m.edge_guard, row_end));
+                    const int j_from = max (s_st, j_st + 1);                    // columns slid across
+                    const int j_to = min (s_end, j_end);
+                    const bool row_start = (j_st >= s_st && j_st < s_end && j_st < j_end);
+                    const int vec_end = r0 + simd_rows (max (0, r1 - r0), lanes);
+                    slide_state<accum_type> *st = &state[k][0] - blk_st;        // indexed by row
+                    slide_state<accum_type> *start = &starts[k][0] - blk_st;
+                    for (int i = r0; i < r1; i++)
+                    {
+                        accum_type runsum = st[i].val;                  // running sum
+                        int nontoxic_cntr = st[i].nontoxic_cntr;        // nontoxic counter
+
+                        // START NEW ROW CALC SEQUENCE HERE
+                        if (row_start)
+                        {
+                            const int j = j_st;
+                            if (i > r0 && !slide_anchor (i, blk_st))
+                            {
+                                // Slide the window of the row above down one row (see tfil_window_sum)
+                                runsum = start[i - 1].val;
+                                nontoxic_cntr = start[i - 1].nontoxic_cntr;
+                                for (int i_tr = 0; i_tr < m.len_vlkups; i_tr++)
+                                {
+                                    const int i_sub = i + m.top_i[i_tr];
+                                    const int j_sub = j + m.top_j[i_tr];
+                                    const int i_add = i + m.bottom_i[i_tr];
+                                    const int j_add = j + m.bottom_j[i_tr];
+                                    runsum = runsum - in[i_sub][j_sub];
+                                    runsum = runsum + in[i_add][j_add];
+                                    nontoxic_cntr += (int) in.has (i_add, j_add) - (int) in.has (i_sub, j_sub);
+                                }
+                            }
+                            else if (k > 0 && b.nests[k].used)
+                            {
+                                // Start from the smaller circle's window on this row, slid right
+                                // to this column, and add the ring between the two circles
+                                const filter_mask &ms = b.masks[k - 1];
+                                const radius_nest &n = b.nests[k];
+                                const int j_small = ms.edge_guard_j;
+                                runsum = starts[k - 1][i - blk_st].val;
+                                nontoxic_cntr = starts[k - 1][i - blk_st].nontoxic_cntr;
+                                for (int i_tr = 0; i_tr < ms.len_lkups; i_tr++)
+                                {
+                                    const int i_in = i + ms.leading_i[i_tr];
+                                    const T *row = in[i_in];
+                                    const int j_out = j_small + ms.trailing_j[i_tr] + 1;    // cells leaving
+                                    const int j_new = j_small + ms.leading_j[i_tr] + 1;     // and coming in
+                                    for (int c = 0; c < n.shift; c++)
+                                    {
+                                        runsum = runsum - row[j_out + c];
+                                        runsum = runsum + row[j_new + c];
+                                    }
+                                    nontoxic_cntr += in.count (i_in, j_new, j_new + n.shift)
+                                                   - in.count (i_in, j_out, j_out + n.shift);
+                                }
+                                for (size_t a = 0; a < n.ann_i.size(); a++)
+                                {
+                                    const int i_in = i + n.ann_i[a];
+                                    const T *row = in[i_in];
+                                    for (int j_in = j + n.ann_lo[a]; j_in < j + n.ann_hi[a]; j_in++)
+                                    {
+                                        runsum = runsum + row[j_in];
+                                    }
+                                    nontoxic_cntr += in.count (i_in, j + n.ann_lo[a], j + n.ann_hi[a]);
+                                }
+                            }
+                            else
+                            {
+                                // The anchor rows of the block thumb over the whole filter mask
+                                probe_count (&probe_thread::row_starts, 1);
+                                runsum = 0;
+                                nontoxic_cntr = 0;
+                                for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+                                {
+                                    const int i_in = i + m.leading_i[i_tr];
+                                    const T *row = in[i_in];
+                                    const int j_in_lo = j + m.trailing_j[i_tr] + 1;
+                                    const int j_in_hi = j + m.leading_j[i_tr] + 1;
+                                    for (int j_in = j_in_lo; j_in < j_in_hi; j_in++)
+                                    {
+                                        runsum = runsum + row[j_in];
+                                    }
+                                    nontoxic_cntr += in.count (i_in, j_in_lo, j_in_hi);
+                                }
+                            }
+                            start[i].val = runsum;
+                            start[i].nontoxic_cntr = nontoxic_cntr;
+                            if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
+                            {
+                                out[i][j] = cell_traits<T>::from_double (OP::finish (runsum, nontoxic_cntr));
+                            }
+                        }
+                        // END NEW ROW CALC SEQUENCE HERE
+
+                        // ROW LOOP: the rows that are not in a vector group slide across the stripe
+                        // here, the same as tfil_window_sum
+                        if (i >= vec_end && j_from < j_to)
+                        {
+                            slide_counts (in, m, i, j_from, j_to, &delta[0]);
+                            for (int j = j_from; j < j_to; j++)
+                            {
+                                for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+                                {
+                                    runsum = runsum - in [ (i + m.trailing_i[i_tr]) ][ (j + m.trailing_j[i_tr]) ];
+                                    runsum = runsum + in [ (i + m.leading_i[i_tr]) ][ (j + m.leading_j[i_tr]) ];
+                                }
+                                nontoxic_cntr += delta[j - j_from];
+                                if (nontoxic_cntr >= req_valcount)        // check toxic counter
+                                {
+                                    out[i][j] = cell_traits<T>::from_double (OP::finish (runsum, nontoxic_cntr));
+                                }
+                            }
+                        }
+                        // Save the row's sliding state for the next stripe
+                        st[i].val = runsum;
+                        st[i].nontoxic_cntr = nontoxic_cntr;
+                    }
+
+                    // The vector groups of rows slide across the stripe together
+                    if (vec_end > r0 && j_from < j_to)
+                    {
+                        simd_slide_rows<T, OP, valid_bits> (in, out, m, req_valcount, st + r0, &delta[0], r0,
+                                                             vec_end - r0, j_from, j_to, lanes);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// BATCH MODULE FUNCTIONS
+
+// calls the calculation modules for every radius on rows row_st to row_end, the outputs of
+// radius k are outs[k * nstat] onwards, one for each statistic
+template <typename T>
+void run_tfil_batch_typed (raster_view<T> in, const vector< raster_view<T> > &outs, const radius_batch &b,
+                           int row_st, int row_end)
+{
+    // The mean or sum of several circles share one traversal
+    const vector<tfil_stat> &stats = b.spec.stats;
+    const bool sum_code = (stats.size() == 1 && (stats[0] == stat_mean || stats[0] == stat_sum));
+    const filter_mask &largest = b.masks[b.masks.size() - 1];
+    const bool whole = (in.nrows > 2 * largest.edge_guard && in.ncols > 2 * largest.edge_guard_j);
+    if (sum_code && b.spec.window == window_circle && b.masks.size() > 1 && whole)
+    {
+        if (stats[0] == stat_mean)
+        {
+            tfil_batch_sum<T, mean_op> (in, outs, b, row_st, row_end);
+        }
+        else
+        {
+            tfil_batch_sum<T, sum_op> (in, outs, b, row_st, row_end);
+        }
+        for (size_t k = 0; b.spec.edge_partial && k < b.masks.size(); k++)
+        {
+            vector< raster_view<T> > mine (1, outs[k]);
+            tfil_border (in, mine, b.masks[k], b.spec, row_st, row_end);
+        }
+        return;
+    }
+    const size_t nstat = outs.size() / b.masks.size();
+    for (size_t k = 0; k < b.masks.size(); k++)
+    {
+        vector< raster_view<T> > mine (outs.begin() + k * nstat, outs.begin() + (k + 1) * nstat);
+        run_tfil_stats_typed (in, mine, b.masks[k], b.spec, b.req_valcounts[k], row_st, row_end);
+    }
+}
+
+// runs the calculations for rows row_st to row_end of every grid in 'dst', using the first
+// 'nrow' rows of 'src', in the cell type of the grids
+template <typename T>
+void run_tfil_batch_view (const raster_buffer &src, vector<raster_buffer> &dst, const radius_batch &b,
+                          int row_st, int row_end, int nrow)
+{
+    raster_view<T> in = src.view<T>();
+    in.nrows = nrow;
+    vector< raster_view<T> > outs (dst.size());
+    for (size_t k = 0; k < dst.size(); k++)
+    {
+        outs[k] = dst[k].view<T>();
+    }
+    run_tfil_batch_typed (in, outs, b, row_st, row_end);
+}
+
+void run_tfil_batch_rows (const raster_buffer &src, vector<raster_buffer> &dst, const radius_batch &b,
+                          int row_st, int row_end, int nrow)
+{
+    switch (src.type)
+    {
+        case cell_int16: run_tfil_batch_view<short> (src, dst, b, row_st, row_end, nrow); break;
+        case cell_int32: run_tfil_batch_view<int> (src, dst, b, row_st, row_end, nrow); break;
+        case cell_float32: run_tfil_batch_view<float> (src, dst, b, row_st, row_end, nrow); break;
+        default: run_tfil_batch_view<double> (src, dst, b, row_st, row_end, nrow); break;
+    }
+}
+
+// -------------------------------------------------------------------------------
+// BATCH CALCULATION FUNCTION: filters the input with every radius into 'outs', one output grid
+// for each radius and statistic
+void calc_tfil_batch (vector<raster_buffer> &outs)
+{
+    radius_batch b (radii);
+    setup_tfil_batch (b);
+
+    // One output grid for each radius and statistic, set to the nodata value of the input file
+    vector<raster_buffer> grids (batch_outputs ());
+    outs.swap (grids);
+    for (size_t k = 0; k < outs.size(); k++)
+    {
+        outs[k].allocate (celltype, nrows, ncols);
+        outs[k].fill (nodataflag);
+    }
+
+    cout << "Beginning calculations with function code: " << funcode.str().c_str() << endl;
+    const char *module = tfil_module_name ();
+    if (module != NULL)
+    {
+        cout << "EXECUTING: " << module << " for " << radii.size() << (radii.size() > 1 ? " radii" : " radius")
+             << " . . ." << endl;
+        for (size_t k = 1; k < radii.size(); k++)
+        {
+            if (b.nests[k].used)
+            {
+                cout << "Radius " << radii[k] << " starts its rows from radius " << radii[k - 1] << endl;
+            }
+        }
+        cout << "Vector instructions: " << simd_name (simd_lanes_used ()) << endl;
+        run_tfil_batch_rows (in, outs, b, 0, nrows, nrows);
+        if (extreme_cache_hits + extreme_cache_misses > 0)
+        {
+            cout << "Row extreme cache: " << extreme_cache_hits << " hits, "
+                 << extreme_cache_misses << " misses" << endl;
+        }
+    }
+    else
+    {
+        cout << "ERROR: I couldn't recognize your function code??" << endl;
+    }
+    cout << "Ending calculations with function code: " << funcode.str().c_str() << endl;
+}
+
+// writes the outputs of a batch in the same format as the output file name, one file for each
+// output, and releases them
+void oput_tfil_batch (vector<raster_buffer> &outs)
+{
+    const size_t nstat = outs.size() / radii.size();
+    for (size_t k = 0; k < outs.size(); k++)
+    {
+        const string name = batch_file_name (k / nstat, k % nstat);
+        if (out_binary)
+        {
+            oput_EsriFlt (outs[k], name);
+        }
+        else
+        {
+            oput_ArcAscii_float (outs[k], name);
+        }
+        outs[k].release ();
+    }
+}
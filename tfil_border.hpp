@@ -0,0 +1,313 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Partial windows at the edges of the grid
+
+/*
+Normally the cells closer to the edge of the grid than the radius of the window are left as
+'nodata', because their windows hang over the edge. With --edges=partial these cells are
+calculated from the part of their window that is inside the grid, the same as the ArcGIS
+focal statistics. The nontoxic rule then applies to that part: with a proportion of 0.8 a
+cell in the corner of the grid needs values in 80% of the cells of its window that are
+inside the grid. A window can be larger than the whole grid, so the radius is no longer
+limited by the size of the grid.
+
+The edge cells have a kernel of their own, so the loops of the interior kernels (which only
+ever see whole windows) have no tests for the edges of the grid. The border kernel slides a
+window along each row of the border (the top and bottom strips, and the ends of the other
+rows) with the trailing and leading lookups, skipping the lookup cells outside the grid. The
+window keeps everything any statistic needs: the count, the sum and the sum of squares (of
+integer cells in whole numbers as well, for their exact variance, see exact_variance), a
+histogram of the levels of the values (see tfil_order.hpp) for the minimum, maximum and the
+order statistics, and the frequency table of the classes (see tfil_class.hpp). The levels
+are only built for the cells the border windows can reach, every value there has a level of
+its own, so the results are exact.
+*/
+
+// -------------------------------------------------------------------------------
+// BORDER WINDOW: the part of the window of a border cell inside the grid, for one thread
+template <typename T>
+class border_window
+{
+public:
+    border_window (raster_view<T> input, const vector< raster_view<T> > &outputs, const filter_spec &spec,
+                   const order_levels &levels, bool use_levels, bool use_classes, bool need_extremes)
+        : in (input), outs (&outputs), f (&spec), lv (&levels), levels (use_levels),
+          classes (use_classes), extremes (need_extremes),
+          h (use_levels ? (int) levels.value.size() : 0, use_levels ? 2 * (int) spec.stats.size() + 2 : 0),
+          t (use_classes ? (int) levels.value.size() : 0),
+          cells (0), n (0), sum (0.0), sq (0.0), dist (0.0), ref (0.0), isum (0), isq (0) {}
+
+    // the window is empty
+    void start ()
+    {
+        sum = 0.0;
+        sq = 0.0;
+        dist = 0.0;
+        isum = 0;
+        isq = 0;
+    }
+
+    void add (int i, int j)
+    {
+        cells++;
+        if (in.has (i, j))
+        {
+            const double v = (double) in[i][j];
+            if (n == 0)
+            {
+                ref = v;            // the squares are summed around the first value
+                sq = 0.0;
+                dist = 0.0;
+            }
+            n++;
+            sum += v;
+            dist += v - ref;
+            sq += (v - ref) * (v - ref);
+            if (numeric_limits<T>::is_integer)
+            {
+                isum += (long long) in[i][j];
+                isq += int_square (in[i][j]);
+            }
+            if (levels)
+            {
+                h.add ((*lv) (i, j));
+            }
+            if (classes)
+            {
+                t.add ((*lv) (i, j));
+            }
+        }
+    }
+
+    void remove (int i, int j)
+    {
+        cells--;
+        if (in.has (i, j))
+        {
+            const double v = (double) in[i][j];
+            n--;
+            sum -= v;
+            dist -= v - ref;
+            sq -= (v - ref) * (v - ref);
+            if (numeric_limits<T>::is_integer)
+            {
+                isum -= (long long) in[i][j];
+                isq -= int_square (in[i][j]);
+            }
+            if (levels)
+            {
+                h.remove ((*lv) (i, j));
+            }
+            if (classes)
+            {
+                t.remove ((*lv) (i, j));
+            }
+        }
+    }
+
+    // record the values in the output arrays, if there are enough values in the part of the
+    // window inside the grid
+    void record (int i, int j)
+    {
+        recentre (dist, n, sq, ref);        // the squares around the mean of this window
+        const int nontoxic_cntr = n;
+        const int req_valcount = (int) ceil (f->nontoxic_frac * cells);
+        if (nontoxic_cntr == 0 || nontoxic_cntr < req_valcount)
+        {
+            return;
+        }
+        double lo = 0.0, hi = 0.0;
+        if (extremes)
+        {
+            window_extremes (lo, hi);
+        }
+        double var = (n > 1) ? sq / n : 0.0;           // one value has none
+        double var_cell = var;                          // and as it is stored
+        if (numeric_limits<T>::is_integer)
+        {
+            const int_variance exact = exact_variance (isum, isq, n);
+            var = exact.value ();
+            var_cell = exact.rounded ();
+        }
+        for (size_t s = 0; s < f->stats.size(); s++)
+        {
+            double v;
+            switch (f->stats[s])
+            {
+                case stat_mean: v = sum / n; break;
+                case stat_sum: v = sum; break;
+                case stat_min: v = lo; break;
+                case stat_max: v = hi; break;
+                case stat_var: v = var_cell; break;
+                case stat_std: v = sqrt (var); break;
+                case stat_range: v = hi - lo; break;
+                case stat_median:
+                case stat_percentile: v = order_value (h, *lv, *f, s, 2 * (int) s, n); break;
+                case stat_majority:
+                case stat_minority:
+                case stat_variety: v = class_value (t, *lv, f->stats[s]); break;
+                default: v = (double) n; break;
+            }
+            (*outs)[s][i][j] = cell_traits<T>::from_double (v);
+        }
+    }
+
+private:
+    raster_view<T> in;
+    const vector< raster_view<T> > *outs;
+    const filter_spec *f;
+    const order_levels *lv;
+    bool levels;                    // true if the histogram of the levels is kept
+    bool classes;                   // true if the frequency table of the classes is kept
+    bool extremes;                  // true if the minimum or maximum is wanted
+    sliding_histogram h;            // rank pointers 2s and 2s + 1 for statistic s, and the last two
+                                    // for the minimum and maximum
+    class_table t;
+    int cells;                      // number of cells of the window inside the grid
+    int n;                          // number of values in the window
+    double sum;                     // sum of the values
+    double sq;                      // sum of the squares of the values around 'ref'
+    double dist;                    // sum of the distances of the values from 'ref'
+    double ref;
+    long long isum;                 // sum and sum of squares of integer cells (see exact_variance)
+    unsigned long long isq;
+
+    // the minimum and maximum of the window, from the histogram
+    void window_extremes (double &lo, double &hi)
+    {
+        const int p = 2 * (int) f->stats.size();
+        lo = lv->value[h.find (p, 1)];
+        hi = lv->value[h.find (p + 1, n)];
+    }
+};
+
+// -------------------------------------------------------------------------------
+// CLIPPED WINDOW FUNCTIONS
+
+// adds (or removes) every cell of the window of focal cell (i, j) that is inside a grid of
+// nrow rows and ncol columns
+template <typename W>
+void clipped_window (W &w, const filter_mask &m, int nrow, int ncol, int i, int j, bool add)
+{
+    for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+    {
+        const int i_in = i + m.leading_i[i_tr];
+        if (i_in < 0 || i_in >= nrow)
+        {
+            continue;
+        }
+        const int j_lo = max (0, j + m.trailing_j[i_tr] + 1);
+        const int j_hi = min (ncol, j + m.leading_j[i_tr] + 1);
+        for (int j_in = j_lo; j_in < j_hi; j_in++)
+        {
+            if (add)
+            {
+                w.add (i_in, j_in);
+            }
+            else
+            {
+                w.remove (i_in, j_in);
+            }
+        }
+    }
+}
+
+// slides window w along row i from column j_st to j_end - 1, recording each cell. The window
+// starts and finishes empty.
+template <typename W>
+void clipped_slide (W &w, const filter_mask &m, int nrow, int ncol, int i, int j_st, int j_end)
+{
+    w.start ();
+    clipped_window (w, m, nrow, ncol, i, j_st, true);
+    w.record (i, j_st);
+    for (int j = j_st + 1; j < j_end; j++)
+    {
+        // the trailing edge leaves and the leading edge comes in, where they are inside the grid
+        for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+        {
+            const int i_in = i + m.leading_i[i_tr];
+            if (i_in < 0 || i_in >= nrow)
+            {
+                continue;
+            }
+            const int j_out = j + m.trailing_j[i_tr];
+            const int j_in = j + m.leading_j[i_tr];
+            if (j_out >= 0 && j_out < ncol)
+            {
+                w.remove (i_in, j_out);
+            }
+            if (j_in >= 0 && j_in < ncol)
+            {
+                w.add (i_in, j_in);
+            }
+        }
+        w.record (i, j);
+    }
+    clipped_window (w, m, nrow, ncol, i, j_end - 1, false);
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: BORDER, every statistic of the cells of rows row_st to row_end whose
+// windows cross the edge of the grid, outs[s] is the output of statistic f.stats[s]
+template <typename T>
+void tfil_border (raster_view<T> in, const vector< raster_view<T> > &outs, const filter_mask &m,
+                  const filter_spec &f, int row_st, int row_end)
+{
+    const int nr = in.nrows;
+    const int nc = in.ncols;
+    const int eg = m.edge_guard;
+    const int eg_j = m.edge_guard_j;
+
+    // The runs of border cells: the whole row at the top and bottom (or if the window is wider
+    // than the grid), otherwise the two ends of the row
+    vector<int> run_i, run_st, run_end;
+    for (int i = max (0, row_st); i < min (nr, row_end); i++)
+    {
+        if (i < eg || i >= nr - eg || nc - eg_j <= eg_j)
+        {
+            run_i.push_back (i);
+            run_st.push_back (0);
+            run_end.push_back (nc);
+        }
+        else if (eg_j > 0)
+        {
+            run_i.push_back (i);
+            run_st.push_back (0);
+            run_end.push_back (eg_j);
+            run_i.push_back (i);
+            run_st.push_back (nc - eg_j);
+            run_end.push_back (nc);
+        }
+    }
+    if (run_i.empty())
+    {
+        return;
+    }
+
+    // What the windows need to keep
+    bool order = false, classes = false, extremes = false;
+    for (size_t s = 0; s < f.stats.size(); s++)
+    {
+        order = order || is_order_stat (f.stats[s]);
+        classes = classes || is_class_stat (f.stats[s]);
+        extremes = extremes || f.stats[s] == stat_min || f.stats[s] == stat_max || f.stats[s] == stat_range;
+    }
+
+    // The levels of the cells the border windows reach
+    order_levels lv;
+    const bool use_levels = order || classes || extremes;
+    if (use_levels)
+    {
+        lv.build (in, 0, nr, 0, nc, 2 * eg, 2 * eg_j);
+    }
+    const border_window<T> proto (in, outs, f, lv, use_levels && (order || extremes), classes, extremes);
+
+    #pragma omp parallel
+    {
+        border_window<T> w (proto);
+        #pragma omp for schedule (dynamic, 1)
+        for (int r = 0; r < (int) run_i.size(); r++)
+        {
+            clipped_slide (w, m, nr, nc, run_i[r], run_st[r], run_end[r]);
+        }
+    }
+}
@@ -0,0 +1,156 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Majority, minority and variety of categorical grids
+
+/*
+Land cover, geomorphons and other class grids have no mean, only the frequency of each class
+in the window: the majority is the most common class, the minority the least common class
+(of those in the window) and the variety the number of different classes. When several
+classes are equally common the smallest class value is reported.
+
+Each thread keeps a frequency table with a count for every class, which slides with the
+window the same way as the histogram of the median (see tfil_order.hpp): the cells of the
+trailing edge are taken out and the cells of the leading edge put in, so each output cell
+costs updates for the perimeter of the window, not its area. The classes are the levels of
+tfil_order (the distinct values of each tile). The classes in the window
+are also kept in a list, so the majority and minority only look through the classes that are
+there, which for a categorical grid are a handful.
+*/
+
+// -------------------------------------------------------------------------------
+// FREQUENCY TABLE: the number of cells of each class (level) in the window
+class class_table
+{
+public:
+    int n;                          // number of values in the window
+
+    class_table (int nlevels) : n (0), freq (nlevels, 0), pos (nlevels, 0) {}
+
+    // empties the table, for 'nlevels' classes
+    void reset (int nlevels)
+    {
+        n = 0;
+        freq.assign (nlevels, 0);
+        pos.assign (nlevels, 0);
+        present.clear ();
+    }
+
+    void add (unsigned int l)
+    {
+        if (l == no_level)
+        {
+            return;
+        }
+        n++;
+        if (freq[l]++ == 0)
+        {
+            pos[l] = (int) present.size();
+            present.push_back (l);
+        }
+    }
+
+    void remove (unsigned int l)
+    {
+        if (l == no_level)
+        {
+            return;
+        }
+        n--;
+        if (--freq[l] == 0)
+        {
+            // move the last class of the list into its place
+            const unsigned int last = present.back();
+            present[pos[l]] = last;
+            pos[last] = pos[l];
+            present.pop_back();
+        }
+    }
+
+    // number of different classes in the window
+    int variety () const { return (int) present.size(); }
+
+    // the most common (most = true) or least common class in the window, the smallest on a tie
+    unsigned int common (bool most) const
+    {
+        unsigned int best = present[0];
+        for (size_t k = 1; k < present.size(); k++)
+        {
+            const unsigned int l = present[k];
+            const bool better = most ? (freq[l] > freq[best]) : (freq[l] < freq[best]);
+            if (better || (freq[l] == freq[best] && l < best))
+            {
+                best = l;
+            }
+        }
+        return best;
+    }
+
+private:
+    vector<int> freq;               // count of each class
+    vector<int> pos;                // position of each class in the list
+    vector<unsigned int> present;   // the classes in the window
+};
+
+// value of class statistic s of the window in table t
+inline double class_value (const class_table &t, const order_levels &lv, tfil_stat s)
+{
+    switch (s)
+    {
+        case stat_majority: return lv.value[t.common (true)];
+        case stat_minority: return lv.value[t.common (false)];
+        default: return t.variety();
+    }
+}
+
+// -------------------------------------------------------------------------------
+// CLASS WINDOW: the frequency table of one thread, and the outputs of the class statistics
+template <typename T>
+class class_window
+{
+public:
+    class_window (const vector< raster_view<T> > &outputs, const filter_spec &spec, int req_valcount)
+        : lv (NULL), outs (&outputs), f (&spec), req (req_valcount), t (0) {}
+
+    // an empty window, over the levels of a new tile
+    void start (const order_levels &levels)
+    {
+        lv = &levels;
+        t.reset ((int) levels.value.size());
+    }
+
+    void add (unsigned int l) { t.add (l); }
+    void remove (unsigned int l) { t.remove (l); }
+
+    // record the values in the output arrays, if we are non-toxic
+    void record (int i, int j)
+    {
+        const int nontoxic_cntr = t.n;
+        if (nontoxic_cntr == 0 || nontoxic_cntr < req)
+        {
+            return;
+        }
+        for (size_t s = 0; s < f->stats.size(); s++)
+        {
+            if (is_class_stat (f->stats[s]))
+            {
+                (*outs)[s][i][j] = cell_traits<T>::from_double (class_value (t, *lv, f->stats[s]));
+            }
+        }
+    }
+
+private:
+    const order_levels *lv;
+    const vector< raster_view<T> > *outs;
+    const filter_spec *f;
+    int req;
+    class_table t;
+};
+
+// -------------------------------------------------------------------------------
+// Calculation module: MAJORITY, MINORITY AND VARIETY, outs[s] is the output of statistic
+// f.stats[s] (the other statistics are left to tfil_stats and tfil_order)
+template <typename T>
+void tfil_class (raster_view<T> in, const vector< raster_view<T> > &outs, const filter_mask &m,
+                 const filter_spec &f, int req_valcount, int row_st, int row_end)
+{
+    slide_levels (in, m, row_st, row_end, class_window<T> (outs, f, req_valcount));
+}
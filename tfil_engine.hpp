@@ -0,0 +1,187 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Filter engine for grids in memory
+
+/*
+The command line program keeps the grid and its settings in globals (tfil_globals.hpp). The
+engine runs the same calculation modules without them: a tfil_engine holds one filter (the
+statistics, the radius and window, the nontoxic proportion and the edge mode) and filters
+grids that belong to the caller, so other programs can use it without writing files (see
+demfil.h for the C interface). The modules read everything about the filter from its
+filter_spec, and a run keeps its working memory to itself, so any number of engines can run
+at once, from different threads, and one engine can run several grids at once. Only the
+tuning options (--tilecache, --simd and --minmaxcache) are shared by the whole process.
+
+The caller's rows can be any distance apart. The input is read where it is if it has no
+'nodata' cells, the engine only adds the validity plane. The modules add up every cell with
+the 'nodata' cells as zero (see raster.hpp), so an input with 'nodata' cells is copied once,
+with zeros in their place. The outputs are written straight into the caller's rows, one grid
+for each statistic, the cells without a value are set to the 'nodata' value of the input.
+*/
+
+// -------------------------------------------------------------------------------
+// INPUT FUNCTION: the caller's cells as an input grid, with its validity plane
+template <typename T>
+void engine_input (raster_buffer &src, const T *cells, ptrdiff_t stride, int nr, int nc, double nodata)
+{
+    // Count the 'nodata' cells: with none, the caller's cells are used where they are
+    long long missing = 0;
+    #pragma omp parallel for schedule (dynamic, CHUNKSIZE) reduction (+:missing)
+    for (int i = 0; i < nr; i++)
+    {
+        const T *row = cells + i * stride;
+        for (int j = 0; j < nc; j++)
+        {
+            missing += ((double) row[j] == nodata);
+        }
+    }
+    if (missing == 0)
+    {
+        src.attach (cell_traits<T>::type, (void *) cells, nr, nc, stride);
+    }
+    else
+    {
+        src.allocate (cell_traits<T>::type, nr, nc);
+    }
+    src.valid.allocate (nr, nc);
+
+    raster_view<T> in = src.view<T>();
+    #pragma omp parallel for schedule (static)
+    for (int i = 0; i < nr; i++)
+    {
+        const T *row = cells + i * stride;
+        T *dst = in[i];
+        bit_word *bits = src.valid[i];
+        bit_word w = 0;
+        for (int j = 0; j < nc; j++)
+        {
+            const bool ok = ((double) row[j] != nodata);
+            if (missing > 0)
+            {
+                dst[j] = ok ? row[j] : (T) 0;
+            }
+            w |= (bit_word) ok << (j & 63);
+            if ((j & 63) == 63 || j == nc - 1)
+            {
+                bits[j >> 6] = w;
+                w = 0;
+            }
+        }
+    }
+    src.build_index ();
+}
+
+// runs the calculations for every statistic, in the cell type of the grids
+template <typename T>
+void engine_run_typed (const raster_buffer &src, const vector<raster_buffer> &dst, const filter_mask &m,
+                       const filter_spec &f, int req_valcount)
+{
+    vector< raster_view<T> > outs (dst.size());
+    for (size_t s = 0; s < dst.size(); s++)
+    {
+        outs[s] = dst[s].view<T>();
+    }
+    run_tfil_stats_typed (src.view<T>(), outs, m, f, req_valcount, 0, src.nrows);
+}
+
+// -------------------------------------------------------------------------------
+// FILTER ENGINE: one filter, for grids in memory
+class tfil_engine
+{
+public:
+    tfil_engine () : radius (0.0) {}
+
+    // sets the filter: the function code (one letter for each statistic, e.g. "m" or "mdr", see
+    // main.cpp), the radius, the window shape ("circle", "square" or ROWSxCOLS, NULL for a
+    // circle), the proportion of the window required to have values, and partial windows at
+    // the edges of the grid. Returns what is wrong, or NULL.
+    const char * configure (const char *code, double rad, const char *shape, double frac, bool partial)
+    {
+        filter_spec f;
+        if (code == NULL || !parse_stats (code, f.stats, f.percentiles))
+        {
+            return "unknown function code";
+        }
+        if (shape != NULL && !parse_window_shape (shape, f.window, f.window_rows, f.window_cols))
+        {
+            return "unknown window shape";
+        }
+        if (!(rad >= 0.0))
+        {
+            return "INVALID Filter radius!";
+        }
+        if (!(frac >= 0.0 && frac <= 1.0))
+        {
+            return "the nontoxic proportion must be between 0.0 and 1.0";
+        }
+        f.nontoxic_frac = frac;
+        f.edge_partial = partial;
+        spec = f;
+        radius = rad;
+        return NULL;
+    }
+
+    // number of output grids, one for each statistic
+    int outputs () const { return (int) spec.stats.size(); }
+
+    // short name of the statistic of output s, e.g. "mean" or "p90"
+    string output_tag (int s) const { return stat_tag (spec.stats[s], spec.percentiles[s]); }
+
+    // filters the nr rows and nc columns of cells of type t (rows 'stride' cells apart, the
+    // cells equal to 'nodata' have no value) into the grids outs[s] (rows out_strides[s] cells
+    // apart), one for each statistic. Returns what is wrong, or NULL.
+    const char * run (cell_type t, const void *cells, ptrdiff_t stride, int nr, int nc, double nodata,
+                      void *const *outs, const ptrdiff_t *out_strides) const
+    {
+        if (spec.stats.empty())
+        {
+            return "unknown function code";
+        }
+        if (cells == NULL || nr <= 0 || nc <= 0 || stride < nc)
+        {
+            return "invalid input grid";
+        }
+        for (int s = 0; s < outputs(); s++)
+        {
+            if (outs[s] == NULL || out_strides[s] < nc)
+            {
+                return "invalid output grid";
+            }
+        }
+        filter_mask m;
+        int req_valcount = 0;
+        const char *problem = build_window (m, req_valcount, spec, radius, nr, nc);
+        if (problem != NULL)
+        {
+            return problem;
+        }
+
+        // The input, and the outputs set to the nodata value
+        raster_buffer src;
+        switch (t)
+        {
+            case cell_int16: engine_input (src, (const short *) cells, stride, nr, nc, nodata); break;
+            case cell_int32: engine_input (src, (const int *) cells, stride, nr, nc, nodata); break;
+            case cell_float32: engine_input (src, (const float *) cells, stride, nr, nc, nodata); break;
+            default: engine_input (src, (const double *) cells, stride, nr, nc, nodata); break;
+        }
+        vector<raster_buffer> dst (outputs());
+        for (int s = 0; s < outputs(); s++)
+        {
+            dst[s].attach (t, outs[s], nr, nc, out_strides[s]);
+            dst[s].fill (nodata);
+        }
+
+        switch (t)
+        {
+            case cell_int16: engine_run_typed<short> (src, dst, m, spec, req_valcount); break;
+            case cell_int32: engine_run_typed<int> (src, dst, m, spec, req_valcount); break;
+            case cell_float32: engine_run_typed<float> (src, dst, m, spec, req_valcount); break;
+            default: engine_run_typed<double> (src, dst, m, spec, req_valcount); break;
+        }
+        return NULL;
+    }
+
+private:
+    filter_spec spec;               // what the filter calculates
+    double radius;                  // radius of the window in cells
+};
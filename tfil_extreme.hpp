@@ -0,0 +1,476 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Minimum and maximum with monotonic deques
+
+/*
+The circle is a stack of row segments, one per row of the mask, the same segments whose
+ends are the trailing and leading lookups. When the window slides one cell to the right,
+every segment slides one cell along its own input row, so the extreme of the window is the
+extreme of its row segments, and each row segment is a 1D sliding window.
+
+Each segment keeps a monotonic deque: the cells of the segment that could still become its
+minimum, in column order with increasing values (for the maximum, decreasing values). The
+front is the minimum of the segment. A new cell on the leading edge first removes every
+cell at the back that is not smaller than it, since they leave the window before it does
+and can never be the minimum again. The cell on the trailing edge leaves from the front, if
+it is still there. Each cell is added and removed at most once, so the cost of each output
+cell is one step per segment: O(r), with no rescans of the whole mask, however rough the
+terrain (the old rescans made a steady slope O(r^2) per cell).
+
+Each output row is calculated one segment at a time: the segment slides across the whole
+row and the extreme and count of each column are updated as it goes. Only one deque is
+needed at a time, and it stays in the processor's registers and cache.
+*/
+
+// -------------------------------------------------------------------------------
+// Minimum and maximum operations, 'none' is what a 'nodata' cell counts as: it never wins
+template <typename T>
+struct min_op
+{
+    static bool beats (T a, T b) { return a < b; }
+    static T pick (T a, T b) { return (b < a) ? b : a; }
+    static T none () { return numeric_limits<T>::max(); }
+};
+
+template <typename T>
+struct max_op
+{
+    static bool beats (T a, T b) { return a > b; }
+    static T pick (T a, T b) { return (b > a) ? b : a; }
+    static T none () { return numeric_limits<T>::lowest(); }
+};
+
+// -------------------------------------------------------------------------------
+// ROW FUNCTION: slides each of the nseg row segments of the mask along its input row for output
+// row i, from column j_st to j_end - 1, into the extremes ext[j] and counts cnt[j] (indexed by
+// column), dv and dj have room for a deque of a whole row. V is the nodata policy (see
+// tfil_mask.hpp).
+template <typename T, typename OP, typename V>
+void deque_row_extremes (raster_view<T> in, int i, int nseg, const int *seg_i, const int *seg_lo,
+                         const int *seg_hi, int j_st, int j_end, T *ext, int *cnt, T *dv, int *dj)
+{
+    for (int k = 0; k < nseg; k++)
+    {
+        const int r = i + seg_i[k];         // input row of the segment
+        const T *row = in[r];
+        const int lo = seg_lo[k];
+        const int hi = seg_hi[k];
+        int head = 0, tail = 0;
+        int run = 0;                        // values in the segment
+
+        // START NEW ROW CALC SEQUENCE HERE: the segment before the first column,
+        // all but its leading cell
+        for (int c = j_st + lo; c < j_st + hi; c++)
+        {
+            const T v = row[c];
+            if (V::has (in, r, c))
+            {
+                run++;
+                while (tail > head && !OP::beats (dv[tail - 1], v))
+                {
+                    tail--;
+                }
+                dv[tail] = v;
+                dj[tail] = c;
+                tail++;
+            }
+        }
+
+        // ROW LOOP: the leading cell comes in at the back, the trailing cell leaves
+        // from the front if it is still there
+        for (int j = j_st; j < j_end; j++)
+        {
+            const T v = row[j + hi];
+            if (V::has (in, r, j + hi))
+            {
+                run++;
+                while (tail > head && !OP::beats (dv[tail - 1], v))
+                {
+                    tail--;
+                }
+                dv[tail] = v;
+                dj[tail] = j + hi;
+                tail++;
+            }
+            if (tail > head && dj[head] < j + lo)
+            {
+                head++;
+            }
+            if (tail > head)
+            {
+                ext[j] = OP::pick (ext[j], dv[head]);
+            }
+            cnt[j] += run;
+            run -= V::has (in, r, j + lo);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: MINIMUM AND MAXIMUM
+template <typename T, typename OP>
+void tfil_extreme (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                   int row_st, int row_end)
+{
+    // Pre-calculate start and finish coords for input array, the edges are left as 'nodata'
+    const int edge_guard = m.edge_guard;
+    const int edge_guard_j = m.edge_guard_j;
+    const int i_st = edge_guard;
+    const int i_end = in.nrows - edge_guard;
+    const int j_st = edge_guard_j;
+    const int j_end = in.ncols - edge_guard_j;
+    const int i_lo = max (i_st, row_st);
+    const int i_hi = min (i_end, row_end);
+    const int width = max (0, j_end - j_st);
+
+    // Row segments of the mask: segment k covers input row i + seg_i[k], columns j + seg_lo[k]
+    // to j + seg_hi[k]
+    const int nseg = m.len_lkups;
+    const int *seg_i = &m.leading_i[0];
+    const int *seg_hi = &m.leading_j[0];
+    vector<int> seg_lo (nseg);
+    for (int k = 0; k < nseg; k++)
+    {
+        seg_lo[k] = m.trailing_j[k] + 1;
+    }
+
+    // Share out blocks of whole rows (see tfil_tiles.hpp)
+    tile_schedule tiles (i_lo, i_hi, j_st, j_end, row_chunk (i_hi - i_lo), max (1, width));
+
+    #pragma omp parallel
+    {
+        vector<T> extreme (width);          // extreme of the segments so far, for each column
+        vector<int> count (width);          // number of values in the segments so far
+        vector<T> dq_val (in.ncols);        // the deque: values and columns, the front is at
+        vector<int> dq_j (in.ncols);        // 'head' and the back just before 'tail'
+        int blk_st, blk_end, str_st, str_end;
+        while (tiles.next_tile (blk_st, blk_end, str_st, str_end))
+        {
+            for (int i = blk_st; i < blk_end; i++)
+            {
+                // The footprint of the row in the validity index picks the kernel, or skips it
+                const footprint_kind kind = tile_footprint (in, m, req_valcount, i, i + 1, j_st, j_end);
+                if (kind == footprint_empty)
+                {
+                    continue;
+                }
+                fill (extreme.begin(), extreme.end(), OP::none());
+                fill (count.begin(), count.end(), 0);
+                T *ext = &extreme[0] - j_st;        // indexed by column
+                int *cnt = &count[0] - j_st;
+                if (kind == footprint_full)
+                {
+                    deque_row_extremes<T, OP, all_valid> (in, i, nseg, seg_i, &seg_lo[0], seg_hi, j_st, j_end,
+                                                          ext, cnt, &dq_val[0], &dq_j[0]);
+                }
+                else
+                {
+                    deque_row_extremes<T, OP, valid_bits> (in, i, nseg, seg_i, &seg_lo[0], seg_hi, j_st, j_end,
+                                                           ext, cnt, &dq_val[0], &dq_j[0]);
+                }
+
+                // Now, record the values in the output array, if we are non-toxic
+                T *orow = out[i];
+                for (int j = j_st; j < j_end; j++)
+                {
+                    const int nontoxic_cntr = count[j - j_st];
+                    if (nontoxic_cntr > 0 && nontoxic_cntr >= req_valcount)
+                    {
+                        orow[j] = extreme[j - j_st];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// SLIDING EXTREME CACHE: the 1D sliding extremes of input rows, kept by (row, width)
+
+/*
+Output row i needs, for each row k of the mask, the sliding extreme of input row i + k
+across the width of that mask row. The same input row at the same width is needed again
+by output row i + 2k (the circle is symmetric, mask rows k and -k have the same width), so
+each processor keeps the most recently used (row, width) extremes in a fixed number of
+slots and only calculates the ones it does not have. A missing entry is calculated with the
+van Herk / Gil-Werman method (see tfil_rect.hpp): three comparisons per cell whatever the
+width, and no branches that depend on the data. Each output cell is then the extreme of
+one cached value per mask row, read straight along the cached rows.
+
+A miss costs a little more than sliding the deque of the same segment, and a hit almost
+nothing, so the cache only pays when a good part of the lookups are hits. It does not when
+the rows are so long that too few of them fit in the cache, or the grid so short that few
+rows are needed twice. Before the calculations the lookups of the first rows are played
+through an empty cache of the same size (see extreme_cache_pays), and if fewer than a
+quarter of them would be hits the monotonic deques are used instead.
+*/
+const double extreme_cache_min_hits = 0.25;     // below this proportion of hits the deques are faster
+
+// number of cache slots for each processor: enough for every (row, width) in the window
+// and the rows of the window behind it, or in a grid of nrows rows, or as many as fit in
+// --minmaxcache=MB
+int extreme_cache_slots (const filter_mask &m, int nrows, int ncols, size_t cell_bytes)
+{
+    int nwidths = 0;            // distinct widths of the mask rows, the circle is symmetric
+    for (int k = 0; k < m.len_lkups; k++)
+    {
+        if (m.leading_i[k] <= 0)
+        {
+            nwidths++;
+        }
+    }
+    const double all = (double) min (2 * (2 * m.edge_guard + 1), nrows) * nwidths;
+    const double mb = (extreme_cache_mb > 0) ? extreme_cache_mb : 64.0;
+    const double fit = mb * 1024.0 * 1024.0 / ((double) ncols * cell_bytes);
+    return (int) max (1.0, min (all, fit));
+}
+
+// true if a cache of nslots slots would find enough of the lookups of nout output rows in a
+// row: the keys of the first rows go through the same least recently used order as the
+// cache, without calculating anything
+bool extreme_cache_pays (const filter_mask &m, int nslots, int nout)
+{
+    const int rows = min (nout, 3 * m.filsize);     // enough for the window to fill the cache
+    const long long span = 2 * m.filsize + 1;       // widths, the keys of one row
+    map<long long, list<long long>::iterator> slot_of;
+    list<long long> order;                          // keys, most recently used first
+    long long hits = 0, lookups = 0;
+    for (int i = 0; i < rows; i++)
+    {
+        for (int k = 0; k < m.len_lkups; k++)
+        {
+            const long long key = (i + m.leading_i[k] + m.filsize) * span + m.leading_j[k] - m.trailing_j[k];
+            map<long long, list<long long>::iterator>::iterator found = slot_of.find (key);
+            lookups++;
+            if (found != slot_of.end())
+            {
+                hits++;
+                order.splice (order.begin(), order, found->second);
+                continue;
+            }
+            if ((int) order.size() == nslots)
+            {
+                slot_of.erase (order.back());
+                order.pop_back ();
+            }
+            order.push_front (key);
+            slot_of[key] = order.begin();
+        }
+    }
+    return lookups > 0 && hits >= extreme_cache_min_hits * lookups;
+}
+
+template <typename T, typename OP>
+class extreme_cache
+{
+public:
+    long long hits;             // entries found in the cache
+    long long misses;           // entries calculated
+
+    extreme_cache (raster_view<T> grid, int nslots)
+        : hits (0), misses (0), in (grid)
+    {
+        nslots = max (1, nslots);
+        cells.resize ((size_t) nslots * in.ncols);
+        keys.assign (nslots, -1);
+        where.resize (nslots);
+        for (int s = 0; s < nslots; s++)
+        {
+            where[s] = order.insert (order.end(), s);
+        }
+        fwd.resize (in.ncols);
+        bwd.resize (in.ncols);
+    }
+
+    // sliding extremes of input row r across w columns: entry c is the extreme of columns c to
+    // c + w - 1 (for c up to ncols - w), the pointer is good until the next call
+    const T * get (int r, int w)
+    {
+        const long long key = (long long) r * (in.ncols + 1) + w;
+        map<long long, int>::iterator found = slot_of.find (key);
+        int s;
+        if (found != slot_of.end())
+        {
+            hits++;
+            s = found->second;
+        }
+        else
+        {
+            // Reuse the least recently used slot
+            misses++;
+            s = order.back();
+            if (keys[s] >= 0)
+            {
+                slot_of.erase (keys[s]);
+            }
+            keys[s] = key;
+            slot_of[key] = s;
+            calculate (r, w, &cells[(size_t) s * in.ncols]);
+        }
+        order.splice (order.begin(), order, where[s]);      // now the most recently used
+        return &cells[(size_t) s * in.ncols];
+    }
+
+private:
+    raster_view<T> in;
+    vector<T> cells;                        // the slots, one row of extremes each
+    vector<long long> keys;                 // key of each slot, -1 if empty
+    map<long long, int> slot_of;            // slot of each key
+    list<int> order;                        // slots, most recently used first
+    vector< list<int>::iterator > where;    // position of each slot in 'order'
+    vector<T> fwd, bwd;                     // running extremes through each piece of the row
+
+    void calculate (int r, int w, T *dst)
+    {
+        const T *row = in[r];
+        const int nc = in.ncols;
+        for (int c = 0; c < nc; c++)
+        {
+            const T v = in.has (r, c) ? row[c] : OP::none();
+            fwd[c] = (c % w == 0) ? v : OP::pick (fwd[c - 1], v);
+        }
+        for (int c = nc - 1; c >= 0; c--)
+        {
+            const T v = in.has (r, c) ? row[c] : OP::none();
+            bwd[c] = (c % w == w - 1 || c == nc - 1) ? v : OP::pick (bwd[c + 1], v);
+        }
+        for (int c = 0; c + w <= nc; c++)
+        {
+            dst[c] = OP::pick (bwd[c], fwd[c + w - 1]);
+        }
+    }
+
+    extreme_cache (const extreme_cache &);              // owns the slots: no copies
+    extreme_cache & operator= (const extreme_cache &);
+};
+
+// the extremes of the windows of output row i from column j_st to j_end - 1 into ext[j] (indexed
+// by column), one cached value per row of the mask, seg_lo[k] is the first column offset of
+// mask row k (see tfil_extreme_cached)
+template <typename T, typename OP>
+void cached_row_extremes (extreme_cache<T, OP> &cache, const filter_mask &m, const int *seg_lo, int i,
+                          int j_st, int j_end, T *ext)
+{
+    fill (ext + j_st, ext + j_end, OP::none());
+    for (int k = 0; k < m.len_lkups; k++)
+    {
+        const int lo = seg_lo[k];
+        const T *seg = cache.get (i + m.leading_i[k], m.leading_j[k] - lo + 1) + lo;
+        for (int j = j_st; j < j_end; j++)
+        {
+            ext[j] = OP::pick (ext[j], seg[j]);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// the number of values in the segment of input row r from column j + lo to j + hi, added to
+// cnt[j] (indexed by column) for each column j from j_st to j_end - 1, V is the nodata policy
+template <typename T, typename V>
+void segment_counts (raster_view<T> in, int r, int lo, int hi, int j_st, int j_end, int *cnt)
+{
+    int run = V::count (in, r, j_st + lo, j_st + hi);
+    for (int j = j_st; j < j_end; j++)
+    {
+        run += V::has (in, r, j + hi);
+        cnt[j] += run;
+        run -= V::has (in, r, j + lo);
+    }
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: MINIMUM AND MAXIMUM, with the sliding extreme cache
+template <typename T, typename OP>
+void tfil_extreme_cached (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                          int row_st, int row_end)
+{
+    // Pre-calculate start and finish coords for input array, the edges are left as 'nodata'
+    const int edge_guard = m.edge_guard;
+    const int edge_guard_j = m.edge_guard_j;
+    const int i_st = edge_guard;
+    const int i_end = in.nrows - edge_guard;
+    const int j_st = edge_guard_j;
+    const int j_end = in.ncols - edge_guard_j;
+    const int i_lo = max (i_st, row_st);
+    const int i_hi = min (i_end, row_end);
+    const int width = max (0, j_end - j_st);
+
+    // Row segments of the mask: segment k covers input row i + seg_i[k], columns j + seg_lo[k]
+    // to j + seg_hi[k]
+    const int nseg = m.len_lkups;
+    const int *seg_i = &m.leading_i[0];
+    const int *seg_hi = &m.leading_j[0];
+    vector<int> seg_lo (nseg);
+    for (int k = 0; k < nseg; k++)
+    {
+        seg_lo[k] = m.trailing_j[k] + 1;
+    }
+    const int nslots = extreme_cache_slots (m, in.nrows, in.ncols, sizeof (T));
+
+    // Share out blocks of whole rows (see tfil_tiles.hpp), a processor that takes the next
+    // block along finds most of what it needs already in its cache
+    tile_schedule tiles (i_lo, i_hi, j_st, j_end, row_chunk (i_hi - i_lo), max (1, width));
+    long long hits = 0, misses = 0;
+
+    #pragma omp parallel reduction (+:hits, misses)
+    {
+        extreme_cache<T, OP> cache (in, nslots);
+        vector<T> extreme (width);          // extreme of the segments so far, for each column
+        vector<int> count (width);          // number of values in the segments so far
+        int blk_st, blk_end, str_st, str_end;
+        while (tiles.next_tile (blk_st, blk_end, str_st, str_end))
+        {
+            for (int i = blk_st; i < blk_end; i++)
+            {
+                // The footprint of the row in the validity index picks the counting, or skips it
+                const footprint_kind kind = tile_footprint (in, m, req_valcount, i, i + 1, j_st, j_end);
+                if (kind == footprint_empty)
+                {
+                    continue;
+                }
+                fill (extreme.begin(), extreme.end(), OP::none());
+                fill (count.begin(), count.end(), 0);
+                T *ext = &extreme[0] - j_st;        // indexed by column
+                int *cnt = &count[0] - j_st;
+                for (int k = 0; k < nseg; k++)
+                {
+                    const int r = i + seg_i[k];         // input row of the segment
+                    const int lo = seg_lo[k];
+                    const int hi = seg_hi[k];
+                    const T *seg = cache.get (r, hi - lo + 1) + lo;     // extreme of segment at column j
+                    for (int j = j_st; j < j_end; j++)
+                    {
+                        ext[j] = OP::pick (ext[j], seg[j]);
+                    }
+
+                    // The number of values in the segment, slid along the row
+                    if (kind == footprint_full)
+                    {
+                        segment_counts<T, all_valid> (in, r, lo, hi, j_st, j_end, cnt);
+                    }
+                    else
+                    {
+                        segment_counts<T, valid_bits> (in, r, lo, hi, j_st, j_end, cnt);
+                    }
+                }
+
+                // Now, record the values in the output array, if we are non-toxic
+                T *orow = out[i];
+                for (int j = j_st; j < j_end; j++)
+                {
+                    const int nontoxic_cntr = cnt[j];
+                    if (nontoxic_cntr > 0 && nontoxic_cntr >= req_valcount)
+                    {
+                        orow[j] = ext[j];
+                    }
+                }
+            }
+        }
+        hits += cache.hits;
+        misses += cache.misses;
+        probe_count (&probe_thread::rescans, misses);       // this thread's share of the reduction
+    }
+    #pragma omp atomic
+    extreme_cache_hits += hits;
+    #pragma omp atomic
+    extreme_cache_misses += misses;
+}
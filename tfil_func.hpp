@@ -5,605 +5,486 @@
 // INITIALIZE FUNCTION: prepares the globals for setting the data
 void init_tfil()
 {
-    // First, set all arrays to null parameters, just to be safe
-    for (int i = 0; i < max_nrow; i++)
+    // Allocate the output to match the input (a float32 binary output is mapped straight
+    // from the output file), and set it to the nodata value of the input file, the edges of
+    // the grid and the windows without enough values are never written
+    if (!map_EsriFlt_output ())
     {
-        for (int j = 0; j < max_ncol; j++)
-        {
-            in[i][j] = -9999.0;
-            out[i][j] = -9999.0;
-        }
-    }
-    for (int i = 0; i < max_filsize; i++)
-    {
-        for (int j = 0; j < max_filsize; j++)
-        {
-            fil[i][j] = false;
-        }
+        out.allocate (celltype, nrows, ncols);
     }
-    // Read in the arcgis Ascii file
+    out.fill (nodataflag);
 }
 
 // -------------------------------------------------------------------------------
-// RUN FUNCTION
-void run_tfil()
+// STRIPE FUNCTION: slides rows blk_st to blk_end - 1 across the columns s_st to s_end - 1 of a
+// stripe, state[i - blk_st] is the sliding state of row i, carried from the stripe before
+// unless the rows start here (fresh, the first stripe). OP is mean_op or sum_op (see tfil_simd.hpp) and V
+// the nodata policy (see tfil_mask.hpp): each one is compiled on its own, with no tests in its
+// loops for the statistic or for 'nodata' cells that are not there
+template <typename T, typename OP, typename V>
+void window_sum_stripe (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                        slide_state<typename cell_traits<T>::accum_type> *state, int *delta,
+                        int blk_st, int blk_end, int s_st, int s_end, bool fresh, int lanes)
 {
-    //=========================================================================================
-    // Create the filter boolean array
-    // This array is 'true' if within the filter 'window'
-    // First check the filter radius, it cannot be greater than the size of the array
-    if (rad > cen_i)
-    {
-        cout << "INVALID Filter radius, recompile with larger static filter allocation!" << endl; exit (3);
-    }
-
-    double dist = 0.0;          // distance from focal cell: measured center to center
-    int mask_sum = 0;           // the mask sum is the number of occurences of 'true'
-    int min_i = max_filsize;    // begin by setting this to a very high value
-    for (int i = 0; i < max_filsize; i++)
+    typedef typename cell_traits<T>::accum_type accum_type;     // running sum type
+
+    // The lookups for the trailing and leading edges of each row of the mask
+    const int *trailing_i = &m.trailing_i[0];
+    const int *trailing_j = &m.trailing_j[0];
+    const int *leading_i = &m.leading_i[0];
+    const int *leading_j = &m.leading_j[0];
+    const int len_lkups = m.len_lkups;
+
+    // and for the top and bottom edges of each column, to start a row from the row above
+    const int *top_i = &m.top_i[0];
+    const int *top_j = &m.top_j[0];
+    const int *bottom_i = &m.bottom_i[0];
+    const int *bottom_j = &m.bottom_j[0];
+    const int len_vlkups = m.len_vlkups;
+
+    const int vec_end = blk_st + simd_rows (blk_end - blk_st, lanes);
+    const int slide_from = fresh ? s_st + 1 : s_st;                 // columns slid onto
+    slide_state<accum_type> above = { 0, 0 };      // window at the start of the row above
+    for (int i = blk_st; i < blk_end; i++)
     {
-        for (int j = 0; j < max_filsize; j++)
+        // Prepare some private variables, note that 'j' is also private to each processer
+        T sub_val = 0;              // temp variables to for the sliding window part
+        T add_val = 0;
+        accum_type runsum = state[i - blk_st].val;      // running sum
+        int i_in;                   // thumb coordinates
+        int nontoxic_cntr = state[i - blk_st].nontoxic_cntr;   // nontoxic counter to track good values
+
+        // A row starts at the first stripe: every slide_rows-th row of the block with the whole
+        // filter mask (see slide_anchor), and each row after it from the window of the row above
+        if (fresh)
         {
-            // Calculate difference between focal cell and location, and tag if less than radius
-            // Note that the following comparison is 'less than or equal to': this matters for edge cells
-            dist = double (sqrt ( ( (i - cen_i) * (i - cen_i) ) + ( (j - cen_j) * (j - cen_j) ) ) );
-            if (dist <= rad)
+            // START NEW ROW CALC SEQUENCE HERE
+            int j = s_st;               // set 'j' to starting column
+            if (slide_anchor (i, blk_st))
             {
-                fil[i][j] = true;
-                mask_sum++;             // add one to the total
-                if (i < min_i)
+                // If this is an anchor row of the block, we have to thumb over the whole filter
+                // mask and properly calculate the mean and runsum
+                probe_count (&probe_thread::row_starts, 1);
+                runsum = 0;                 // running sum for mean calculation
+                nontoxic_cntr = 0;             // nontoxic counter starts at zero
+
+                // Main filter loop, each row of the mask runs from just after its trailing
+                // edge to its leading edge. The 'nodata' cells are zero, so every cell is
+                // added, and the count is taken from the validity bits of the run
+                for (int i_tr = 0; i_tr < len_lkups; i_tr++)
                 {
-                    min_i = i;
+                    i_in = i + leading_i[i_tr];
+                    const T *row = in[i_in];
+                    const int j_lo = j + trailing_j[i_tr] + 1;
+                    const int j_hi = j + leading_j[i_tr] + 1;
+                    for (int j_in = j_lo; j_in < j_hi; j_in++)
+                    {
+                        runsum = runsum + row[j_in];
+                    }
+                    nontoxic_cntr += V::count (in, i_in, j_lo, j_hi);
                 }
             }
             else
             {
-                fil[i][j] = false;
+                // Slide the window of the row above down one row: take the top edge
+                // of each mask column out and put the cell below its bottom edge in,
+                // so only the anchor rows walk over the whole mask. The sum is rounded
+                // in a different order from a walk over the whole mask, so the mean or
+                // sum of floating point cells can differ from it in the last digit, but
+                // the anchors are the same rows whatever the number of processors
+                runsum = above.val;
+                nontoxic_cntr = above.nontoxic_cntr;
+                for (int i_tr = 0; i_tr < len_vlkups; i_tr++)
+                {
+                    const int i_sub = i + top_i[i_tr];
+                    const int j_sub = j + top_j[i_tr];
+                    const int i_add = i + bottom_i[i_tr];
+                    const int j_add = j + bottom_j[i_tr];
+                    runsum = runsum - in[i_sub][j_sub];
+                    runsum = runsum + in[i_add][j_add];
+                    nontoxic_cntr += (int) V::has (in, i_add, j_add) - (int) V::has (in, i_sub, j_sub);
+                }
+                if (nontoxic_cntr == 0)
+                {
+                    runsum = 0;         // an empty window sums to exactly zero
+                }
+            }
+            above.val = runsum;
+            above.nontoxic_cntr = nontoxic_cntr;
+            if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
+            {
+                out[i][j] = cell_traits<T>::from_double (OP::finish (runsum, nontoxic_cntr));      // calculate and store before moving on
+            }
+            // END NEW ROW CALC SEQUENCE HERE
+        }
+
+        // ROW LOOP: continue to the right, across the stripe (the rows of the
+        // vector groups are slid together below). The count changes at each
+        // column come from the validity bits of the edges, worked out first
+        const int j_from = (i < vec_end) ? s_end : slide_from;
+        V::changes (in, m, i, j_from, s_end, delta);
+        for (int j = j_from; j < s_end; j++)
+        {
+            // START SHIFTING CALC SEQUENCE HERE: the rest of the calcs will be this type
+            // Loop down the lookups and add and subtract values
+            for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+            {
+                // Perform the subtraction from the running sum and the addition, a
+                // 'nodata' cell is zero so there is nothing to test
+                sub_val = in [ (i + trailing_i[i_tr]) ][ (j + trailing_j[i_tr]) ];
+                runsum = runsum - sub_val; // subtract val from running sum
+                add_val = in [ (i + leading_i[i_tr]) ][ (j + leading_j[i_tr]) ];
+                runsum = runsum + add_val;  // add value to the running sum
+            }
+            if (V::counted)
+            {
+                nontoxic_cntr += delta[j - j_from];     // update the nontoxic counter
+                if (nontoxic_cntr == 0)
+                {
+                    runsum = 0;         // an empty window sums to exactly zero, with no rounding left
+                }
+            }
+            // Now, record the value in the output array, if we are non-toxic
+            if (nontoxic_cntr >= req_valcount)        // check toxic counter
+            {
+                out[i][j] = cell_traits<T>::from_double (OP::finish (runsum, nontoxic_cntr));
             }
+            // END SHIFTING CALC SEQUENCE HERE: on to the next column
         }
+        // Save the row's sliding state for the next stripe
+        state[i - blk_st].val = runsum;
+        state[i - blk_st].nontoxic_cntr = nontoxic_cntr;
     }
 
-    // Calculate the number of required values from each filter window
-    // use ceiling to be conservative with this function
-    int req_valcount = (int) ceil(nontoxic_frac * mask_sum);
+    // The vector groups of rows slide across the stripe together
+    simd_slide_rows<T, OP, V> (in, out, m, req_valcount, state, delta, blk_st, vec_end - blk_st,
+                               slide_from, s_end, lanes);
+}
 
-    int edge_guard = cen_i - min_i;         // determine the number of cells to 'guard' on the edges
+// -------------------------------------------------------------------------------
+// Calculation module: MEAN AND SUM, OP is mean_op or sum_op
+template <typename T, typename OP>
+void tfil_window_sum (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                      int row_st, int row_end)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;     // running sum type
 
     // Pre-calculate start and finish coords for input array, these are subsequently used in
     // for loops with '<' conditionals (see below), thus, the loop will end one short of the
     // ending coordinates, leaving a strip of nodatas on the edge of the grids
+    const int edge_guard = m.edge_guard;
+    const int edge_guard_j = m.edge_guard_j;
     const int i_st = edge_guard;
-    const int i_end = nrows - edge_guard;
-    const int j_st = edge_guard;
-    const int j_end = ncols - edge_guard;
+    const int i_end = in.nrows - edge_guard;
+    const int j_st = edge_guard_j;
+    const int j_end = in.ncols - edge_guard_j;
 
-    // Check to ensure the start and finish variables are not out of bounds!!
-    if (i_st < 0 || i_st >= nrows || i_end < 0 || i_end >= nrows)
-    {
-        cout << "INVALID Filter radius!" << endl; exit (3);
-    }
-    if (j_st < 0 || j_st >= ncols || j_end < 0 || j_end >= ncols)
-    {
-        cout << "INVALID Filter radius!" << endl; exit (3);
-    }
+    // Only the rows from row_st to row_end are calculated
+    const int i_lo = max (i_st, row_st);
+    const int i_hi = min (i_end, row_end);
 
-    // Pre-calculate starting and ending points for the filter mask array
-    // The '+1' at the end of the ending coordinate is required because it is
-    // part of a 'for loop' with a '<' conditional evaluation.
-    const int i_f_st = min_i;
-    const int i_f_end = cen_i + edge_guard + 1;
-    const int j_f_st = min_i;
-    const int j_f_end = cen_j + edge_guard + 1;
+    // A window needs at least one value, even with a nontoxic proportion of 0 (the mean of an
+    // empty window would be 0 / 0), the same as every other module
+    req_valcount = max (1, req_valcount);
 
-    // NEW algorithm also sets arrays with the coordinates for the trailing edge of the sliding
-    // window and the leading edge of the window. The idea is to speed up calculations by keeping
-    // the running sum and simply adding and subtracting from the front and back of the filter
-    // window. This reduces the number of references substantially, and should speed up the
-    // program significantly.
-    // set the lookup arrays
-    int trailing_i [max_filsize];
-    int trailing_j [max_filsize];
-    int leading_i [max_filsize];
-    int leading_j [max_filsize];
+    // Split the rows into blocks and the columns into stripes that fit in the cache, the
+    // blocks are shared out between the processors by work stealing (see tfil_tiles.hpp)
+    tile_schedule tiles (i_lo, i_hi, j_st, j_end, m, sizeof (T));
+    const int lanes = simd_lanes_used ();     // rows slid together (see tfil_simd.hpp)
 
-    // now, loop through the filter and set the lookup arrays
-    int i_tr = 0;   // thumb coordinate for the lookup, starting with zero
-    for (int i = i_f_st; i < i_f_end; i++)
+    #pragma omp parallel
     {
-        for (int j = j_f_st; j < j_f_end; j++)
+        // The running sum and nontoxic counter of each row of the block are
+        // carried from one stripe to the next, so each row slides exactly as if it was whole
+        vector< slide_state<accum_type> > state (tiles.block_rows);
+        vector<int> delta ((size_t) max (lanes, 1) * tiles.stripe_cols);     // count changes (see slide_counts)
+        int blk_st, blk_end;        // rows of the block
+        while (tiles.next_block (blk_st, blk_end))
         {
-            // Starting a new row, we'll run across the filter and record the edge coords
-            // Set the coordinates, this will be assessed when the function has a focal
-            // cell that is one cell to the right, so, we need to subtract one from it.
-            // These values are the offset from the focal cell, so some will be negative
-            if (fil[i][j] && !fil[i][j-1])
-            {
-                trailing_i [i_tr] = i - cen_i;
-                trailing_j [i_tr] = j - cen_j - 1;
-            }
-            // check for the leading coordinate
-            if (fil[i][j] && !fil[i][j+1])
+            bool fresh = true;      // the rows start at this stripe (the first one)
+            for (int s = 0; s < tiles.nstripes; s++)
             {
-                leading_i [i_tr] = i - cen_i;
-                leading_j [i_tr] = j - cen_j;
-            }
-        }
-        i_tr++;
-    }
-    int len_lkups = i_tr;       // save the length of the lookup array
-
-    cout << "Beginning calculations with function code: " << funcode.str().c_str() << endl;
-
-    //=========================================================================================
-    // Calculation module: MEAN
-    if (strcmp (funcode.str().c_str(), "m") == 0 || strcmp (funcode.str().c_str(), "M") == 0)
-    {
-        cout << "EXECUTING: mean . . ." << endl;
-        // Use OpenMP to split the rows up into small chunks that are farmed
-        // out to available processers dynamically as they are available.
-        #pragma omp parallel for schedule (dynamic, CHUNKSIZE)
-        for (int i = i_st; i < i_end; i++)
-        {
-            // Prepare some private variables, note that 'j' is also private to each processer
-            double sub_val = 0.0;       // temp variables to for the sliding window part
-            double add_val = 0.0;
-            double runsum = 0.0;        // running sum
-            int i_in, j_in;             // thumb coordinates
-            int nontoxic_cntr = 0;         // nontoxic counter to track good values
-
-            // START NEW ROW CALC SEQUENCE HERE
-            // If this is a new row, we have to thumb over the whole filter mask
-            // and properly calculate the mean and runsum
-            runsum = 0.0;               // running sum for mean calculation
-            int j = j_st;               // set 'j' to starting column
-            i_in = i - edge_guard;      // coordinates that thumb over the input grid
-            j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-            nontoxic_cntr = 0;             // nontoxic counter starts at zero
-
-            // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-            for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
-            {
-                j_in = j - edge_guard;      // reset j_in back to beginning column
-                for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
+                const int s_st = tiles.stripe_start (s);      // columns of the stripe
+                const int s_end = tiles.stripe_end (s);
+
+                // The footprint of the tile in the validity index picks the kernel, or skips it if
+                // it has no values at all. Every window of the tile is then empty, and the rows
+                // carry an empty window (a sum of exactly zero) into the next stripe, the same as
+                // sliding across the tile would, so the sums do not depend on the stripe widths
+                const footprint_kind kind = tile_footprint (in, m, 1, blk_st, blk_end, s_st, s_end);
+                if (kind == footprint_empty)
                 {
-                    // Check to see if the filter mask is 'true'
-                    if ( fil[i_fil][j_fil] )
-                    {
-                        if (in[i_in][j_in] != -9999.0)  // check toxicity
-                        {
-                            nontoxic_cntr++;   // advance the nontoxic counter
-                            //Add to the running sum, if inside the filter mask
-                            runsum = runsum + in[i_in][j_in];
-                        }
-                    }
-                    j_in++;     // increment input thumb coordinate
+                    const slide_state<accum_type> empty = { 0, 0 };
+                    fill (state.begin(), state.end(), empty);
+                    fresh = false;
+                    continue;
                 }
-                i_in++;     // increment input thumb coordinate
-            }
-            if (nontoxic_cntr < req_valcount)        // check to see if we have enough values
-            {
-                out[i][j] = -9999.0;        // fill in with 'nodata'
-            }
-            else
-            {
-                out[i][j] = runsum / nontoxic_cntr;      // calculate mean and store before moving on
-            }
-            // END NEW ROW CALC SEQUENCE HERE
-
-            // ROW LOOP: continue to the right
-            for (int j = (j_st + 1); j < j_end; j++)
-            {
-                // START SHIFTING CALC SEQUENCE HERE: the rest of the calcs will be this type
-                // Loop down the lookups and add and subtract values
-                for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                if (kind == footprint_full)
                 {
-                    // Perform the subtraction from the running sum
-                    sub_val = in [ (i + trailing_i[i_tr]) ][ (j + trailing_j[i_tr]) ];
-                    if (sub_val != -9999.0)
-                    {
-                        nontoxic_cntr--;            // decrement the nontoxic counter
-                        runsum = runsum - sub_val; // subtract val from running sum
-                    }
-                    // Perform the addition to the running sum
-                    add_val = in [ (i + leading_i[i_tr]) ][ (j + leading_j[i_tr]) ];
-                    if (add_val != -9999.0)
-                    {
-                        nontoxic_cntr++;            // increment the nontoxic counter
-                        runsum = runsum + add_val;  // add value to the running sum
-                    }
+                    window_sum_stripe<T, OP, all_valid> (in, out, m, req_valcount, &state[0], &delta[0],
+                                                         blk_st, blk_end, s_st, s_end, fresh, lanes);
                 }
-                // Now, record the value in the output array, if we are non-toxic
-                if (nontoxic_cntr >= req_valcount)        // check toxic counter
+                else
                 {
-                    out[i][j] = runsum / nontoxic_cntr;        // fill in with 'nodata'
+                    window_sum_stripe<T, OP, valid_bits> (in, out, m, req_valcount, &state[0], &delta[0],
+                                                          blk_st, blk_end, s_st, s_end, fresh, lanes);
                 }
-                // END SHIFTING CALC SEQUENCE HERE: on to the next column
+                fresh = false;
             }
         }
     }
+}
 
+// -------------------------------------------------------------------------------
+// MODULE FUNCTIONS
 
-    //=========================================================================================
-    // Calculation module: SUM
-    else if (strcmp (funcode.str().c_str(), "s") == 0 || strcmp (funcode.str().c_str(), "S") == 0)
+// calls the minimum or maximum kernel OP, with the monotonic deques or the sliding extreme cache
+// (see tfil_extreme.hpp), the deques if the cache would not pay on this grid
+template <typename T, typename OP>
+void run_tfil_extreme (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                       int row_st, int row_end, bool deque)
+{
+    const int nout = min (in.nrows - m.edge_guard, row_end) - max (m.edge_guard, row_st);
+    if (deque || !extreme_cache_pays (m, extreme_cache_slots (m, in.nrows, in.ncols, sizeof (T)), nout))
     {
-        cout << "EXECUTING: sum . . ." << endl;
-        // Use OpenMP to split the rows up into small chunks that are farmed
-        // out to available processers dynamically as they are available.
-        #pragma omp parallel for schedule (dynamic, CHUNKSIZE)
-        for (int i = i_st; i < i_end; i++)
-        {
-            // Prepare some private variables, note that 'j' is also private to each processer
-            double sub_val = 0.0;       // temp variables to for the sliding window part
-            double add_val = 0.0;
-            double runsum = 0.0;        // running sum
-            int i_in, j_in;             // thumb coordinates
-            int nontoxic_cntr = 0;         // nontoxic counter to track good values
+        tfil_extreme<T, OP> (in, out, m, req_valcount, row_st, row_end);
+    }
+    else
+    {
+        tfil_extreme_cached<T, OP> (in, out, m, req_valcount, row_st, row_end);
+    }
+}
 
-            // START NEW ROW CALC SEQUENCE HERE
-            // If this is a new row, we have to thumb over the whole filter mask
-            // and properly calculate the mean and runsum
-            runsum = 0.0;               // running sum for mean calculation
-            int j = j_st;               // set 'j' to starting column
-            i_in = i - edge_guard;      // coordinates that thumb over the input grid
-            j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-            nontoxic_cntr = 0;             // nontoxic counter starts at zero
+// name of the calculation module for the function code (the statistics, separated by commas),
+// or NULL if it is not recognized
+const char * tfil_module_name ()
+{
+    static string name;
+    if (stats.empty())
+    {
+        return NULL;
+    }
+    name = stat_name (stats[0], percentiles[0]);
+    for (size_t s = 1; s < stats.size(); s++)
+    {
+        name = name + ", " + stat_name (stats[s], percentiles[s]);
+    }
+    return name.c_str();
+}
 
-            // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-            for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
+// calls the calculation module for the single statistic of filter f on rows row_st to row_end
+template <typename T>
+void run_tfil_typed (raster_view<T> in, raster_view<T> out, const filter_mask &m, const filter_spec &f,
+                     int req_valcount, int row_st, int row_end)
+{
+    // Rectangles have their own modules, whose cost does not depend on the window size
+    const tfil_stat stat = f.stats[0];
+    if (m.rectangular && run_tfil_rect (in, out, m, stat, req_valcount, row_st, row_end))
+    {
+        return;
+    }
+
+    // Each kernel is compiled for its statistic and cell type, and picks the nodata policy for
+    // each tile from the validity index
+    if (stat == stat_mean)
+    {
+        tfil_window_sum<T, mean_op> (in, out, m, req_valcount, row_st, row_end);
+    }
+    else if (stat == stat_sum)
+    {
+        tfil_window_sum<T, sum_op> (in, out, m, req_valcount, row_st, row_end);
+    }
+    else if (stat == stat_min)
+    {
+        run_tfil_extreme< T, min_op<T> > (in, out, m, req_valcount, row_st, row_end, f.extreme_deque);
+    }
+    else if (stat == stat_max)
+    {
+        run_tfil_extreme< T, max_op<T> > (in, out, m, req_valcount, row_st, row_end, f.extreme_deque);
+    }
+}
+
+// calls the calculation modules for the statistics of filter f, outs[s] is the output of
+// statistic f.stats[s]: a single mean, sum, minimum or maximum has a module of its own, any
+// other statistic, or several, are calculated together (see tfil_stats.hpp), and the median and
+// percentiles together from a sliding histogram (see tfil_order.hpp), and the majority, minority
+// and variety from a sliding frequency table (see tfil_class.hpp). With --edges=partial the
+// cells whose windows cross the edge of the grid have a kernel of their own (see tfil_border.hpp)
+template <typename T>
+void run_tfil_stats_typed (raster_view<T> in, const vector< raster_view<T> > &outs, const filter_mask &m,
+                           const filter_spec &f, int req_valcount, int row_st, int row_end)
+{
+    const vector<tfil_stat> &stats = f.stats;
+    if (f.edge_partial)
+    {
+        tfil_border (in, outs, m, f, row_st, row_end);
+    }
+    if (in.nrows <= 2 * m.edge_guard || in.ncols <= 2 * m.edge_guard_j)
+    {
+        return;                 // every window crosses the edge of the grid
+    }
+    if (stats.size() > 1 || (stats.size() == 1 && stats[0] > stat_max))
+    {
+        bool order = false;
+        bool classes = false;
+        bool other = false;
+        for (size_t s = 0; s < stats.size(); s++)
+        {
+            if (is_order_stat (stats[s]))
             {
-                j_in = j - edge_guard;      // reset j_in back to beginning column
-                for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
-                {
-                    // Check to see if the filter mask is 'true'
-                    if ( fil[i_fil][j_fil] )
-                    {
-                        if (in[i_in][j_in] != -9999.0)  // check toxicity
-                        {
-                            nontoxic_cntr++;   // advance the nontoxic counter
-                            //Add to the running sum, if inside the filter mask
-                            runsum = runsum + in[i_in][j_in];
-                        }
-                    }
-                    j_in++;     // increment input thumb coordinate
-                }
-                i_in++;     // increment input thumb coordinate
+                order = true;
             }
-            if (nontoxic_cntr < req_valcount)        // check to see if we have enough values
+            else if (is_class_stat (stats[s]))
             {
-                out[i][j] = -9999.0;        // fill in with 'nodata'
+                classes = true;
             }
             else
             {
-                out[i][j] = runsum;      // calculate sum and store before moving on
-            }
-            // END NEW ROW CALC SEQUENCE HERE
-
-            // ROW LOOP: continue to the right
-            for (int j = (j_st + 1); j < j_end; j++)
-            {
-                // START SHIFTING CALC SEQUENCE HERE: the rest of the calcs will be this type
-                // Loop down the lookups and add and subtract values
-                for (int i_tr = 0; i_tr < len_lkups; i_tr++)
-                {
-                    // Perform the subtraction from the running sum
-                    sub_val = in [ (i + trailing_i[i_tr]) ][ (j + trailing_j[i_tr]) ];
-                    if (sub_val != -9999.0)
-                    {
-                        nontoxic_cntr--;            // decrement the nontoxic counter
-                        runsum = runsum - sub_val; // subtract val from running sum
-                    }
-                    // Perform the addition to the running sum
-                    add_val = in [ (i + leading_i[i_tr]) ][ (j + leading_j[i_tr]) ];
-                    if (add_val != -9999.0)
-                    {
-                        nontoxic_cntr++;            // increment the nontoxic counter
-                        runsum = runsum + add_val;  // add value to the running sum
-                    }
-                }
-                // Now, record the value in the output array, if we are non-toxic
-                if (nontoxic_cntr >= req_valcount)        // check toxic counter
-                {
-                    out[i][j] = runsum;      // calculate sum and store before moving on
-                }
-                // END SHIFTING CALC SEQUENCE HERE: on to the next column
+                other = true;
             }
         }
+        if (other)
+        {
+            tfil_stats (in, outs, m, f, req_valcount, row_st, row_end);
+        }
+        if (order)
+        {
+            tfil_order (in, outs, m, f, req_valcount, row_st, row_end);
+        }
+        if (classes)
+        {
+            tfil_class (in, outs, m, f, req_valcount, row_st, row_end);
+        }
     }
+    else
+    {
+        run_tfil_typed (in, outs[0], m, f, req_valcount, row_st, row_end);
+    }
+}
 
+// runs the calculations for rows row_st to row_end of 'dst', in the cell type of the grids
+template <typename T>
+void run_tfil_view (const raster_buffer &src, raster_buffer &dst, const filter_mask &m, const filter_spec &f,
+                    int req_valcount, int row_st, int row_end)
+{
+    vector< raster_view<T> > outs (1, dst.view<T>());
+    run_tfil_stats_typed (src.view<T>(), outs, m, f, req_valcount, row_st, row_end);
+}
 
+void run_tfil_rows (const raster_buffer &src, raster_buffer &dst, const filter_mask &m, const filter_spec &f,
+                    int req_valcount, int row_st, int row_end)
+{
+    switch (src.type)
+    {
+        case cell_int16: run_tfil_view<short> (src, dst, m, f, req_valcount, row_st, row_end); break;
+        case cell_int32: run_tfil_view<int> (src, dst, m, f, req_valcount, row_st, row_end); break;
+        case cell_float32: run_tfil_view<float> (src, dst, m, f, req_valcount, row_st, row_end); break;
+        default: run_tfil_view<double> (src, dst, m, f, req_valcount, row_st, row_end); break;
+    }
+}
+
+// -------------------------------------------------------------------------------
+// WINDOW FUNCTION: creates the filter mask of filter f for 'radius' on a grid of nr rows and nc
+// columns, returns what is wrong if it does not fit the grid, or NULL
+const char * build_window (filter_mask &m, int &req_valcount, const filter_spec &f, double radius,
+                           int nr, int nc)
+{
     //=========================================================================================
-    // Calculation module: MINIMUM
-    else if (strcmp (funcode.str().c_str(), "f") == 0 || strcmp (funcode.str().c_str(), "F") == 0)
+    // Create the filter boolean array and lookups
+    // First check the filter radius, it cannot be greater than the size of the array
+    if (f.window == window_rect)
     {
-        cout << "EXECUTING: minimum . . ." << endl;
-        // Use OpenMP to split the rows up into small chunks that are farmed
-        // out to available processers dynamically as they are available.
-        #pragma omp parallel for schedule (dynamic, CHUNKSIZE)
-        for (int i = i_st; i < i_end; i++)
+        if (!f.edge_partial && (f.window_rows > nr || f.window_cols > nc))
         {
-            // Prepare some private variables, note that 'j' is also private to each processer
-            double sub_val = 0.0;       // temp variables to for the sliding window part
-            double add_val = 0.0;
-            double minval = 0.0;        // minimum value
-            int i_in, j_in;             // thumb coordinates
-            int nontoxic_cntr = 0;      // nontoxic counter to track good values
-            int min_i = -1;              // track coordinates of the minimum value in the filter
-            int min_j = -1;
-
-            // START NEW ROW CALC SEQUENCE HERE
-            // If this is a new row, we have to thumb over the whole filter mask
-            // and properly calculate the mean and runsum
-            minval = 99999999.9;        // set min value to a high value
-            int j = j_st;               // set 'j' to starting column
-            i_in = i - edge_guard;      // coordinates that thumb over the input grid
-            j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-            nontoxic_cntr = 0;             // nontoxic counter starts at zero
-
-            // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-            for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
-            {
-                j_in = j - edge_guard;      // reset j_in back to beginning column
-                for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
-                {
-                    // Check to see if the filter mask is 'true'
-                    if ( fil[i_fil][j_fil] )
-                    {
-                        if (in[i_in][j_in] != -9999.0)  // check toxicity
-                        {
-                            nontoxic_cntr++;   // advance the nontoxic counter
-                            if (in[i_in][j_in] < minval)
-                            {
-                                minval = in[i_in][j_in];    // record new minimum value
-                                min_i = i_in;               // record the coordinates
-                                min_j = j_in;
-                            }
-                        }
-                    }
-                    j_in++;     // increment input thumb coordinate
-                }
-                i_in++;     // increment input thumb coordinate
-            }
-            if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
-            {
-                out[i][j] = minval;      // record the output value
-            }
-            // END NEW ROW CALC SEQUENCE HERE
-
-            int i_lkup, j_lkup;     // set variables to record lookup coordinates
-            // ROW LOOP: continue to the right
-            for (int j = (j_st + 1); j < j_end; j++)
-            {
-                // START SHIFTING CALC SEQUENCE HERE: the rest of the calcs will be this type
-                bool redo_normal = false;   // set flag to false
-                // Loop down the lookups and assess the values as they come up
-                for (int i_tr = 0; i_tr < len_lkups; i_tr++)
-                {
-                    // Jot down the lookup coordinates
-                    i_lkup = i + trailing_i[i_tr];
-                    j_lkup = j + trailing_j[i_tr];
-                    sub_val = in [ i_lkup ][ j_lkup ];
-                    if (sub_val != -9999.0)
-                    {
-                        nontoxic_cntr--;            // decrement the nontoxic counter
-                        if (i_lkup == min_i && j_lkup == min_j)
-                        {
-                            redo_normal = true;     // if one of the values on the trailing
-                                                    // edge is the minimum value, we have to
-                                                    // redo the algorithm normally to find min
-                        }
-                    }
-                    // Check the leading values
-                    i_lkup = i + leading_i[i_tr];
-                    j_lkup = j + leading_j[i_tr];
-                    add_val = in [ i_lkup ][ j_lkup ];
-                    if (add_val != -9999.0)
-                    {
-                        nontoxic_cntr++;            // increment the nontoxic counter
-                        // record a new low value, but don't bother if we're already going
-                        // to redo the focal cell
-                        if (!redo_normal && add_val < minval)
-                        {
-                            minval = in[i_lkup][j_lkup];    // record new minimum value
-                            min_i = i_lkup;
-                            min_j = j_lkup;
-                        }
-                    }
-                }
-                // REDO normally: if the minimum value was found on the trailing
-                // edge of the sliding window, we need to find a new minimum value normally
-                if (redo_normal)
-                {
-                    minval = 99999999.9;        // set min value to a high value
-                    i_in = i - edge_guard;      // coordinates that thumb over the input grid
-                    j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-                    nontoxic_cntr = 0;          // nontoxic counter starts at zero
-
-                    // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-                    for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
-                    {
-                        j_in = j - edge_guard;      // reset j_in back to beginning column
-                        for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
-                        {
-                            // Check to see if the filter mask is 'true'
-                            if ( fil[i_fil][j_fil] )
-                            {
-                                if (in[i_in][j_in] != -9999.0)  // check toxicity
-                                {
-                                    nontoxic_cntr++;   // advance the nontoxic counter
-                                    if (in[i_in][j_in] < minval)
-                                    {
-                                        minval = in[i_in][j_in];    // record new minimum value
-                                        min_i = i_in;
-                                        min_j = j_in;
-                                    }
-                                }
-                            }
-                            j_in++;     // increment input thumb coordinate
-                        }
-                        i_in++;     // increment input thumb coordinate
-                    }
-                }
-                // Now, record the value in the output array, if we are non-toxic
-                if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
-                {
-                    out[i][j] = minval;      // record the output value
-                }
-                // END SHIFTING CALC SEQUENCE HERE: on to the next column
-            }
+            return "INVALID Filter window: larger than the grid!";
         }
+        build_rect_mask (m, f.window_rows / 2, f.window_cols / 2);
     }
-
-    //=========================================================================================
-    // Calculation module: MAXIMUM
-    else if (strcmp (funcode.str().c_str(), "c") == 0 || strcmp (funcode.str().c_str(), "C") == 0)
+    else
     {
-        cout << "EXECUTING: maximum . . ." << endl;
-        // Use OpenMP to split the rows up into small chunks that are farmed
-        // out to available processers dynamically as they are available.
-        #pragma omp parallel for schedule (dynamic, CHUNKSIZE)
-        for (int i = i_st; i < i_end; i++)
+        if (radius < 0.0 || (!f.edge_partial && (radius > nr || radius > nc)))
         {
-            // Prepare some private variables, note that 'j' is also private to each processer
-            double sub_val = 0.0;       // temp variables to for the sliding window part
-            double add_val = 0.0;
-            double maxval = 0.0;        // minimum value
-            int i_in, j_in;             // thumb coordinates
-            int nontoxic_cntr = 0;      // nontoxic counter to track good values
-            int max_i = -1;              // track coordinates of the maximum values in the filter
-            int max_j = -1;
+            return "INVALID Filter radius!";
+        }
+        if (f.window == window_square)
+        {
+            build_rect_mask (m, (int) radius, (int) radius);
+        }
+        else
+        {
+            build_filter_mask (m, radius);
+        }
+    }
 
-            // START NEW ROW CALC SEQUENCE HERE
-            // If this is a new row, we have to thumb over the whole filter mask
-            // and properly calculate the mean and runsum
-            maxval = -99999999.9;        // set max value to a low value
-            int j = j_st;               // set 'j' to starting column
-            i_in = i - edge_guard;      // coordinates that thumb over the input grid
-            j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-            nontoxic_cntr = 0;             // nontoxic counter starts at zero
+    // Calculate the number of required values from each filter window
+    // use ceiling to be conservative with this function
+    req_valcount = (int) ceil(f.nontoxic_frac * m.mask_sum);
 
-            // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-            for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
-            {
-                j_in = j - edge_guard;      // reset j_in back to beginning column
-                for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
-                {
-                    // Check to see if the filter mask is 'true'
-                    if ( fil[i_fil][j_fil] )
-                    {
-                        if (in[i_in][j_in] != -9999.0)  // check toxicity
-                        {
-                            nontoxic_cntr++;   // advance the nontoxic counter
-                            if (in[i_in][j_in] > maxval)
-                            {
-                                maxval = in[i_in][j_in];    // record new max value
-                                max_i = i_in;               // record the coordinates
-                                max_j = j_in;
-                            }
-                        }
-                    }
-                    j_in++;     // increment input thumb coordinate
-                }
-                i_in++;     // increment input thumb coordinate
-            }
-            if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
-            {
-                out[i][j] = maxval;      // record the output value
-            }
-            // END NEW ROW CALC SEQUENCE HERE
+    // Check to ensure the start and finish coordinates are not out of bounds!! At least one
+    // cell must have its whole window inside the grid, a window one row high or one column
+    // wide has no edge to guard. With partial windows at the edges any window will do
+    if (f.edge_partial)
+    {
+        return NULL;
+    }
+    const int i_st = m.edge_guard;
+    const int i_end = nr - m.edge_guard;        // one past the last row
+    const int j_st = m.edge_guard_j;
+    const int j_end = nc - m.edge_guard_j;
+    if (i_st < 0 || i_end <= i_st || j_st < 0 || j_end <= j_st)
+    {
+        return (f.window == window_rect) ? "INVALID Filter window: larger than the grid!"
+                                         : "INVALID Filter radius: the window is larger than the grid!";
+    }
+    return NULL;
+}
 
-            int i_lkup, j_lkup;     // set variables to record lookup coordinates
-            // ROW LOOP: continue to the right
-            for (int j = (j_st + 1); j < j_end; j++)
-            {
-                // START SHIFTING CALC SEQUENCE HERE: the rest of the calcs will be this type
-                bool redo_normal = false;   // set flag to false
-                // Loop down the lookups and assess the values as they come up
-                for (int i_tr = 0; i_tr < len_lkups; i_tr++)
-                {
-                    // Jot down the lookup coordinates
-                    i_lkup = i + trailing_i[i_tr];
-                    j_lkup = j + trailing_j[i_tr];
-                    sub_val = in [ i_lkup ][ j_lkup ];
-                    if (sub_val != -9999.0)
-                    {
-                        nontoxic_cntr--;            // decrement the nontoxic counter
-                        if (i_lkup == max_i && j_lkup == max_j)
-                        {
-                            redo_normal = true;     // if one of the values on the trailing
-                                                    // edge is the maximum value, we have to
-                                                    // redo the algorithm normally to find max
-                        }
-                    }
-                    // Check the leading values
-                    i_lkup = i + leading_i[i_tr];
-                    j_lkup = j + leading_j[i_tr];
-                    add_val = in [ i_lkup ][ j_lkup ];
-                    if (add_val != -9999.0)
-                    {
-                        nontoxic_cntr++;            // increment the nontoxic counter
-                        // record a new low value, but don't bother if we're already going
-                        // to redo the focal cell
-                        if (!redo_normal && add_val > maxval)
-                        {
-                            maxval = in[i_lkup][j_lkup];    // record new maximum value
-                            max_i = i_lkup;
-                            max_j = j_lkup;
-                        }
-                    }
-                }
-                // REDO normally: if the minimum value was found on the trailing
-                // edge of the sliding window, we need to find a new minimum value normally
-                if (redo_normal)
-                {
-                    maxval = -99999999.9;        // set min value to a high value
-                    i_in = i - edge_guard;      // coordinates that thumb over the input grid
-                    j_in = j - edge_guard;      // starting from minimum values, progressively looping up
-                    nontoxic_cntr = 0;          // nontoxic counter starts at zero
+// -------------------------------------------------------------------------------
+// SETUP FUNCTION: creates the filter mask of the command line for 'radius' and checks it fits
+// the grid
+void setup_tfil (filter_mask &m, int &req_valcount, double radius)
+{
+    const char *problem = build_window (m, req_valcount, command_line_spec (), radius, nrows, ncols);
+    if (problem != NULL)
+    {
+        cout << problem << endl; exit (3);
+    }
+}
 
-                    // Main filter loop, thumbs over the mask, while updating input grid coords simultaneously
-                    for (int i_fil = i_f_st; i_fil < i_f_end; i_fil++)
-                    {
-                        j_in = j - edge_guard;      // reset j_in back to beginning column
-                        for (int j_fil = j_f_st; j_fil < j_f_end; j_fil++)
-                        {
-                            // Check to see if the filter mask is 'true'
-                            if ( fil[i_fil][j_fil] )
-                            {
-                                if (in[i_in][j_in] != -9999.0)  // check toxicity
-                                {
-                                    nontoxic_cntr++;   // advance the nontoxic counter
-                                    if (in[i_in][j_in] > maxval)
-                                    {
-                                        maxval = in[i_in][j_in];    // record new maximum value
-                                        max_i = i_in;
-                                        max_j = j_in;
-                                    }
-                                }
-                            }
-                            j_in++;     // increment input thumb coordinate
-                        }
-                        i_in++;     // increment input thumb coordinate
-                    }
-                }
-                // Now, record the value in the output array, if we are non-toxic
-                if (nontoxic_cntr >= req_valcount)        // check to see if we have enough values
-                {
-                    out[i][j] = maxval;      // record the output value
-                }
-                // END SHIFTING CALC SEQUENCE HERE: on to the next column
-            }
+// -------------------------------------------------------------------------------
+// RUN FUNCTION
+void run_tfil()
+{
+    filter_mask m;
+    int req_valcount = 0;
+    setup_tfil (m, req_valcount, rad);
+
+    cout << "Beginning calculations with function code: " << funcode.str().c_str() << endl;
+    const char *module = tfil_module_name ();
+    if (module != NULL)
+    {
+        cout << "EXECUTING: " << module << " . . ." << endl;
+        if (m.rectangular)
+        {
+            cout << "Window: " << 2 * m.edge_guard + 1 << " x " << 2 * m.edge_guard_j + 1 << " rectangle" << endl;
+        }
+        else
+        {
+            cout << "Tiles: blocks of " << slide_chunk (nrows - 2 * m.edge_guard) << " rows, stripes of "
+                 << tile_stripe_cols (m, cell_type_size (in.type), ncols - 2 * m.edge_guard_j)
+                 << " columns" << endl;
+        }
+        cout << "Vector instructions: " << simd_name (simd_lanes_used ()) << endl;
+        run_tfil_rows (in, out, m, command_line_spec (), req_valcount, 0, nrows);
+        if (extreme_cache_hits + extreme_cache_misses > 0)
+        {
+            cout << "Row extreme cache: " << extreme_cache_hits << " hits, "
+                 << extreme_cache_misses << " misses" << endl;
         }
     }
-
     else
     {
         cout << "ERROR: I couldn't recognize your function code??" << endl;
     }
     cout << "Ending calculations with function code: " << funcode.str().c_str() << endl;
 }
-
-
-
-
-
@@ -3,25 +3,38 @@
 
 // -------------------------------------------------------------------------------
 // GLOBAL VARIABLES
-const int max_nrow = 8000;              // these need to be adjusted if compiling on
-const int max_ncol = 8000;              // systems with limited memory capacity
-double in [max_nrow][max_ncol];         // input and output arrays, static allocation
-double out [max_nrow][max_ncol];
-
-const int max_filsize = 1001;           // this must be odd!
-const int cen_i = max_filsize / 2;      // set the center coordinates
-const int cen_j = max_filsize / 2;
-bool fil[max_filsize][max_filsize];     // boolean filter mask, true = included, false = excluded
+raster_buffer in;                       // input and output arrays, allocated at run time
+raster_buffer out;                      // from the dimensions in the file header
+cell_type celltype = cell_float64;      // cell type of the input and output arrays
 
 int nrows, ncols;                       // global constants for number of rows and number of columns
 
 ostringstream infile;                   // input file
 ostringstream outfile;                  // output file
 ostringstream funcode;                  // function code
+bool in_binary = false;                 // true if the input is an ESRI binary grid (.flt/.hdr)
+bool out_binary = false;                // true if the output is an ESRI binary grid
 double rad;                             // radius of filter circle
+vector<double> radii;                   // every radius of a batch, smallest first (see tfil_batch.hpp)
+window_shape window = window_circle;    // shape of the filter window
+int window_rows = 0;                    // rows and columns of a rectangular window
+int window_cols = 0;
 double nodataflag;                      // no data flag value
 char xllcorner[100];                    // set character array for projection parameters
 char yllcorner[100];
 char cellsize[100];
+int precision = 6;                      // number of decimals in the output file
+bool stream_mode = false;               // true to read, filter and write a band of rows at a time
+int stream_margin = 0;                  // rows added to the streaming band each step (0 = automatic)
+bool extreme_deque = false;             // true for the monotonic deque minimum/maximum engine
+int extreme_cache_mb = 0;               // minimum/maximum row cache for each processor in MB (0 = automatic)
+long long extreme_cache_hits = 0;       // minimum/maximum row cache statistics
+long long extreme_cache_misses = 0;
+int tile_cache_kb = 0;                  // cache size for the tile stripes in KB (0 = automatic)
+int simd_lanes = -1;                    // rows slid together by the mean and sum: 8 (AVX-512),
+                                        // 4 (AVX2) or 1 (off), -1 = the best the processor has
+string report_name;                     // run report (see tfil_probe.hpp), empty for next to the output
+bool edge_partial = false;              // true to calculate the edge cells from the part of
+                                        // their window inside the grid (see tfil_border.hpp)
 double nontoxic_frac = 1.0;             // fraction of nontoxic values required
                                         // defaults to 1.0
@@ -0,0 +1,311 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Filter mask and sliding window lookups
+
+// -------------------------------------------------------------------------------
+// WINDOW SHAPES
+enum window_shape
+{
+    window_circle,              // circle of the given radius (default)
+    window_square,              // square, the radius is half of the side
+    window_rect                 // rectangle of a given number of rows and columns
+};
+
+// parse a window shape: 'circle', 'square' or 'ROWSxCOLS' (odd numbers of cells, so the focal
+// cell is in the middle), returns false if it is not recognized
+bool parse_window_shape (const char *text, window_shape &shape, int &rows, int &cols)
+{
+    if (strcmp (text, "circle") == 0) { shape = window_circle; return true; }
+    if (strcmp (text, "square") == 0) { shape = window_square; return true; }
+    char x = 0;
+    char extra = 0;
+    if (sscanf (text, "%d%c%d%c", &rows, &x, &cols, &extra) != 3 || (x != 'x' && x != 'X'))
+    {
+        return false;
+    }
+    if (rows < 1 || cols < 1 || rows % 2 == 0 || cols % 2 == 0)
+    {
+        return false;
+    }
+    shape = window_rect;
+    return true;
+}
+
+// -------------------------------------------------------------------------------
+// FILTER MASK: the circle and the edge lookups used by the sliding window
+struct filter_mask
+{
+    raster<bool> fil;           // boolean filter mask, true = included, false = excluded
+    int filsize;                // size of the filter mask, this is always odd
+    int cen_i;                  // center coordinates of the filter mask
+    int cen_j;
+    int mask_sum;               // the number of cells in the circle
+    int edge_guard;             // the number of rows to 'guard' on the top and bottom edges
+    int edge_guard_j;           // the number of columns to 'guard' on the left and right edges
+    bool rectangular;           // true if the window is a rectangle (every cell is included)
+
+    // starting and ending points for loops over the filter mask array
+    int i_f_st;
+    int i_f_end;
+    int j_f_st;
+    int j_f_end;
+
+    // offsets from the focal cell to the trailing and leading edges of each mask row
+    vector<int> trailing_i;
+    vector<int> trailing_j;
+    vector<int> leading_i;
+    vector<int> leading_j;
+    int len_lkups;              // the length of the lookup arrays
+
+    // offsets from the focal cell to the top and bottom edges of each mask column, for
+    // sliding the window down one row
+    vector<int> top_i;
+    vector<int> top_j;
+    vector<int> bottom_i;
+    vector<int> bottom_j;
+    int len_vlkups;             // the length of the vertical lookup arrays
+};
+
+// -------------------------------------------------------------------------------
+// VERTICAL LOOKUP FUNCTION: the top and bottom edges of each column of the mask. These work
+// the same way as the trailing and leading edges of the rows, turned on their side: when the
+// focal cell moves down one row, the top cell of each column leaves the window and the cell
+// below its bottom edge comes in, so a row can start from the window of the row above
+void build_vertical_lookups (filter_mask &m)
+{
+    m.top_i.clear();
+    m.top_j.clear();
+    m.bottom_i.clear();
+    m.bottom_j.clear();
+    for (int j = m.j_f_st; j < m.j_f_end; j++)
+    {
+        for (int i = m.i_f_st; i < m.i_f_end; i++)
+        {
+            // The top coordinate is assessed when the focal cell is one row further down,
+            // so we need to subtract one from it (the mask is padded, so the rows above and
+            // below are always inside it)
+            if (m.fil[i][j] && !m.fil[i-1][j])
+            {
+                m.top_i.push_back (i - m.cen_i - 1);
+                m.top_j.push_back (j - m.cen_j);
+            }
+            // check for the bottom coordinate
+            if (m.fil[i][j] && !m.fil[i+1][j])
+            {
+                m.bottom_i.push_back (i - m.cen_i);
+                m.bottom_j.push_back (j - m.cen_j);
+            }
+        }
+    }
+    m.len_vlkups = (int) m.top_i.size();
+}
+
+// -------------------------------------------------------------------------------
+// MASK FUNCTION: creates the filter boolean array and the lookups for radius 'rad'
+void build_filter_mask (filter_mask &m, double rad)
+{
+    // The mask is sized from the radius, with one 'false' cell of padding on each side
+    // so the edge lookups below can safely test the neighbours of every included cell
+    m.filsize = 2 * (int) rad + 3;
+    m.cen_i = m.filsize / 2;
+    m.cen_j = m.filsize / 2;
+    m.fil.allocate (m.filsize, m.filsize);
+
+    const int filsize = m.filsize;
+    const int cen_i = m.cen_i;
+    const int cen_j = m.cen_j;
+    raster<bool> &fil = m.fil;
+
+    // This array is 'true' if within the filter 'window'
+    double dist = 0.0;          // distance from focal cell: measured center to center
+    int mask_sum = 0;           // the mask sum is the number of occurences of 'true'
+    int min_i = filsize;        // begin by setting this to a very high value
+    for (int i = 0; i < filsize; i++)
+    {
+        for (int j = 0; j < filsize; j++)
+        {
+            // Calculate difference between focal cell and location, and tag if less than radius
+            // Note that the following comparison is 'less than or equal to': this matters for edge cells
+            dist = double (sqrt ( ( (i - cen_i) * (i - cen_i) ) + ( (j - cen_j) * (j - cen_j) ) ) );
+            if (dist <= rad)
+            {
+                fil[i][j] = true;
+                mask_sum++;             // add one to the total
+                if (i < min_i)
+                {
+                    min_i = i;
+                }
+            }
+            else
+            {
+                fil[i][j] = false;
+            }
+        }
+    }
+    m.mask_sum = mask_sum;
+
+    int edge_guard = cen_i - min_i;         // determine the number of cells to 'guard' on the edges
+    m.edge_guard = edge_guard;
+    m.edge_guard_j = edge_guard;            // a circle guards the same number of rows and columns
+    m.rectangular = false;
+
+    // Pre-calculate starting and ending points for the filter mask array
+    // The '+1' at the end of the ending coordinate is required because it is
+    // part of a 'for loop' with a '<' conditional evaluation.
+    m.i_f_st = min_i;
+    m.i_f_end = cen_i + edge_guard + 1;
+    m.j_f_st = min_i;
+    m.j_f_end = cen_j + edge_guard + 1;
+
+    // NEW algorithm also sets arrays with the coordinates for the trailing edge of the sliding
+    // window and the leading edge of the window. The idea is to speed up calculations by keeping
+    // the running sum and simply adding and subtracting from the front and back of the filter
+    // window. This reduces the number of references substantially, and should speed up the
+    // program significantly.
+    // set the lookup arrays
+    m.trailing_i.assign (filsize, 0);
+    m.trailing_j.assign (filsize, 0);
+    m.leading_i.assign (filsize, 0);
+    m.leading_j.assign (filsize, 0);
+
+    // now, loop through the filter and set the lookup arrays
+    int i_tr = 0;   // thumb coordinate for the lookup, starting with zero
+    for (int i = m.i_f_st; i < m.i_f_end; i++)
+    {
+        for (int j = m.j_f_st; j < m.j_f_end; j++)
+        {
+            // Starting a new row, we'll run across the filter and record the edge coords
+            // Set the coordinates, this will be assessed when the function has a focal
+            // cell that is one cell to the right, so, we need to subtract one from it.
+            // These values are the offset from the focal cell, so some will be negative
+            if (fil[i][j] && !fil[i][j-1])
+            {
+                m.trailing_i [i_tr] = i - cen_i;
+                m.trailing_j [i_tr] = j - cen_j - 1;
+            }
+            // check for the leading coordinate
+            if (fil[i][j] && !fil[i][j+1])
+            {
+                m.leading_i [i_tr] = i - cen_i;
+                m.leading_j [i_tr] = j - cen_j;
+            }
+        }
+        i_tr++;
+    }
+    m.len_lkups = i_tr;         // save the length of the lookup array
+    build_vertical_lookups (m);
+}
+
+// -------------------------------------------------------------------------------
+// RECTANGLE MASK FUNCTION: creates a rectangular filter array of 2 * half_i + 1 rows and
+// 2 * half_j + 1 columns, and the lookups for it
+void build_rect_mask (filter_mask &m, int half_i, int half_j)
+{
+    // Sized and padded the same way as the circle, so the lookups work the same way
+    m.filsize = 2 * max (half_i, half_j) + 3;
+    m.cen_i = m.filsize / 2;
+    m.cen_j = m.filsize / 2;
+    m.fil.allocate (m.filsize, m.filsize);
+    for (int i = 0; i < m.filsize; i++)
+    {
+        for (int j = 0; j < m.filsize; j++)
+        {
+            m.fil[i][j] = (abs (i - m.cen_i) <= half_i && abs (j - m.cen_j) <= half_j);
+        }
+    }
+    m.mask_sum = (2 * half_i + 1) * (2 * half_j + 1);
+    m.edge_guard = half_i;
+    m.edge_guard_j = half_j;
+    m.rectangular = true;
+    m.i_f_st = m.cen_i - half_i;
+    m.i_f_end = m.cen_i + half_i + 1;
+    m.j_f_st = m.cen_j - half_j;
+    m.j_f_end = m.cen_j + half_j + 1;
+
+    // Every row of a rectangle has the same trailing and leading edges
+    m.len_lkups = 2 * half_i + 1;
+    m.trailing_i.assign (m.len_lkups, 0);
+    m.trailing_j.assign (m.len_lkups, -half_j - 1);
+    m.leading_i.assign (m.len_lkups, 0);
+    m.leading_j.assign (m.len_lkups, half_j);
+    for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+    {
+        m.trailing_i[i_tr] = i_tr - half_i;
+        m.leading_i[i_tr] = i_tr - half_i;
+    }
+    build_vertical_lookups (m);
+}
+
+// -------------------------------------------------------------------------------
+// COUNT FUNCTIONS: how the number of values in the window changes as it slides
+
+// adds 'sign' to delta[c] for each 'nodata' cell of row r at column c0 + c, for c from 0 to
+// n - 1. Only the 'nodata' cells are visited, a word of 64 cells with values costs nothing.
+template <typename T>
+inline void add_missing (raster_view<T> in, int r, int c0, int n, int *delta, int sign)
+{
+    const bit_word *row = in.valid + r * in.valid_stride;
+    for (int c = 0; c < n; c += 64)
+    {
+        bit_word miss = ~bits_from (row, c0 + c);
+        if (n - c < 64)
+        {
+            miss &= (1ULL << (n - c)) - 1;
+        }
+        while (miss != 0)
+        {
+            delta[c + bit_first (miss)] += sign;
+            miss &= miss - 1;
+        }
+    }
+}
+
+// the change in the number of values in the window of row i as it slides onto each column
+// j from j_from to j_to - 1, in delta[j - j_from]: one for each leading cell with a value,
+// less one for each trailing cell with a value, from the validity bits of the input
+template <typename T>
+void slide_counts (raster_view<T> in, const filter_mask &m, int i, int j_from, int j_to, int *delta)
+{
+    const int n = j_to - j_from;
+    fill (delta, delta + max (n, 0), 0);        // as if every cell had a value
+    for (int i_tr = 0; i_tr < m.len_lkups; i_tr++)
+    {
+        add_missing (in, i + m.leading_i[i_tr], j_from + m.leading_j[i_tr], n, delta, -1);
+        add_missing (in, i + m.trailing_i[i_tr], j_from + m.trailing_j[i_tr], n, delta, 1);
+    }
+}
+
+// -------------------------------------------------------------------------------
+// NODATA POLICIES: how a kernel counts the values of its windows, chosen for each tile from
+// the validity index (see tile_footprint in tfil_tiles.hpp). valid_bits reads the validity
+// plane. all_valid is for tiles whose windows reach no 'nodata' cells, every cell counts, so
+// the counting is compiled out of the inner loops.
+struct valid_bits
+{
+    static const bool counted = true;       // false if the count of a window never changes
+
+    template <typename T>
+    static bool has (const raster_view<T> &in, int i, int j) { return in.has (i, j); }
+
+    template <typename T>
+    static int count (const raster_view<T> &in, int i, int c0, int c1) { return in.count (i, c0, c1); }
+
+    template <typename T>
+    static void changes (raster_view<T> in, const filter_mask &m, int i, int j_from, int j_to, int *delta)
+    {
+        slide_counts (in, m, i, j_from, j_to, delta);
+    }
+};
+
+struct all_valid
+{
+    static const bool counted = false;
+
+    template <typename T>
+    static bool has (const raster_view<T> &, int, int) { return true; }
+
+    template <typename T>
+    static int count (const raster_view<T> &, int, int c0, int c1) { return max (0, c1 - c0); }
+
+    template <typename T>
+    static void changes (raster_view<T>, const filter_mask &, int, int, int, int *) {}
+};
@@ -0,0 +1,458 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Median and percentiles with sliding histograms
+
+/*
+The median and percentiles of a window come from a histogram of its values (Huang's
+method): when the window slides one cell, the cells of the trailing edge are taken out of
+the histogram and the cells of the leading edge are put in, through the same lookups as the
+running sums, so each output cell costs O(r) updates instead of a sort of the whole window.
+Each row of a block is swept in the opposite direction to the row before (a serpentine), and
+the window moves down a row at the end of each row through the top and bottom lookups, so a
+single histogram slides through the whole block and is only filled once.
+
+The histogram counts levels rather than values: every input cell is replaced by its level,
+the position of its value in the sorted values. The levels are built for each tile of the
+grid on its own, from the cells its windows reach, by the thread that takes it, so every
+value has a level of its own however many different values the grid has, the results are
+exact, and the histogram is never larger than the tile. Whole numbers (any integer grid, and
+float grids of whole metres) are their own levels, less the smallest, if they do not span
+many more levels than the tile has cells, otherwise the distinct values are sorted. The
+tiles are at least as tall as the window, and at least four windows wide, so the cells the
+windows reach are at most a few times as many as the tile has. The results do not depend on
+the tiles, so a streamed band (see tfil_stream.hpp) gives the same results as the whole grid.
+
+A percentile is found with a rank pointer: a level, and the number of values in the window
+below it. Each update moves the count, and the pointer then steps up or down to the level
+that holds the wanted rank, which for neighbouring windows of a DEM is only a few levels
+away. A second, coarse histogram (one count for every 64 levels) lets the pointer jump over
+long runs of levels that are not in the window.
+
+The column histograms of Perreault and Hebert would make each output cell O(1), but they
+need a histogram for every column, which is far too much memory with this many levels.
+
+The percentile p of n values is the value of rank ceil (p / 100 * n), at least 1 (the
+nearest rank). The median is the middle value, or the mean of the two middle values if n is
+even. 'nodata' cells are not counted.
+*/
+
+const int order_direct_levels = 1 << 16;    // whole numbers spanning up to this many levels are
+                                            // their own levels, however few cells there are
+const unsigned int no_level = 0xFFFFFFFFu;  // level of a 'nodata' cell
+
+// -------------------------------------------------------------------------------
+// LEVELS: the level of every cell of a rectangle of the input, and the value of each level
+class order_levels
+{
+public:
+    vector<unsigned int> cells;     // level of each cell of the rectangle, rows 'ncols' apart
+    vector<double> value;           // value of each level
+    int row0;                       // first row and column of the rectangle
+    int col0;
+    int ncols;
+
+    order_levels () : row0 (0), col0 (0), ncols (0) {}
+
+    unsigned int operator() (ptrdiff_t i, int j) const { return cells[(i - row0) * ncols + (j - col0)]; }
+
+    // builds the levels of the cells of rows i_lo to i_hi - 1 and columns j_lo to j_hi - 1 of
+    // 'in', or only of those within band_i rows and band_j columns of the edges of the grid (see
+    // tfil_border.hpp), the other cells have no level. Called from a parallel region (for one
+    // tile), it runs on the calling thread alone.
+    template <typename T>
+    void build (raster_view<T> in, int i_lo, int i_hi, int j_lo, int j_hi, int band_i = -1, int band_j = -1)
+    {
+        i_lo = max (0, i_lo);
+        i_hi = min (in.nrows, i_hi);
+        j_lo = max (0, j_lo);
+        j_hi = min (in.ncols, j_hi);
+        row0 = i_lo;
+        col0 = j_lo;
+        ncols = max (0, j_hi - j_lo);
+        cells.assign ((size_t) max (0, i_hi - i_lo) * ncols, no_level);
+        if (cells.empty())
+        {
+            value.assign (1, 0.0);      // no cells at all
+            return;
+        }
+        const bool all = (band_i < 0);
+        const bool team = !omp_in_parallel();
+
+        // The range of the values, how many there are, and whether they are all whole numbers
+        double lo = numeric_limits<double>::max();
+        double hi = -numeric_limits<double>::max();
+        long long count = 0;
+        int whole = 1;
+        #pragma omp parallel for if (team) schedule (dynamic, CHUNKSIZE) reduction (min:lo) reduction (max:hi) reduction (+:count) reduction (&&:whole)
+        for (int i = i_lo; i < i_hi; i++)
+        {
+            const T *row = in[i];
+            for (int j = j_lo; j < j_hi; j++)
+            {
+                if (in.has (i, j) && (all || edge_cell (in, i, j, band_i, band_j)))
+                {
+                    const double v = (double) row[j];
+                    lo = min (lo, v);
+                    hi = max (hi, v);
+                    count++;
+                    whole = whole && (v == floor (v));
+                }
+            }
+        }
+        if (lo > hi)
+        {
+            value.assign (1, 0.0);      // no values at all
+            return;
+        }
+
+        if (whole && hi - lo < max ((double) order_direct_levels, (double) count))
+        {
+            // Whole numbers are their own levels
+            value.resize ((size_t) (hi - lo) + 1);
+            for (size_t l = 0; l < value.size(); l++)
+            {
+                value[l] = lo + (double) l;
+            }
+            #pragma omp parallel for if (team) schedule (dynamic, CHUNKSIZE)
+            for (int i = i_lo; i < i_hi; i++)
+            {
+                const T *row = in[i];
+                unsigned int *dst = &cells[0] + (ptrdiff_t) (i - i_lo) * ncols - j_lo;
+                for (int j = j_lo; j < j_hi; j++)
+                {
+                    if (in.has (i, j) && (all || edge_cell (in, i, j, band_i, band_j)))
+                    {
+                        dst[j] = (unsigned int) ((double) row[j] - lo);
+                    }
+                }
+            }
+            return;
+        }
+
+        // Otherwise sort the distinct values, each one is a level
+        vector<T> sorted;
+        sorted.reserve ((size_t) count);
+        for (int i = i_lo; i < i_hi; i++)
+        {
+            for (int j = j_lo; j < j_hi; j++)
+            {
+                if (in.has (i, j) && (all || edge_cell (in, i, j, band_i, band_j)))
+                {
+                    sorted.push_back (in[i][j]);
+                }
+            }
+        }
+        sort (sorted.begin(), sorted.end());
+        sorted.erase (unique (sorted.begin(), sorted.end()), sorted.end());
+        value.assign (sorted.begin(), sorted.end());
+        #pragma omp parallel for if (team) schedule (dynamic, CHUNKSIZE)
+        for (int i = i_lo; i < i_hi; i++)
+        {
+            const T *row = in[i];
+            unsigned int *dst = &cells[0] + (ptrdiff_t) (i - i_lo) * ncols - j_lo;
+            for (int j = j_lo; j < j_hi; j++)
+            {
+                if (in.has (i, j) && (all || edge_cell (in, i, j, band_i, band_j)))
+                {
+                    dst[j] = (unsigned int) (lower_bound (sorted.begin(), sorted.end(), row[j]) - sorted.begin());
+                }
+            }
+        }
+    }
+
+private:
+    // true if cell (i, j) of grid 'in' is within band_i rows or band_j columns of its edges
+    template <typename T>
+    static bool edge_cell (raster_view<T> in, int i, int j, int band_i, int band_j)
+    {
+        return i < band_i || i >= in.nrows - band_i || j < band_j || j >= in.ncols - band_j;
+    }
+};
+
+// -------------------------------------------------------------------------------
+// SLIDING HISTOGRAM: the levels of the values in the window, with rank pointers
+class sliding_histogram
+{
+public:
+    int n;                          // number of values in the window
+
+    sliding_histogram (int nlevels, int npointers)
+        : n (0), fine ((nlevels + 63) / 64 * 64, 0), coarse ((nlevels + 63) / 64, 0),
+          level (npointers, 0), below (npointers, 0) {}
+
+    // empties the histogram, for 'nlevels' levels
+    void reset (int nlevels)
+    {
+        n = 0;
+        fine.assign ((nlevels + 63) / 64 * 64, 0);
+        coarse.assign ((nlevels + 63) / 64, 0);
+        level.assign (level.size(), 0);
+        below.assign (below.size(), 0);
+    }
+
+    void add (unsigned int l)
+    {
+        if (l == no_level)
+        {
+            return;
+        }
+        fine[l]++;
+        coarse[l >> 6]++;
+        n++;
+        for (size_t p = 0; p < level.size(); p++)
+        {
+            below[p] += ((int) l < level[p]);
+        }
+    }
+
+    void remove (unsigned int l)
+    {
+        if (l == no_level)
+        {
+            return;
+        }
+        fine[l]--;
+        coarse[l >> 6]--;
+        n--;
+        for (size_t p = 0; p < level.size(); p++)
+        {
+            below[p] -= ((int) l < level[p]);
+        }
+    }
+
+    // level of the value of rank k (1 to n) in the window, by moving pointer p to it
+    int find (int p, int k)
+    {
+        int l = level[p];
+        int b = below[p];           // number of values below level l
+        while (b >= k)
+        {
+            // step down, a whole block of 64 levels at a time if the rank is not in it
+            if ((l & 63) == 0 && b - coarse[(l >> 6) - 1] >= k)
+            {
+                l -= 64;
+                b -= coarse[l >> 6];
+            }
+            else
+            {
+                l--;
+                b -= fine[l];
+            }
+        }
+        while (b + fine[l] < k)
+        {
+            // step up, the same way
+            if ((l & 63) == 0 && b + coarse[l >> 6] < k)
+            {
+                b += coarse[l >> 6];
+                l += 64;
+            }
+            else
+            {
+                b += fine[l];
+                l++;
+            }
+        }
+        level[p] = l;
+        below[p] = b;
+        return l;
+    }
+
+private:
+    vector<int> fine;               // count of each level
+    vector<int> coarse;             // count of each block of 64 levels
+    vector<int> level;              // level of each rank pointer
+    vector<int> below;              // number of values below the level of each pointer
+};
+
+// -------------------------------------------------------------------------------
+// SERPENTINE SLIDE: slides a window of levels through rows row_st to row_end of grid 'in', in
+// tiles. A copy of 'proto' for each thread is given the levels of each tile it takes (start
+// (lv)), is told each level that comes into the window (add) and leaves it (remove), and
+// records each focal cell (record (i, j)) once its window is complete.
+template <typename T, typename W>
+void slide_levels (raster_view<T> in, const filter_mask &m, int row_st, int row_end, const W &proto)
+{
+    const int nrows = in.nrows;
+    const int ncols = in.ncols;
+
+    // Pre-calculate start and finish coords for input array, the edges are left as 'nodata'
+    const int i_st = m.edge_guard;
+    const int i_end = nrows - m.edge_guard;
+    const int j_st = m.edge_guard_j;
+    const int j_end = ncols - m.edge_guard_j;
+    const int i_lo = max (i_st, row_st);
+    const int i_hi = min (i_end, row_end);
+    const int width = max (0, j_end - j_st);
+    if (i_lo >= i_hi || width == 0)
+    {
+        return;
+    }
+
+    // The lookups for the edges of each row and column of the mask
+    const int *trailing_i = &m.trailing_i[0];
+    const int *trailing_j = &m.trailing_j[0];
+    const int *leading_i = &m.leading_i[0];
+    const int *leading_j = &m.leading_j[0];
+    const int len_lkups = m.len_lkups;
+    const int *top_i = &m.top_i[0];
+    const int *top_j = &m.top_j[0];
+    const int *bottom_i = &m.bottom_i[0];
+    const int *bottom_j = &m.bottom_j[0];
+    const int len_vlkups = m.len_vlkups;
+
+    // Share out tiles (see tfil_tiles.hpp) at least as tall as the window and four windows wide
+    const int blk_rows = max (row_chunk (i_hi - i_lo), m.filsize);
+    const int str_cols = max (tile_stripe_cols (m, sizeof (T), width), 4 * m.filsize);
+    tile_schedule tiles (i_lo, i_hi, j_st, j_end, blk_rows, str_cols);
+
+    #pragma omp parallel
+    {
+        W w (proto);
+        order_levels lv;
+        int blk_st, blk_end, str_st, str_end;
+        while (tiles.next_tile (blk_st, blk_end, str_st, str_end))
+        {
+            // The levels of the cells the windows of the tile reach
+            lv.build (in, blk_st - m.cen_i, blk_end + m.filsize - 1 - m.cen_i, str_st - m.cen_j,
+                      str_end + m.filsize - 1 - m.cen_j);
+            w.start (lv);
+
+            // START NEW BLOCK CALC SEQUENCE HERE: thumb over the whole filter mask once
+            probe_count (&probe_thread::row_starts, 1);
+            int j = str_st;
+            for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+            {
+                const int i_in = blk_st + leading_i[i_tr];
+                for (int j_in = j + trailing_j[i_tr] + 1; j_in < j + leading_j[i_tr] + 1; j_in++)
+                {
+                    w.add (lv (i_in, j_in));
+                }
+            }
+
+            for (int i = blk_st; i < blk_end; i++)
+            {
+                // The rows of the block go left to right and right to left in turn
+                const bool rightwards = ((i - blk_st) % 2 == 0);
+                if (i > blk_st)
+                {
+                    // Slide the window down one row, at the column the row above finished on
+                    for (int i_tr = 0; i_tr < len_vlkups; i_tr++)
+                    {
+                        w.remove (lv (i + top_i[i_tr], j + top_j[i_tr]));
+                        w.add (lv (i + bottom_i[i_tr], j + bottom_j[i_tr]));
+                    }
+                }
+
+                // ROW LOOP: record the cell, then slide on to the next, until the end of the row
+                for (int c = 0; c < str_end - str_st; c++)
+                {
+                    if (c > 0)
+                    {
+                        if (rightwards)
+                        {
+                            j++;
+                            for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                            {
+                                w.remove (lv (i + trailing_i[i_tr], j + trailing_j[i_tr]));
+                                w.add (lv (i + leading_i[i_tr], j + leading_j[i_tr]));
+                            }
+                        }
+                        else
+                        {
+                            // Leftwards the leading edge leaves and the trailing edge comes back
+                            for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                            {
+                                w.remove (lv (i + leading_i[i_tr], j + leading_j[i_tr]));
+                                w.add (lv (i + trailing_i[i_tr], j + trailing_j[i_tr]));
+                            }
+                            j--;
+                        }
+                    }
+                    w.record (i, j);
+                }
+            }
+
+        }
+    }
+}
+
+// value of order statistic s of filter f of the n values in histogram h, from rank pointers p
+// and p + 1
+inline double order_value (sliding_histogram &h, const order_levels &lv, const filter_spec &f, size_t s,
+                           int p, int n)
+{
+    if (f.stats[s] == stat_median)
+    {
+        const int lower = h.find (p, (n + 1) / 2);
+        const int upper = h.find (p + 1, n / 2 + 1);
+        return 0.5 * (lv.value[lower] + lv.value[upper]);
+    }
+    int k = (int) ceil (f.percentiles[s] * n / 100.0 - 1e-9);
+    k = max (1, min (n, k));
+    return lv.value[h.find (p, k)];
+}
+
+// -------------------------------------------------------------------------------
+// ORDER WINDOW: the sliding histogram of one thread, and the outputs of the order statistics
+template <typename T>
+class order_window
+{
+public:
+    order_window (const vector< raster_view<T> > &outputs, const filter_spec &spec, const vector<size_t> &order_stats,
+                  int req_valcount)
+        : lv (NULL), outs (&outputs), f (&spec), which (&order_stats), req (req_valcount),
+          h (0, 2 * (int) order_stats.size()) {}
+
+    // an empty window, over the levels of a new tile
+    void start (const order_levels &levels)
+    {
+        lv = &levels;
+        h.reset ((int) levels.value.size());
+    }
+
+    void add (unsigned int l) { h.add (l); }
+    void remove (unsigned int l) { h.remove (l); }
+
+    // record the values in the output arrays, if we are non-toxic
+    void record (int i, int j)
+    {
+        const int nontoxic_cntr = h.n;
+        if (nontoxic_cntr == 0 || nontoxic_cntr < req)
+        {
+            return;
+        }
+        for (size_t q = 0; q < which->size(); q++)
+        {
+            const size_t s = (*which)[q];
+            (*outs)[s][i][j] = cell_traits<T>::from_double (order_value (h, *lv, *f, s, 2 * (int) q, nontoxic_cntr));
+        }
+    }
+
+private:
+    const order_levels *lv;
+    const vector< raster_view<T> > *outs;
+    const filter_spec *f;
+    const vector<size_t> *which;    // the order statistics, each has two rank pointers (the two
+                                    // middle values of a median)
+    int req;
+    sliding_histogram h;
+};
+
+// -------------------------------------------------------------------------------
+// Calculation module: MEDIAN AND PERCENTILES, outs[s] is the output of statistic f.stats[s] (the
+// other statistics are left to tfil_stats)
+template <typename T>
+void tfil_order (raster_view<T> in, const vector< raster_view<T> > &outs, const filter_mask &m,
+                 const filter_spec &f, int req_valcount, int row_st, int row_end)
+{
+    vector<size_t> which;
+    for (size_t s = 0; s < f.stats.size(); s++)
+    {
+        if (is_order_stat (f.stats[s]))
+        {
+            which.push_back (s);
+        }
+    }
+
+    slide_levels (in, m, row_st, row_end, order_window<T> (outs, f, which, req_valcount));
+}
@@ -0,0 +1,228 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Run report: phase timers, per-thread counters and progress
+
+/*
+A long run can be slow for several reasons: reading the file, the window sums that start
+again at the beginning of each block, the rows the minimum/maximum cache has to calculate
+again, blocks that take much longer than others, or writing. With --report the program keeps
+count of these as it runs and writes them as JSON next to the output (out.asc gives
+out_report.json). The report has:
+
+- the time of each phase (read, prepare, compute, write), from the OpenMP wall clock, which
+  does not go backwards when the system clock is set;
+- the counters of each thread: the output cells of the tiles it took, the tiles it took and
+  stole (see tfil_tiles.hpp), the windows it summed over the whole mask to start a block
+  ("row starts"), the row extremes the minimum/maximum cache calculated again ("rescans"),
+  and the output cells whose windows reach 'nodata' cells or that were skipped because no
+  window there has enough values (from the footprints of the tiles, so only for the modules
+  that look them up: mean, sum, minimum and maximum);
+- the time each thread spent working on its tiles and waiting for the others at the end of
+  each module, which shows how evenly the work was shared.
+
+With --progress (or --progress=SECONDS) a line with the proportion of the tiles done and an
+estimate of the time left is printed every 10 seconds (or SECONDS) while a module runs.
+
+The counters are added once for each tile, or once for each block of rows, never for each
+cell, and each thread has its own on a cache line of its own, so the report costs little.
+Without --report or --progress the tile schedule only tests a flag for each tile.
+*/
+
+// -------------------------------------------------------------------------------
+// REPORT SETTINGS
+bool probe_on = false;                  // true to keep the counters and write the report
+double probe_interval = 0.0;            // seconds between progress lines (0 = no progress lines)
+
+// -------------------------------------------------------------------------------
+// THREAD COUNTERS: what one thread did, on a cache line of its own
+struct probe_thread
+{
+    long long cells;                    // output cells of the tiles taken
+    long long tiles;                    // tiles (or blocks of rows) taken
+    long long steals;                   // tiles taken from another thread's share
+    long long row_starts;               // windows summed over the whole mask to start a block
+    long long rescans;                  // row extremes the minimum/maximum cache calculated again
+    long long nodata_cells;             // output cells whose windows reach 'nodata' cells
+    long long skipped_cells;            // output cells skipped, no window there has enough values
+    double busy;                        // seconds working on tiles
+    double wall;                        // seconds of the modules it ran in
+    char pad[64];
+
+    probe_thread () : cells (0), tiles (0), steals (0), row_starts (0), rescans (0), nodata_cells (0),
+                      skipped_cells (0), busy (0.0), wall (0.0) {}
+};
+
+vector<probe_thread> probe_threads;     // one for each thread
+
+// the counters of the calling thread
+inline probe_thread & probe_slot ()
+{
+    return probe_threads[omp_get_thread_num() % probe_threads.size()];
+}
+
+// adds n to counter 'field' of the calling thread, if the report is on
+inline void probe_count (long long probe_thread::*field, long long n)
+{
+    if (probe_on)
+    {
+        probe_slot().*field += n;
+    }
+}
+
+// -------------------------------------------------------------------------------
+// PHASE TIMERS
+struct probe_phase
+{
+    string name;
+    double seconds;
+};
+
+vector<probe_phase> probe_phases;       // the phases so far, in the order they started
+int probe_current = -1;                 // the current phase (-1 = none)
+double probe_t_start = 0.0;             // when the run started
+double probe_t_phase = 0.0;             // when the current phase started
+
+// starts the report: a set of counters for each thread, and the clock
+void probe_start ()
+{
+    probe_threads.assign (omp_get_max_threads(), probe_thread ());
+    probe_phases.clear ();
+    probe_current = -1;
+    probe_t_start = omp_get_wtime();
+    probe_t_phase = probe_t_start;
+}
+
+// ends the current phase (if there is one) and starts phase 'name' (NULL for none), a phase
+// that comes round again (e.g. the bands of a stream) adds to its time
+void probe_mark (const char *name)
+{
+    const double now = omp_get_wtime();
+    if (probe_current >= 0)
+    {
+        probe_phases[probe_current].seconds += now - probe_t_phase;
+    }
+    probe_current = -1;
+    for (size_t k = 0; name != NULL && k < probe_phases.size(); k++)
+    {
+        if (probe_phases[k].name == name)
+        {
+            probe_current = (int) k;
+        }
+    }
+    if (name != NULL && probe_current < 0)
+    {
+        probe_phase p;
+        p.name = name;
+        p.seconds = 0.0;
+        probe_phases.push_back (p);
+        probe_current = (int) probe_phases.size() - 1;
+    }
+    probe_t_phase = now;
+}
+
+// -------------------------------------------------------------------------------
+// PROGRESS FUNCTION: prints the progress of a module that has done 'done' of its 'total' tiles
+// since 'since', if the last line was printed at least probe_interval seconds ago
+void probe_progress (long long done, long long total, double since, double &last)
+{
+    const double now = omp_get_wtime();
+    if (now - last < probe_interval || done <= 0 || total <= 0)
+    {
+        return;
+    }
+    last = now;
+    const double frac = (double) done / total;
+    const double spent = now - since;
+    char line[160];
+    sprintf (line, "Progress: %5.1f%% of the tiles, %.0f s so far, about %.0f s to go", 100.0 * frac, spent,
+             spent * (1.0 - frac) / frac);
+    cout << line << endl;
+}
+
+// -------------------------------------------------------------------------------
+// REPORT FUNCTIONS
+
+// the name of the report of output file 'out': its extension replaced by '_report.json'
+string probe_file_name (const string &out)
+{
+    const size_t dot = out.find_last_of ('.');
+    const size_t slash = out.find_last_of ("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+    {
+        return out + "_report.json";
+    }
+    return out.substr (0, dot) + "_report.json";
+}
+
+// a string as a JSON string
+string probe_quote (const string &s)
+{
+    string q = "\"";
+    for (size_t k = 0; k < s.size(); k++)
+    {
+        if (s[k] == '"' || s[k] == '\\')
+        {
+            q += '\\';
+        }
+        q += s[k];
+    }
+    return q + "\"";
+}
+
+// writes the report to 'name', with the arguments of the run in 'args' (pairs of a name and a
+// JSON value), returns false if it could not be written
+bool probe_write (const string &name, const vector< pair<string, string> > &args)
+{
+    ofstream f (name.c_str());
+    if (!f)
+    {
+        return false;
+    }
+    f << "{\n";
+    for (size_t k = 0; k < args.size(); k++)
+    {
+        f << "  " << probe_quote (args[k].first) << ": " << args[k].second << ",\n";
+    }
+    f << "  \"threads\": " << probe_threads.size() << ",\n";
+    f << "  \"phases\": [\n";
+    for (size_t k = 0; k < probe_phases.size(); k++)
+    {
+        f << "    {\"name\": " << probe_quote (probe_phases[k].name) << ", \"seconds\": "
+          << probe_phases[k].seconds << "}" << (k + 1 < probe_phases.size() ? "," : "") << "\n";
+    }
+    f << "  ],\n";
+    f << "  \"total_seconds\": " << omp_get_wtime() - probe_t_start << ",\n";
+
+    // Each thread, and the sums and the balance of the work
+    probe_thread sum;
+    double most = 0.0;
+    f << "  \"per_thread\": [\n";
+    for (size_t t = 0; t < probe_threads.size(); t++)
+    {
+        const probe_thread &p = probe_threads[t];
+        f << "    {\"thread\": " << t << ", \"cells\": " << p.cells << ", \"tiles\": " << p.tiles
+          << ", \"steals\": " << p.steals << ", \"row_starts\": " << p.row_starts << ", \"minmax_rescans\": "
+          << p.rescans << ", \"nodata_cells\": " << p.nodata_cells << ", \"skipped_cells\": " << p.skipped_cells
+          << ", \"busy_seconds\": " << p.busy << ", \"idle_seconds\": " << max (0.0, p.wall - p.busy) << "}"
+          << (t + 1 < probe_threads.size() ? "," : "") << "\n";
+        sum.cells += p.cells;
+        sum.tiles += p.tiles;
+        sum.steals += p.steals;
+        sum.row_starts += p.row_starts;
+        sum.rescans += p.rescans;
+        sum.nodata_cells += p.nodata_cells;
+        sum.skipped_cells += p.skipped_cells;
+        sum.busy += p.busy;
+        sum.wall = max (sum.wall, p.wall);
+        most = max (most, p.busy);
+    }
+    f << "  ],\n";
+    const double mean_busy = sum.busy / max ((size_t) 1, probe_threads.size());
+    f << "  \"totals\": {\"cells\": " << sum.cells << ", \"tiles\": " << sum.tiles << ", \"steals\": " << sum.steals
+      << ", \"row_starts\": " << sum.row_starts << ", \"minmax_rescans\": " << sum.rescans
+      << ", \"nodata_cells\": " << sum.nodata_cells << ", \"skipped_cells\": " << sum.skipped_cells
+      << ", \"busy_seconds\": " << sum.busy << ", \"module_seconds\": " << sum.wall << "},\n";
+    f << "  \"imbalance\": " << (mean_busy > 0.0 ? most / mean_busy : 1.0) << ",\n";
+    f << "  \"minmax_cache\": {\"hits\": " << extreme_cache_hits << ", \"misses\": " << extreme_cache_misses << "}\n";
+    f << "}\n";
+    return (bool) f;
+}
@@ -0,0 +1,268 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Rectangular windows
+
+/*
+For a rectangular window the cost of each output cell does not depend on the size of the
+window at all:
+
+Mean and sum use a summed-area table: each entry is the sum of every input value above
+and to the left of it, so the sum over any rectangle is four lookups (bottom right - bottom
+left - top right + top left). A second table counts the values that are not 'nodata' the
+same way, for the nontoxic test and for the mean. Integer cells are summed exactly in
+int64, float cells in double.
+
+Minimum and maximum use the van Herk / Gil-Werman method, one pass along the rows and one
+down the columns. The input is cut into pieces the length of the window, and a running
+minimum is taken forwards and backwards through each piece. Every window covers the end of
+one piece and the start of the next, so its minimum is the smaller of two values: three
+comparisons per cell in each direction, whatever the window size.
+
+The tables are built for one tile of the output at a time (plus a halo of half a window on
+each side), so they stay small, and the sums in them stay small enough to be accurate.
+*/
+
+// -------------------------------------------------------------------------------
+// TILE SIZE FUNCTIONS: tiles are a few windows across, so the halo is not too much extra work
+int rect_block_rows (int half_i, int nrow)
+{
+    return max (1, min (nrow, max (4 * half_i, 64)));
+}
+
+int rect_stripe_cols (int half_j, int ncol)
+{
+    return max (1, min (ncol, max (4 * half_j, 256)));
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: RECTANGULAR MEAN AND SUM (summed-area tables)
+template <typename T>
+void tfil_rect_sum (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                    int row_st, int row_end, bool mean)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;     // table sum type
+    const int half_i = m.edge_guard;
+    const int half_j = m.edge_guard_j;
+
+    // The edges of the grid are left as 'nodata', the same as the circle
+    const int i_lo = max (half_i, row_st);
+    const int i_hi = min (in.nrows - half_i, row_end);
+    const int j_lo = half_j;
+    const int j_hi = in.ncols - half_j;
+    tile_schedule tiles (i_lo, i_hi, j_lo, j_hi, rect_block_rows (half_i, i_hi - i_lo),
+                         rect_stripe_cols (half_j, j_hi - j_lo));
+
+    #pragma omp parallel
+    {
+        vector<accum_type> sat;     // summed-area table of the values
+        vector<unsigned int> cnt;   // summed-area table of the number of values, unsigned so
+                                    // the differences are exact even if the totals wrap
+        int ti_st, ti_end, tj_st, tj_end;
+        while (tiles.next_tile (ti_st, ti_end, tj_st, tj_end))
+        {
+            // The tables cover the input under every window of the tile, with a row and a
+            // column of zeros in front: entry [r][c] is the total of input rows r0 to r0 + r
+            // and columns c0 to c0 + c, not including row r0 + r or column c0 + c
+            const int r0 = ti_st - half_i;
+            const int c0 = tj_st - half_j;
+            const int nr = (ti_end - ti_st) + 2 * half_i;
+            const int nc = (tj_end - tj_st) + 2 * half_j;
+            const size_t tw = (size_t) nc + 1;      // table width
+            sat.resize ((nr + 1) * tw);
+            cnt.resize ((nr + 1) * tw);
+            fill (sat.begin(), sat.begin() + tw, (accum_type) 0);
+            fill (cnt.begin(), cnt.begin() + tw, 0u);
+            for (int r = 0; r < nr; r++)
+            {
+                const T *src = in[r0 + r] + c0;
+                accum_type *s = &sat[(r + 1) * tw];
+                unsigned int *k = &cnt[(r + 1) * tw];
+                const accum_type *s_up = s - tw;
+                const unsigned int *k_up = k - tw;
+                accum_type rowsum = 0;      // running totals along the row
+                unsigned int rowcnt = 0;
+                s[0] = 0;
+                k[0] = 0;
+                for (int c = 0; c < nc; c++)
+                {
+                    rowsum += src[c];       // zero if it is 'nodata'
+                    rowcnt += in.has (r0 + r, c0 + c);
+                    s[c + 1] = s_up[c + 1] + rowsum;
+                    k[c + 1] = k_up[c + 1] + rowcnt;
+                }
+            }
+
+            // Each window is four lookups in each table
+            for (int i = ti_st; i < ti_end; i++)
+            {
+                const size_t top = (size_t) (i - ti_st) * tw;                   // table row of input row i - half_i
+                const size_t bot = (size_t) (i - ti_st + 2 * half_i + 1) * tw;  // and of input row i + half_i + 1
+                T *orow = out[i];
+                for (int j = tj_st; j < tj_end; j++)
+                {
+                    const int a = j - tj_st;                    // table column of input column j - half_j
+                    const int b = a + 2 * half_j + 1;           // and of input column j + half_j + 1
+                    const unsigned int nontoxic_cntr = cnt[bot + b] - cnt[bot + a] - cnt[top + b] + cnt[top + a];
+                    if (nontoxic_cntr == 0 || (int) nontoxic_cntr < req_valcount)
+                    {
+                        continue;           // not enough values: the output stays 'nodata'
+                    }
+                    const accum_type sum = sat[bot + b] - sat[bot + a] - sat[top + b] + sat[top + a];
+                    orow[j] = cell_traits<T>::from_double (mean ? (double) sum / nontoxic_cntr : (double) sum);
+                }
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: RECTANGULAR MINIMUM AND MAXIMUM (van Herk / Gil-Werman)
+template <typename T, typename OP>
+void tfil_rect_extreme (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                        int row_st, int row_end)
+{
+    const int half_i = m.edge_guard;
+    const int half_j = m.edge_guard_j;
+    const int win_i = 2 * half_i + 1;       // window height and width
+    const int win_j = 2 * half_j + 1;
+
+    // The edges of the grid are left as 'nodata', the same as the circle
+    const int i_lo = max (half_i, row_st);
+    const int i_hi = min (in.nrows - half_i, row_end);
+    const int j_lo = half_j;
+    const int j_hi = in.ncols - half_j;
+    tile_schedule tiles (i_lo, i_hi, j_lo, j_hi, rect_block_rows (half_i, i_hi - i_lo),
+                         rect_stripe_cols (half_j, j_hi - j_lo));
+
+    #pragma omp parallel
+    {
+        vector<T> fwd, bwd;         // running extremes forwards and backwards through each piece
+        vector<T> rows;             // extreme across each window width, for every input row
+        vector<T> down;             // running extremes down the pieces of rows
+        vector<int> cnt;            // number of values in the window, summed down the rows
+        int ti_st, ti_end, tj_st, tj_end;
+        while (tiles.next_tile (ti_st, ti_end, tj_st, tj_end))
+        {
+            const int r0 = ti_st - half_i;
+            const int c0 = tj_st - half_j;
+            const int nr = (ti_end - ti_st) + 2 * half_i;       // input rows of the tile
+            const int nc = (tj_end - tj_st) + 2 * half_j;       // input columns of the tile
+            const int tw = tj_end - tj_st;                      // output columns of the tile
+            fwd.resize (nc);
+            bwd.resize (nc);
+            rows.resize ((size_t) nr * tw);
+            down.resize ((size_t) nr * tw);
+            cnt.assign ((size_t) (nr + 1) * tw, 0);
+
+            //=========================================================================================
+            // Along the rows: the extreme and the count across each window width
+            for (int r = 0; r < nr; r++)
+            {
+                const int ri = r0 + r;                  // input row
+                const T *src = in[ri] + c0;
+                for (int c = 0; c < nc; c++)
+                {
+                    const T v = in.has (ri, c0 + c) ? src[c] : OP::none();
+                    fwd[c] = (c % win_j == 0) ? v : OP::pick (fwd[c - 1], v);
+                }
+                for (int c = nc - 1; c >= 0; c--)
+                {
+                    const T v = in.has (ri, c0 + c) ? src[c] : OP::none();
+                    bwd[c] = (c % win_j == win_j - 1 || c == nc - 1) ? v : OP::pick (bwd[c + 1], v);
+                }
+                T *hrow = &rows[(size_t) r * tw];
+                int *krow = &cnt[(size_t) (r + 1) * tw];
+                const int *kup = krow - tw;
+                int run = in.count (ri, c0, c0 + win_j - 1);   // values in the window, slid along the row
+                for (int s = 0; s < tw; s++)
+                {
+                    // window s covers input columns s to s + win_j - 1
+                    run += in.has (ri, c0 + s + win_j - 1);
+                    hrow[s] = OP::pick (bwd[s], fwd[s + win_j - 1]);
+                    krow[s] = kup[s] + run;
+                    run -= in.has (ri, c0 + s);
+                }
+            }
+
+            //=========================================================================================
+            // Down the columns: the same again, a whole row of the tile at a time
+            for (int r = 0; r < nr; r++)
+            {
+                const T *hrow = &rows[(size_t) r * tw];
+                T *drow = &down[(size_t) r * tw];
+                if (r % win_i == 0)
+                {
+                    copy (hrow, hrow + tw, drow);
+                }
+                else
+                {
+                    const T *dup = drow - tw;
+                    for (int s = 0; s < tw; s++)
+                    {
+                        drow[s] = OP::pick (dup[s], hrow[s]);
+                    }
+                }
+            }
+            for (int r = nr - 2; r >= 0; r--)       // backwards, in place
+            {
+                if (r % win_i == win_i - 1)
+                {
+                    continue;
+                }
+                T *hrow = &rows[(size_t) r * tw];
+                const T *hdown = hrow + tw;
+                for (int s = 0; s < tw; s++)
+                {
+                    hrow[s] = OP::pick (hdown[s], hrow[s]);
+                }
+            }
+            for (int i = ti_st; i < ti_end; i++)
+            {
+                // window of output row i covers tile rows r to r + win_i - 1
+                const int r = i - ti_st;
+                const T *bwd_row = &rows[(size_t) r * tw];
+                const T *fwd_row = &down[(size_t) (r + win_i - 1) * tw];
+                const int *k_top = &cnt[(size_t) r * tw];
+                const int *k_bot = &cnt[(size_t) (r + win_i) * tw];
+                T *orow = out[i] + tj_st;
+                for (int s = 0; s < tw; s++)
+                {
+                    const int nontoxic_cntr = k_bot[s] - k_top[s];
+                    if (nontoxic_cntr > 0 && nontoxic_cntr >= req_valcount)
+                    {
+                        orow[s] = OP::pick (bwd_row[s], fwd_row[s]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------
+// RECTANGLE MODULE FUNCTION: runs the rectangular window module for statistic 'stat',
+// returns false if there is no rectangular module for it
+template <typename T>
+bool run_tfil_rect (raster_view<T> in, raster_view<T> out, const filter_mask &m, tfil_stat stat,
+                    int req_valcount, int row_st, int row_end)
+{
+    if (stat == stat_mean)
+    {
+        tfil_rect_sum (in, out, m, req_valcount, row_st, row_end, true);
+    }
+    else if (stat == stat_sum)
+    {
+        tfil_rect_sum (in, out, m, req_valcount, row_st, row_end, false);
+    }
+    else if (stat == stat_min)
+    {
+        tfil_rect_extreme< T, min_op<T> > (in, out, m, req_valcount, row_st, row_end);
+    }
+    else if (stat == stat_max)
+    {
+        tfil_rect_extreme< T, max_op<T> > (in, out, m, req_valcount, row_st, row_end);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,344 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Vectorised sliding sums (AVX2 and AVX-512)
+
+/*
+The running sum of a row has to be slid one column at a time, each step starts from the
+sum of the column before, so the columns of a row cannot be added up side by side without
+changing the order of the additions (and so the last bits of a floating point sum). The
+rows of a block are independent though: the vector lanes are neighbouring output rows at
+the same column, 4 rows with AVX2 or 8 with AVX-512. Each lane takes the same values out
+of and into its own running sum in exactly the same order as the scalar loop, so the
+output is bit for bit the same as the scalar calculation.
+
+The cells of the leading and trailing edges for a group of rows are one row stride apart,
+they are gathered into the lanes (converted to double for float cells, int64 for integer
+cells, the same as the scalar running sums). 'nodata' cells are zero (see raster.hpp), so
+every cell is added and subtracted with no branches that depend on the data, and the counts
+come from the validity bits the same way as the scalar loop (see slide_counts).
+
+The processor is checked when the program runs, the fastest instruction set it has is
+used (or the one asked for with --simd), and everything else falls back to the scalar
+loop.
+*/
+
+// -------------------------------------------------------------------------------
+// LANE FUNCTIONS: the number of rows slid together
+
+// lanes the processor can use: 8 with AVX-512, 4 with AVX2, otherwise 1 (no vectors)
+int simd_best_lanes ()
+{
+#ifdef TFIL_X86_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+    {
+        return 8;
+    }
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        return 4;
+    }
+#endif
+    return 1;
+}
+
+// lanes for the sliding sums: the --simd choice, if the processor has it
+int simd_lanes_used ()
+{
+    const int best = simd_best_lanes ();
+    return (simd_lanes < 0) ? best : min (simd_lanes, best);
+}
+
+const char * simd_name (int lanes)
+{
+    if (lanes == 8) return "AVX-512";
+    if (lanes == 4) return "AVX2";
+    return "off";
+}
+
+// -------------------------------------------------------------------------------
+// Mean and sum operations: what the running sum of a window with n values is recorded as
+struct mean_op
+{
+    template <typename A>
+    static double finish (A sum, int n) { return (double) sum / n; }
+};
+
+struct sum_op
+{
+    template <typename A>
+    static double finish (A sum, int) { return (double) sum; }
+};
+
+// -------------------------------------------------------------------------------
+// OUTPUT FUNCTION: records the sums of 'lanes' rows from row i at column j, the same test
+// and calculation as the scalar loop
+template <typename T, typename OP, typename A>
+inline void simd_record (raster_view<T> out, int i, int j, const A *sum, const int *cnt, int lanes,
+                         int req_valcount)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        const int nontoxic_cntr = cnt[l];
+        if (nontoxic_cntr >= req_valcount)
+        {
+            out[i + l][j] = cell_traits<T>::from_double (OP::finish (sum[l], nontoxic_cntr));
+        }
+    }
+}
+
+#ifdef TFIL_X86_SIMD
+
+// -------------------------------------------------------------------------------
+// AVX2 LANES: running sums in doubles (float and double cells) or int64 (integer cells),
+// 4 rows at a time
+template <typename A>
+struct simd_avx2;
+
+template <>
+struct simd_avx2<double>
+{
+    typedef __m256d vec;
+    __attribute__((target("avx2"))) static vec set (const double *a) { return _mm256_loadu_pd (a); }
+    __attribute__((target("avx2"))) static void get (vec v, double *a) { _mm256_storeu_pd (a, v); }
+    __attribute__((target("avx2"))) static vec take (vec sum, vec v) { return _mm256_sub_pd (sum, v); }
+    __attribute__((target("avx2"))) static vec put (vec sum, vec v) { return _mm256_add_pd (sum, v); }
+
+    // the cells at p, p + stride, p + 2 * stride and p + 3 * stride
+    __attribute__((target("avx2"))) static vec load (const double *p, __m256i idx, ptrdiff_t)
+    {
+        return _mm256_i64gather_pd (p, idx, 8);
+    }
+    __attribute__((target("avx2"))) static vec load (const float *p, __m256i idx, ptrdiff_t)
+    {
+        return _mm256_cvtps_pd (_mm256_i64gather_ps (p, idx, 4));
+    }
+};
+
+template <>
+struct simd_avx2<long long>
+{
+    typedef __m256i vec;
+    __attribute__((target("avx2"))) static vec set (const long long *a) { return _mm256_loadu_si256 ((const __m256i *) a); }
+    __attribute__((target("avx2"))) static void get (vec v, long long *a) { _mm256_storeu_si256 ((__m256i *) a, v); }
+    __attribute__((target("avx2"))) static vec take (vec sum, vec v) { return _mm256_sub_epi64 (sum, v); }
+    __attribute__((target("avx2"))) static vec put (vec sum, vec v) { return _mm256_add_epi64 (sum, v); }
+
+    __attribute__((target("avx2"))) static vec load (const int *p, __m256i idx, ptrdiff_t)
+    {
+        return _mm256_cvtepi32_epi64 (_mm256_i64gather_epi32 (p, idx, 4));
+    }
+    // there is no 16 bit gather, and a 32 bit one could read past the end of the grid
+    __attribute__((target("avx2"))) static vec load (const short *p, __m256i, ptrdiff_t stride)
+    {
+        return _mm256_set_epi64x (p[3 * stride], p[2 * stride], p[stride], p[0]);
+    }
+};
+
+// -------------------------------------------------------------------------------
+// AVX-512 LANES: the same, 8 rows at a time (the masked forms of the gathers and
+// conversions, with every lane on, have no undefined lanes for the compiler to warn about)
+template <typename A>
+struct simd_avx512;
+
+template <>
+struct simd_avx512<double>
+{
+    typedef __m512d vec;
+    __attribute__((target("avx512f"))) static vec set (const double *a) { return _mm512_loadu_pd (a); }
+    __attribute__((target("avx512f"))) static void get (vec v, double *a) { _mm512_storeu_pd (a, v); }
+    __attribute__((target("avx512f"))) static vec take (vec sum, vec v) { return _mm512_sub_pd (sum, v); }
+    __attribute__((target("avx512f"))) static vec put (vec sum, vec v) { return _mm512_add_pd (sum, v); }
+
+    __attribute__((target("avx512f"))) static vec load (const double *p, __m512i idx, ptrdiff_t)
+    {
+        return _mm512_mask_i64gather_pd (_mm512_setzero_pd (), 0xFF, idx, p, 8);
+    }
+    __attribute__((target("avx512f"))) static vec load (const float *p, __m512i idx, ptrdiff_t)
+    {
+        return _mm512_maskz_cvtps_pd (0xFF, _mm512_mask_i64gather_ps (_mm256_setzero_ps (), 0xFF, idx, p, 4));
+    }
+};
+
+template <>
+struct simd_avx512<long long>
+{
+    typedef __m512i vec;
+    __attribute__((target("avx512f"))) static vec set (const long long *a) { return _mm512_loadu_si512 (a); }
+    __attribute__((target("avx512f"))) static void get (vec v, long long *a) { _mm512_storeu_si512 (a, v); }
+    __attribute__((target("avx512f"))) static vec take (vec sum, vec v) { return _mm512_sub_epi64 (sum, v); }
+    __attribute__((target("avx512f"))) static vec put (vec sum, vec v) { return _mm512_add_epi64 (sum, v); }
+
+    __attribute__((target("avx512f"))) static vec load (const int *p, __m512i idx, ptrdiff_t)
+    {
+        return _mm512_maskz_cvtepi32_epi64 (0xFF, _mm512_mask_i64gather_epi32 (_mm256_setzero_si256 (), 0xFF, idx, p, 4));
+    }
+    __attribute__((target("avx512f"))) static vec load (const short *p, __m512i, ptrdiff_t stride)
+    {
+        return _mm512_set_epi64 (p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride],
+                                 p[3 * stride], p[2 * stride], p[stride], p[0]);
+    }
+};
+
+// -------------------------------------------------------------------------------
+// SLIDING FUNCTIONS: slide rows i to i + 3 (or i + 7) from column j_from to j_to, starting
+// from (and leaving) their running sums and counts in 'state', the count changes of lane l
+// are in delta[l * (j_to - j_from)] onwards (see slide_counts), OP is mean_op or sum_op and V
+// the nodata policy (see tfil_mask.hpp)
+template <typename T, typename OP, typename V>
+__attribute__((target("avx2")))
+void simd_slide_avx2 (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                      slide_state<typename cell_traits<T>::accum_type> *state, const int *delta, int i,
+                      int j_from, int j_to)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;
+    typedef simd_avx2<accum_type> S;
+    const int *trailing_i = &m.trailing_i[0];
+    const int *trailing_j = &m.trailing_j[0];
+    const int *leading_i = &m.leading_i[0];
+    const int *leading_j = &m.leading_j[0];
+    const int len_lkups = m.len_lkups;
+
+    accum_type sum[4];
+    int cnt[4];
+    for (int l = 0; l < 4; l++)
+    {
+        sum[l] = state[l].val;
+        cnt[l] = state[l].nontoxic_cntr;
+    }
+    typename S::vec runsum = S::set (sum);
+    const ptrdiff_t stride = in.stride;
+    const __m256i idx = _mm256_set_epi64x (3 * stride, 2 * stride, stride, 0);
+    const int n = j_to - j_from;
+    for (int j = j_from; j < j_to; j++)
+    {
+        for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+        {
+            // 'nodata' cells are zero, so every cell is taken out and put in
+            runsum = S::take (runsum, S::load (in[i + trailing_i[i_tr]] + j + trailing_j[i_tr], idx, stride));
+            runsum = S::put (runsum, S::load (in[i + leading_i[i_tr]] + j + leading_j[i_tr], idx, stride));
+        }
+        S::get (runsum, sum);
+        if (V::counted)
+        {
+            bool empty = false;
+            for (int l = 0; l < 4; l++)
+            {
+                cnt[l] += delta[l * n + j - j_from];
+                if (cnt[l] == 0)
+                {
+                    sum[l] = 0;         // an empty window sums to exactly zero, as in the scalar loop
+                    empty = true;
+                }
+            }
+            if (empty)
+            {
+                runsum = S::set (sum);
+            }
+        }
+        simd_record<T, OP> (out, i, j, sum, cnt, 4, req_valcount);
+    }
+    S::get (runsum, sum);
+    for (int l = 0; l < 4; l++)
+    {
+        state[l].val = sum[l];
+        state[l].nontoxic_cntr = cnt[l];
+    }
+}
+
+template <typename T, typename OP, typename V>
+__attribute__((target("avx512f")))
+void simd_slide_avx512 (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                        slide_state<typename cell_traits<T>::accum_type> *state, const int *delta, int i,
+                        int j_from, int j_to)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;
+    typedef simd_avx512<accum_type> S;
+    const int *trailing_i = &m.trailing_i[0];
+    const int *trailing_j = &m.trailing_j[0];
+    const int *leading_i = &m.leading_i[0];
+    const int *leading_j = &m.leading_j[0];
+    const int len_lkups = m.len_lkups;
+
+    accum_type sum[8];
+    int cnt[8];
+    for (int l = 0; l < 8; l++)
+    {
+        sum[l] = state[l].val;
+        cnt[l] = state[l].nontoxic_cntr;
+    }
+    typename S::vec runsum = S::set (sum);
+    const ptrdiff_t stride = in.stride;
+    const __m512i idx = _mm512_set_epi64 (7 * stride, 6 * stride, 5 * stride, 4 * stride,
+                                          3 * stride, 2 * stride, stride, 0);
+    const int n = j_to - j_from;
+    for (int j = j_from; j < j_to; j++)
+    {
+        for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+        {
+            runsum = S::take (runsum, S::load (in[i + trailing_i[i_tr]] + j + trailing_j[i_tr], idx, stride));
+            runsum = S::put (runsum, S::load (in[i + leading_i[i_tr]] + j + leading_j[i_tr], idx, stride));
+        }
+        S::get (runsum, sum);
+        if (V::counted)
+        {
+            bool empty = false;
+            for (int l = 0; l < 8; l++)
+            {
+                cnt[l] += delta[l * n + j - j_from];
+                if (cnt[l] == 0)
+                {
+                    sum[l] = 0;         // an empty window sums to exactly zero, as in the scalar loop
+                    empty = true;
+                }
+            }
+            if (empty)
+            {
+                runsum = S::set (sum);
+            }
+        }
+        simd_record<T, OP> (out, i, j, sum, cnt, 8, req_valcount);
+    }
+    S::get (runsum, sum);
+    for (int l = 0; l < 8; l++)
+    {
+        state[l].val = sum[l];
+        state[l].nontoxic_cntr = cnt[l];
+    }
+}
+
+#endif
+
+// -------------------------------------------------------------------------------
+// GROUP FUNCTION: the rows of a block that slide in vector groups, the first
+// simd_rows (nrow, lanes) rows, the rest slide one at a time
+int simd_rows (int nrow, int lanes)
+{
+    return (lanes > 1) ? nrow / lanes * lanes : 0;
+}
+
+// slides the nrow rows from row i in groups of 'lanes' (nrow is a multiple of lanes), state[r]
+// is the sliding state of row i + r, 'delta' has room for the count changes of 'lanes' rows
+template <typename T, typename OP, typename V>
+void simd_slide_rows (raster_view<T> in, raster_view<T> out, const filter_mask &m, int req_valcount,
+                      slide_state<typename cell_traits<T>::accum_type> *state, int *delta, int i, int nrow,
+                      int j_from, int j_to, int lanes)
+{
+#ifdef TFIL_X86_SIMD
+    const int n = j_to - j_from;
+    for (int r = 0; r < nrow; r += lanes)
+    {
+        for (int l = 0; l < lanes; l++)
+        {
+            V::changes (in, m, i + r + l, j_from, j_to, delta + l * n);
+        }
+        if (lanes == 8)
+        {
+            simd_slide_avx512<T, OP, V> (in, out, m, req_valcount, state + r, delta, i + r, j_from, j_to);
+        }
+        else
+        {
+            simd_slide_avx2<T, OP, V> (in, out, m, req_valcount, state + r, delta, i + r, j_from, j_to);
+        }
+    }
+#endif
+}
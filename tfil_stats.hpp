@@ -0,0 +1,579 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Several statistics in one pass
+
+/*
+The function code can be several letters, one for each statistic, e.g. 'mdr' for the mean,
+standard deviation and range. The grid is read once and filtered once, and one output is
+written for each statistic, named with the statistic before the extension of the output file
+name (out.asc gives out_mean.asc, out_std.asc and out_range.asc).
+
+One pass over the rows updates every accumulator the statistics need:
+- the running sum (mean, sum, variance, standard deviation)
+- the running sum of squares (variance, standard deviation)
+- the sliding minimum and maximum (minimum, maximum, range)
+- the number of values in the window, which every statistic needs for the nontoxic test
+The median and percentiles need the order of the values instead, they have a pass of their
+own over a sliding histogram (see tfil_order.hpp), and the majority, minority and variety
+of a categorical grid need the frequency of each value (see tfil_class.hpp).
+
+The running sums slide along each row with the trailing and leading lookups and start each
+row from the row above (see tfil_func.hpp), the counts come from the validity bits (see
+slide_counts), and the extremes from the sliding extreme cache (see tfil_extreme.hpp). The
+rows are shared out in whole-row blocks, so the window rows read for the sums are still in
+the cache when the extremes are taken from them.
+
+The squares are summed around a reference value, so the variance of a high, flat area does
+not disappear into the rounding of the squares of the elevations. Only the cells with values
+add their squares. The reference follows the window: every few cells the sum of the squares
+is moved onto the mean of the window (see recentre), so each square is of the distance of a
+value from the mean of a window near its own. The distances from the reference are summed
+as well, and take the sum of the squares the rest of the way to the mean of each window;
+the running sum is not used for that, its rounding grows along the row. Integer cells need
+none of that: their running sum and sum of squares are whole numbers, and the variance is
+worked out from them exactly (see exact_variance), so a variance that is exactly a half
+rounds up like every other rounding of the program. The variance is the population variance
+(divided by the number of values), the same as the ArcGIS focal statistics.
+*/
+
+// -------------------------------------------------------------------------------
+// STATISTICS
+enum tfil_stat
+{
+    stat_mean,                  // m
+    stat_sum,                   // s
+    stat_min,                   // f (floor)
+    stat_max,                   // c (ceiling)
+    stat_var,                   // v
+    stat_std,                   // d (standard deviation)
+    stat_range,                 // r
+    stat_count,                 // n (number of values)
+    stat_median,                // e (median, see tfil_order.hpp)
+    stat_percentile,            // p followed by the percentile, e.g. p90
+    stat_majority,              // o (the most common value, see tfil_class.hpp)
+    stat_minority,              // i (the least common value)
+    stat_variety,               // y (number of different values)
+    stat_kinds
+};
+
+vector<tfil_stat> stats;        // the statistics of the function code, in the order given
+vector<double> percentiles;     // the percentile of each statistic (50 for the median)
+
+// true for the statistics that come from the order of the values (see tfil_order.hpp)
+inline bool is_order_stat (tfil_stat s)
+{
+    return s == stat_median || s == stat_percentile;
+}
+
+// true for the statistics that come from the frequency of each value (see tfil_class.hpp)
+inline bool is_class_stat (tfil_stat s)
+{
+    return s == stat_majority || s == stat_minority || s == stat_variety;
+}
+
+// name of statistic s, with its percentile 'pct'
+string stat_name (tfil_stat s, double pct)
+{
+    static const char *names[stat_kinds] =
+    {
+        "mean", "sum", "minimum", "maximum", "variance", "standard deviation", "range", "count",
+        "median", "percentile", "majority", "minority", "variety"
+    };
+    ostringstream name;
+    name << names[s];
+    if (s == stat_percentile)
+    {
+        name << " " << pct;
+    }
+    return name.str();
+}
+
+// short name of statistic s, with its percentile 'pct', for the output file names
+string stat_tag (tfil_stat s, double pct)
+{
+    static const char *tags[stat_kinds] =
+    {
+        "mean", "sum", "min", "max", "var", "std", "range", "count", "median", "p", "majority",
+        "minority", "variety"
+    };
+    ostringstream tag;
+    tag << tags[s];
+    if (s == stat_percentile)
+    {
+        tag << pct;
+    }
+    return tag.str();
+}
+
+// parse a function code, one letter for each statistic (any case) and a percentile after each
+// 'p', into 'list' and 'pcts' without repeats, returns false if the code is not recognized
+bool parse_stats (const string &code, vector<tfil_stat> &list, vector<double> &pcts)
+{
+    static const char letters[] = "msfcvdrnepoiy";  // in the order of tfil_stat
+    list.clear ();
+    pcts.clear ();
+    const char *p = code.c_str();
+    while (*p != '\0')
+    {
+        const char *at = strchr (letters, tolower ((unsigned char) *p));
+        if (at == NULL || *at == '\0')
+        {
+            list.clear ();
+            return false;
+        }
+        const tfil_stat s = (tfil_stat) (at - letters);
+        p++;
+        double pct = (s == stat_median) ? 50.0 : 0.0;
+        if (s == stat_percentile)
+        {
+            char *stop = NULL;
+            pct = strtod (p, &stop);
+            if (stop == p || pct < 0.0 || pct > 100.0)
+            {
+                list.clear ();
+                return false;
+            }
+            p = stop;
+        }
+        bool repeat = false;
+        for (size_t k = 0; k < list.size(); k++)
+        {
+            repeat = repeat || (list[k] == s && pcts[k] == pct);
+        }
+        if (!repeat)
+        {
+            list.push_back (s);
+            pcts.push_back (pct);
+        }
+    }
+    return !list.empty();
+}
+
+// -------------------------------------------------------------------------------
+// FILTER SPECIFICATION: everything about one filter that the calculation modules need, they
+// read nothing else, so several filters can run at once (see tfil_engine.hpp)
+struct filter_spec
+{
+    vector<tfil_stat> stats;        // the statistics, in the order of the outputs
+    vector<double> percentiles;     // the percentile of each statistic (50 for the median)
+    double nontoxic_frac;           // fraction of the window required to have values
+    bool edge_partial;              // true for partial windows at the edges (see tfil_border.hpp)
+    window_shape window;            // shape of the window
+    int window_rows;                // rows and columns of a rectangular window
+    int window_cols;
+    bool extreme_deque;             // true for the monotonic deque minimum/maximum engine
+
+    filter_spec ()
+        : nontoxic_frac (1.0), edge_partial (false), window (window_circle), window_rows (0),
+          window_cols (0), extreme_deque (false) {}
+};
+
+// the filter given on the command line
+filter_spec command_line_spec ()
+{
+    filter_spec f;
+    f.stats = stats;
+    f.percentiles = percentiles;
+    f.nontoxic_frac = nontoxic_frac;
+    f.edge_partial = edge_partial;
+    f.window = window;
+    f.window_rows = window_rows;
+    f.window_cols = window_cols;
+    f.extreme_deque = extreme_deque;
+    return f;
+}
+
+const int stats_recentre_cols = 16;     // columns between the moves of the reference
+
+// moves the sum of squares 'sq' of n values around 'ref', whose distances from it sum to 'dist',
+// to around their mean, which is the new 'ref'; 'dist' keeps what the rounding of 'ref' leaves
+// over, or the reference would drift away from the mean cell after cell
+inline void recentre (double &dist, int n, double &sq, double &ref)
+{
+    if (n == 0)
+    {
+        sq = 0.0;
+        dist = 0.0;
+        return;
+    }
+    const double moved = (ref + dist / n) - ref;
+    sq = max (0.0, sq - dist * dist / n);
+    ref += moved;
+    dist -= n * moved;
+}
+
+// -------------------------------------------------------------------------------
+// INTEGER VARIANCE: the population variance of n whole numbers, from their sum and the sum of
+// their squares (modulo 2^64, the sum of the squares of their distances from the mean has to
+// fit, the squares themselves need not), as a whole part and a fraction frac / nn, |frac| < nn
+struct int_variance
+{
+    unsigned long long whole;
+    long long frac;
+    long long nn;               // n * n
+
+    double value () const { return (double) whole + (double) frac / (double) nn; }
+
+    // rounded to the nearest whole number, halves up, the same as round_to_cell but without
+    // the rounding of the fraction to a double
+    double rounded () const { return (double) whole + (2 * frac >= nn) - (2 * frac < -nn); }
+};
+
+inline int_variance exact_variance (long long sum, unsigned long long sq, long long n)
+{
+    // q is the mean rounded down, and sum = q * n + rem, so the squares of the distances from
+    // q sum to a = sq - q * (sum + rem), and the variance is a / n - rem^2 / n^2
+    long long q = sum / n;
+    long long rem = sum % n;
+    if (rem < 0)
+    {
+        q--;
+        rem += n;
+    }
+    const unsigned long long a = sq - (unsigned long long) q * (unsigned long long) (sum + rem);
+    int_variance v;
+    v.whole = a / (unsigned long long) n;
+    v.frac = (long long) (a % (unsigned long long) n) * n - rem * rem;
+    v.nn = n * n;
+    return v;
+}
+
+// the square of integer cell v, for the sums of squares of exact_variance
+template <typename T>
+inline unsigned long long int_square (T v)
+{
+    return (unsigned long long) ((long long) v * (long long) v);
+}
+
+// -------------------------------------------------------------------------------
+// Calculation module: SEVERAL STATISTICS, outs[s] is the output of statistic stats[s] (the
+// median and percentiles are left to tfil_order)
+template <typename T>
+void tfil_stats (raster_view<T> in, const vector< raster_view<T> > &outs, const filter_mask &m,
+                 const filter_spec &f, int req_valcount, int row_st, int row_end)
+{
+    typedef typename cell_traits<T>::accum_type accum_type;     // running sum type
+    const vector<tfil_stat> &stats = f.stats;
+
+    // The accumulators the statistics need
+    bool want[stat_kinds] = { false };
+    for (size_t s = 0; s < stats.size(); s++)
+    {
+        want[stats[s]] = true;
+    }
+    const bool need_sq = want[stat_var] || want[stat_std];
+    const bool int_sq = need_sq && numeric_limits<T>::is_integer;      // exact squares (see exact_variance)
+    const bool float_sq = need_sq && !int_sq;                           // squares around a reference
+    const bool need_sum = need_sq || want[stat_mean] || want[stat_sum];
+    const bool need_min = want[stat_min] || want[stat_range];
+    const bool need_max = want[stat_max] || want[stat_range];
+
+    // Pre-calculate start and finish coords for input array, the edges are left as 'nodata'
+    const int i_st = m.edge_guard;
+    const int i_end = in.nrows - m.edge_guard;
+    const int j_st = m.edge_guard_j;
+    const int j_end = in.ncols - m.edge_guard_j;
+    const int i_lo = max (i_st, row_st);
+    const int i_hi = min (i_end, row_end);
+    const int width = max (0, j_end - j_st);
+
+    // The lookups for the edges of each row and column of the mask
+    const int *trailing_i = &m.trailing_i[0];
+    const int *trailing_j = &m.trailing_j[0];
+    const int *leading_i = &m.leading_i[0];
+    const int *leading_j = &m.leading_j[0];
+    const int len_lkups = m.len_lkups;
+    const int *top_i = &m.top_i[0];
+    const int *top_j = &m.top_j[0];
+    const int *bottom_i = &m.bottom_i[0];
+    const int *bottom_j = &m.bottom_j[0];
+    const int len_vlkups = m.len_vlkups;
+
+    // Row segments of the mask for the extremes (see tfil_extreme_cached)
+    vector<int> seg_lo (len_lkups);
+    for (int k = 0; k < len_lkups; k++)
+    {
+        seg_lo[k] = trailing_j[k] + 1;
+    }
+    const int nslots = extreme_cache_slots (m, in.nrows, in.ncols, sizeof (T));
+    const bool deque = (need_min || need_max) && (f.extreme_deque || !extreme_cache_pays (m, nslots, i_hi - i_lo));
+
+    // Share out blocks of whole rows, in whole slide anchors (see tfil_tiles.hpp)
+    tile_schedule tiles (i_lo, i_hi, j_st, j_end, slide_chunk (i_hi - i_lo), max (1, width));
+    long long hits = 0, misses = 0;
+
+    #pragma omp parallel reduction (+:hits, misses)
+    {
+        extreme_cache< T, min_op<T> > min_cache (in, need_min && !deque ? nslots : 1);
+        extreme_cache< T, max_op<T> > max_cache (in, need_max && !deque ? nslots : 1);
+        vector<T> dq_val (deque ? in.ncols : 0);        // the deques (see deque_row_extremes)
+        vector<int> dq_j (deque ? in.ncols : 0);
+        vector<int> dq_cnt (deque ? width : 0);         // their counts, not used here
+        vector<accum_type> sum (width);     // running sum at each column of the row
+        vector<double> sq (width);          // running sum of squares around the reference
+        vector<double> dist (width);        // sum of the distances of the values from it
+        vector<unsigned long long> isq (width);     // sum of squares of integer cells
+        vector<int> count (width);          // number of values in the window
+        vector<int> delta (width);          // count changes (see slide_counts)
+        vector<T> lo (width), hi (width);   // minimum and maximum
+        int blk_st, blk_end, str_st, str_end;
+        while (tiles.next_tile (blk_st, blk_end, str_st, str_end))
+        {
+            accum_type above_sum = 0;       // window at the start of the row above
+            double above_sq = 0.0;
+            double above_dist = 0.0;
+            double above_ref = 0.0;
+            unsigned long long above_isq = 0;
+            int above_cnt = 0;
+            for (int i = blk_st; i < blk_end; i++)
+            {
+                //=========================================================================================
+                // START NEW ROW CALC SEQUENCE HERE: the anchor rows of the block thumb over the
+                // whole filter mask (see slide_anchor), each row after one slides the window of
+                // the row above down
+                int j = j_st;
+                accum_type runsum = 0;
+                double runsq = 0.0;
+                double rundist = 0.0;       // sum of the distances of the values from the reference
+                double ref = 0.0;           // reference value for the squares
+                unsigned long long runisq = 0;      // sum of squares of integer cells
+                int nontoxic_cntr = 0;
+                if (slide_anchor (i, blk_st))
+                {
+                    probe_count (&probe_thread::row_starts, 1);
+                    for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                    {
+                        const int i_in = i + leading_i[i_tr];
+                        const T *row = in[i_in];
+                        const int j_lo = j + trailing_j[i_tr] + 1;
+                        const int j_hi = j + leading_j[i_tr] + 1;
+                        if (need_sum)
+                        {
+                            for (int j_in = j_lo; j_in < j_hi; j_in++)
+                            {
+                                runsum = runsum + row[j_in];
+                            }
+                        }
+                        if (int_sq)
+                        {
+                            for (int j_in = j_lo; j_in < j_hi; j_in++)
+                            {
+                                runisq += int_square (row[j_in]);       // 'nodata' cells are zero
+                            }
+                        }
+                        nontoxic_cntr += in.count (i_in, j_lo, j_hi);
+                    }
+                    ref = (nontoxic_cntr > 0) ? (double) runsum / nontoxic_cntr : 0.0;
+                    if (float_sq)
+                    {
+                        for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                        {
+                            const T *row = in[i + leading_i[i_tr]];
+                            for (int j_in = j + trailing_j[i_tr] + 1; j_in < j + leading_j[i_tr] + 1; j_in++)
+                            {
+                                const double d = in.has (i + leading_i[i_tr], j_in) ? (double) row[j_in] - ref : 0.0;
+                                rundist += d;
+                                runsq += d * d;
+                            }
+                        }
+                    }
+                }
+                else
+                {
+                    runsum = above_sum;
+                    runsq = above_sq;
+                    rundist = above_dist;
+                    ref = above_ref;
+                    runisq = above_isq;
+                    nontoxic_cntr = above_cnt;
+                    bool empty = (nontoxic_cntr == 0);     // the first value is the reference
+                    for (int i_tr = 0; i_tr < len_vlkups; i_tr++)
+                    {
+                        const int i_sub = i + top_i[i_tr];
+                        const int j_sub = j + top_j[i_tr];
+                        const int i_add = i + bottom_i[i_tr];
+                        const int j_add = j + bottom_j[i_tr];
+                        const T sub_val = in[i_sub][j_sub];
+                        const T add_val = in[i_add][j_add];
+                        runsum = runsum - sub_val;
+                        runsum = runsum + add_val;
+                        const bool has_sub = in.has (i_sub, j_sub);
+                        const bool has_add = in.has (i_add, j_add);
+                        if (int_sq)
+                        {
+                            runisq += int_square (add_val) - int_square (sub_val);
+                        }
+                        if (float_sq)
+                        {
+                            if (empty && has_add)
+                            {
+                                ref = (double) add_val;
+                                runsq = 0.0;
+                                rundist = 0.0;
+                                empty = false;
+                            }
+                            const double ds = has_sub ? (double) sub_val - ref : 0.0;
+                            const double da = has_add ? (double) add_val - ref : 0.0;
+                            rundist += da - ds;
+                            runsq += da * da - ds * ds;
+                        }
+                        nontoxic_cntr += (int) has_add - (int) has_sub;
+                    }
+                }
+                if (float_sq)
+                {
+                    recentre (rundist, nontoxic_cntr, runsq, ref);
+                }
+                above_sum = runsum;
+                above_sq = runsq;
+                above_dist = rundist;
+                above_ref = ref;
+                above_isq = runisq;
+                above_cnt = nontoxic_cntr;
+                sum[0] = runsum;
+                sq[0] = runsq;
+                dist[0] = rundist;
+                isq[0] = runisq;
+                count[0] = nontoxic_cntr;
+                // END NEW ROW CALC SEQUENCE HERE
+
+                //=========================================================================================
+                // ROW LOOP: slide the sums and the count to the right, across the whole row
+                slide_counts (in, m, i, j_st + 1, j_end, &delta[0]);
+                for (j = j_st + 1; j < j_end; j++)
+                {
+                    // the cells of a window full before and after the step all have values
+                    const int n_next = nontoxic_cntr + delta[j - j_st - 1];
+                    const bool gate = (nontoxic_cntr < m.mask_sum || n_next < m.mask_sum);
+                    bool empty = (nontoxic_cntr == 0);
+                    if (need_sum)
+                    {
+                        for (int i_tr = 0; i_tr < len_lkups; i_tr++)
+                        {
+                            const T sub_val = in [ (i + trailing_i[i_tr]) ][ (j + trailing_j[i_tr]) ];
+                            const T add_val = in [ (i + leading_i[i_tr]) ][ (j + leading_j[i_tr]) ];
+                            runsum = runsum - sub_val;
+                            runsum = runsum + add_val;
+                            if (int_sq)
+                            {
+                                runisq += int_square (add_val) - int_square (sub_val);
+                            }
+                            else if (need_sq && !gate)
+                            {
+                                const double ds = (double) sub_val - ref;
+                                const double da = (double) add_val - ref;
+                                rundist += da - ds;
+                                runsq += da * da - ds * ds;
+                            }
+                            else if (need_sq)
+                            {
+                                const double ds = in.has (i + trailing_i[i_tr], j + trailing_j[i_tr])
+                                                  ? (double) sub_val - ref : 0.0;
+                                const bool has_add = in.has (i + leading_i[i_tr], j + leading_j[i_tr]);
+                                if (empty && has_add)
+                                {
+                                    ref = (double) add_val;
+                                    runsq = 0.0;
+                                    rundist = 0.0;
+                                    empty = false;
+                                }
+                                const double da = has_add ? (double) add_val - ref : 0.0;
+                                rundist += da - ds;
+                                runsq += da * da - ds * ds;
+                            }
+                        }
+                    }
+                    nontoxic_cntr = n_next;
+                    if (float_sq && (j - j_st) % stats_recentre_cols == 0)
+                    {
+                        recentre (rundist, nontoxic_cntr, runsq, ref);
+                    }
+                    sum[j - j_st] = runsum;
+                    sq[j - j_st] = runsq;
+                    dist[j - j_st] = rundist;
+                    isq[j - j_st] = runisq;
+                    count[j - j_st] = nontoxic_cntr;
+                }
+
+                // The extremes of the same row, one cached value per row of the mask, or one
+                // deque per row of the mask where the cache would not pay
+                if (need_min && !deque)
+                {
+                    cached_row_extremes (min_cache, m, &seg_lo[0], i, j_st, j_end, &lo[0] - j_st);
+                }
+                if (need_max && !deque)
+                {
+                    cached_row_extremes (max_cache, m, &seg_lo[0], i, j_st, j_end, &hi[0] - j_st);
+                }
+                if (deque)
+                {
+                    fill (dq_cnt.begin(), dq_cnt.end(), 0);
+                }
+                if (need_min && deque)
+                {
+                    fill (lo.begin(), lo.end(), min_op<T>::none());
+                    deque_row_extremes< T, min_op<T>, valid_bits > (in, i, len_lkups, leading_i, &seg_lo[0], leading_j,
+                                                                    j_st, j_end, &lo[0] - j_st, &dq_cnt[0] - j_st,
+                                                                    &dq_val[0], &dq_j[0]);
+                }
+                if (need_max && deque)
+                {
+                    fill (hi.begin(), hi.end(), max_op<T>::none());
+                    deque_row_extremes< T, max_op<T>, valid_bits > (in, i, len_lkups, leading_i, &seg_lo[0], leading_j,
+                                                                    j_st, j_end, &hi[0] - j_st, &dq_cnt[0] - j_st,
+                                                                    &dq_val[0], &dq_j[0]);
+                }
+
+                //=========================================================================================
+                // Now, record the values in the output arrays, if we are non-toxic
+                for (int c = 0; c < width; c++)
+                {
+                    const int n = count[c];
+                    if (n == 0 || n < req_valcount)
+                    {
+                        continue;           // not enough values: the outputs stay 'nodata'
+                    }
+                    double var = 0.0;       // one value has none, whatever the rounding of its square
+                    double var_cell = 0.0;  // and as it is stored, integer cells rounded exactly
+                    if (int_sq)
+                    {
+                        const int_variance exact = exact_variance ((long long) sum[c], isq[c], n);
+                        var = exact.value ();
+                        var_cell = exact.rounded ();
+                    }
+                    else if (need_sq && n > 1)
+                    {
+                        var = max (0.0, (sq[c] - dist[c] * dist[c] / n) / n);
+                        var_cell = var;
+                    }
+                    for (size_t s = 0; s < stats.size(); s++)
+                    {
+                        if (is_order_stat (stats[s]) || is_class_stat (stats[s]))
+                        {
+                            continue;       // calculated by tfil_order and tfil_class
+                        }
+                        double v;
+                        switch (stats[s])
+                        {
+                            case stat_mean: v = (double) sum[c] / n; break;
+                            case stat_sum: v = (double) sum[c]; break;
+                            case stat_min: v = (double) lo[c]; break;
+                            case stat_max: v = (double) hi[c]; break;
+                            case stat_var: v = var_cell; break;
+                            case stat_std: v = sqrt (var); break;
+                            case stat_range: v = (double) hi[c] - (double) lo[c]; break;
+                            default: v = (double) n; break;
+                        }
+                        outs[s][i][j_st + c] = cell_traits<T>::from_double (v);
+                    }
+                }
+            }
+        }
+        hits += min_cache.hits + max_cache.hits;
+        misses += min_cache.misses + max_cache.misses;
+        probe_count (&probe_thread::rescans, misses);       // this thread's share of the reduction
+    }
+    #pragma omp atomic
+    extreme_cache_hits += hits;
+    #pragma omp atomic
+    extreme_cache_misses += misses;
+}
@@ -0,0 +1,202 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Streaming (out-of-core) filtering
+
+/*
+In streaming mode the whole raster is never held in memory. The sliding window for output
+row i only touches input rows i - edge_guard to i + edge_guard, so the input is read as a
+rolling band: the 2 * edge_guard + 1 rows of the window plus a prefetch margin. Each time
+the band is topped up, the output rows whose windows are complete are calculated and
+written, then the oldest rows are evicted. Memory use is bounded by the radius and the
+number of columns, and does not depend on the number of rows. With a batch of radii (see
+tfil_batch.hpp) the band is sized for the largest circle, and each radius (and statistic) has
+its own output band and output file.
+
+The margin is the number of new output rows calculated each time the band is topped up,
+bigger margins share the work better between processors, but use more memory. By default
+it is the larger of the window height and 16 rows per processor.
+
+The bands start the running sums at other rows than the blocks of a whole grid in memory do
+(see tfil_tiles.hpp), so the mean, sum, variance and standard deviation of a floating point
+grid can differ in the last digit, the other statistics are the same.
+*/
+
+// -------------------------------------------------------------------------------
+// STREAMING RUN FUNCTION: reads, filters and writes the grid one band of rows at a time
+void run_tfil_stream ()
+{
+    cout << "-------------------------------------------------------------" << endl;
+    cout << "Beginning streaming filter . . ." << endl;
+    double t_start = omp_get_wtime();
+
+    //=========================================================================================
+    // Open the input file and read the header
+    ascii_row_reader ascii_in;
+    flt_row_reader flt_in;
+    double in_megabytes = 0.0;
+    if (in_binary)
+    {
+        flt_in.open (infile.str());
+        in_megabytes = flt_in.megabytes;
+    }
+    else
+    {
+        ascii_in.open (infile.str().c_str());
+        in_megabytes = ascii_in.megabytes;
+    }
+    cout << "Number of rows: " << nrows << endl;
+    cout << "Number of columns: " << ncols << endl;
+    cout << "XLL corner: " << xllcorner << endl;
+    cout << "YLL corner: " << yllcorner << endl;
+    cout << "Cellsize: " << cellsize << endl;
+    cout << "NODATA_value: " << nodataflag << endl;
+    cout << "Cell type: " << cell_type_name (celltype) << endl;
+
+    //=========================================================================================
+    // Create the filter masks (one for each radius of a batch) and size the band from the largest
+    radius_batch b (radii);
+    setup_tfil_batch (b);
+    const int nout = (int) batch_outputs ();
+    const int edge_guard = b.masks[radii.size() - 1].edge_guard;
+    const int margin = (stream_margin > 0) ? stream_margin
+                                           : max (2 * edge_guard + 1, 16 * omp_get_max_threads());
+    const int band_rows = min (nrows, 2 * edge_guard + 1 + margin);
+    raster_buffer band;             // input rows b0 to b0 + nb
+    vector<raster_buffer> obands (nout);    // output rows, numbered the same way as the input rows,
+                                            // for each radius and statistic
+    band.allocate (celltype, band_rows, ncols);
+    band.valid.allocate (band_rows, ncols);
+    for (int k = 0; k < nout; k++)
+    {
+        obands[k].allocate (celltype, band_rows, ncols);
+    }
+    cout << "Band of " << band_rows << " rows, "
+         << (1.0 + nout) * band_rows * band.stride * cell_type_size (celltype) / (1024.0 * 1024.0)
+         << " MB for the input and output bands" << endl;
+
+    //=========================================================================================
+    // Open the output files (one for each radius and statistic of a batch) and write the headers
+    vector<ascii_grid_writer> ascii_out (nout);
+    vector<flt_row_writer> flt_out (nout);
+    string header;
+    for (int k = 0; k < nout; k++)
+    {
+        const string name = batch_file_name (k / (nout / radii.size()), k % (nout / radii.size()));
+        bool opened = out_binary ? flt_out[k].open (name) : ascii_out[k].open (name.c_str(), precision);
+        if (!opened)
+        {
+            cout << "ERROR: cannot open output file!" << endl;
+            exit (10);
+        }
+        if (out_binary)
+        {
+            header = write_EsriFlt_header (binary_grid_file (name, ".hdr"));
+        }
+        else
+        {
+            header = arc_ascii_header ();
+            ascii_out[k].write_text (header);
+        }
+    }
+
+    //=========================================================================================
+    // Roll the band down the grid
+    cout << "Beginning calculations with function code: " << funcode.str().c_str() << endl;
+    const char *module = tfil_module_name ();
+    if (module != NULL)
+    {
+        cout << "EXECUTING: " << module << " . . ." << endl;
+    }
+    else
+    {
+        cout << "ERROR: I couldn't recognize your function code??" << endl;
+    }
+    double t_read = 0.0, t_calc = 0.0, t_write = 0.0;
+    int b0 = 0;             // first row in the band
+    int nb = 0;             // number of rows in the band
+    int o = 0;              // next output row
+    while (o < nrows)
+    {
+        // Top up the band
+        probe_mark ("read");
+        double t0 = omp_get_wtime();
+        int want = min (band_rows - nb, nrows - (b0 + nb));
+        if (in_binary)
+        {
+            flt_in.read_rows (band, nb, want);
+        }
+        else
+        {
+            ascii_in.read_rows (band, nb, want);
+        }
+        nb += want;
+
+        // The output rows with complete windows, at the bottom of the grid the rest of the rows
+        // are all edge rows, which are 'nodata'
+        probe_mark ("compute");
+        double t1 = omp_get_wtime();
+        int o_end = (b0 + nb == nrows) ? nrows : b0 + nb - edge_guard;
+        for (int k = 0; k < nout; k++)
+        {
+            obands[k].fill_rows (o - b0, o_end - b0, nodataflag);
+        }
+        if (module != NULL)
+        {
+            run_tfil_batch_rows (band, obands, b, o - b0, o_end - b0, nb);
+        }
+
+        // Write the rows out
+        probe_mark ("write");
+        double t2 = omp_get_wtime();
+        for (int k = 0; k < nout; k++)
+        {
+            if (out_binary)
+            {
+                flt_out[k].write_rows (obands[k], o - b0, o_end - b0);
+            }
+            else
+            {
+                ascii_out[k].write_rows (obands[k], o - b0, o_end - b0);
+            }
+        }
+        o = o_end;
+
+        // Evict the rows that no later window needs
+        int drop = (o - edge_guard) - b0;
+        if (drop > 0)
+        {
+            band.move_rows (drop, 0, nb - drop);
+            b0 += drop;
+            nb -= drop;
+        }
+        double t3 = omp_get_wtime();
+        t_read += t1 - t0;
+        t_calc += t2 - t1;
+        t_write += t3 - t2;
+    }
+    cout << "Ending calculations with function code: " << funcode.str().c_str() << endl;
+
+    double out_megabytes = 0.0;
+    for (int k = 0; k < nout; k++)
+    {
+        out_megabytes += (out_binary ? flt_out[k].bytes : ascii_out[k].bytes) / (1024.0 * 1024.0);
+        bool closed = out_binary ? flt_out[k].close () : ascii_out[k].close ();
+        if (!closed)
+        {
+            cout << "ERROR: problem writing the output file!" << endl;
+            exit (10);
+        }
+    }
+
+    // Print the operation to the console
+    double t_total = omp_get_wtime() - t_start;
+    time_t nowTime;
+    struct tm * timeString;
+    time (&nowTime);
+    timeString = localtime (&nowTime);
+
+    cout << "Header values:\n" << header.c_str();
+    cout << "Read " << in_megabytes << " MB in " << t_read << " s, calculated in " << t_calc
+         << " s, wrote " << out_megabytes << " MB in " << t_write << " s (total " << t_total << " s)" << endl;
+    cout << "FILE output to hard disk successfully, Time: " << asctime(timeString) << endl;
+    cout << "-------------------------------------------------------------" << endl;
+}
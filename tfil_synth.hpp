@@ -0,0 +1,198 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Synthetic terrain for the benchmarks
+
+/*
+The benchmarks (bench.cpp) need grids of any size that look like terrain, and the same grid
+every time for the same seed, on any computer and with any number of processors. The terrain
+is fractal (value) noise: random heights on a coarse lattice, smoothly interpolated, plus
+octaves at twice the frequency and half the height of the one before, down to the size of a
+cell. That gives the hills, valleys and rough slopes of a real DEM, with the most relief in
+the longest wavelengths. The random heights come from a hash of the seed, the octave and the
+lattice point rather than a random number generator, so each cell is calculated on its own,
+in parallel, and the grid does not depend on the order or the number of threads.
+
+The 'nodata' cells are blobs, like the sea, lakes or the gaps of a survey, not single cells
+scattered over the grid: a second, smoother noise field is cut at the level that leaves the
+requested proportion of the cells below it. The level comes from a histogram of the whole
+field, so the proportion is within a small fraction of a percent of the one requested.
+*/
+
+const int synth_levels = 4096;          // histogram bins of the 'nodata' field
+
+// -------------------------------------------------------------------------------
+// NOISE FUNCTIONS
+
+// random number from 0 to 1 for lattice point (i, j) of octave o
+inline double synth_hash (unsigned int seed, int o, int i, int j)
+{
+    unsigned long long h = (unsigned long long) seed * 0x9E3779B97F4A7C15ULL
+                           + (unsigned long long) (unsigned int) o * 0xD1B54A32D192ED03ULL
+                           + (unsigned long long) (unsigned int) i * 0xAEF17502108EF2D9ULL
+                           + (unsigned long long) (unsigned int) j;
+    h ^= h >> 30;               // splitmix64 finaliser
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return (double) (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// noise of octave o at (y, x) in lattice units: the random heights of the four lattice points
+// around it, blended with a smooth step so the slopes are continuous
+inline double synth_value (unsigned int seed, int o, double y, double x)
+{
+    const double fy = floor (y);
+    const double fx = floor (x);
+    const int i = (int) fy;
+    const int j = (int) fx;
+    const double ty = y - fy;
+    const double tx = x - fx;
+    const double sy = ty * ty * (3.0 - 2.0 * ty);
+    const double sx = tx * tx * (3.0 - 2.0 * tx);
+    const double top = synth_hash (seed, o, i, j) + sx * (synth_hash (seed, o, i, j + 1) - synth_hash (seed, o, i, j));
+    const double bot = synth_hash (seed, o, i + 1, j)
+                       + sx * (synth_hash (seed, o, i + 1, j + 1) - synth_hash (seed, o, i + 1, j));
+    return top + sy * (bot - top);
+}
+
+// fractal noise from 0 to 1 at cell (i, j): 'octaves' octaves, the first with lattice points
+// 'wavelength' cells apart, each one after at half the wavelength and half the height
+inline double synth_fractal (unsigned int seed, int i, int j, double wavelength, int octaves)
+{
+    double sum = 0.0, height = 1.0, total = 0.0;
+    for (int o = 0; o < octaves; o++)
+    {
+        sum += height * synth_value (seed, o, i / wavelength, j / wavelength);
+        total += height;
+        height *= 0.5;
+        wavelength *= 0.5;
+    }
+    return sum / total;
+}
+
+// -------------------------------------------------------------------------------
+// SYNTHETIC TERRAIN: the elevation and 'nodata' fields of a grid
+class synth_terrain
+{
+public:
+    // terrain for 'seed' on a grid of nr rows and nc columns, with the proportion 'missing' of
+    // the cells 'nodata'
+    synth_terrain (unsigned int seed, int nr, int nc, double missing)
+        : elev_seed (seed), hole_seed (seed ^ 0x5BD1E995u), level (-1.0)
+    {
+        // The longest hills are a quarter of the grid across, the octaves go down to one cell
+        elev_wavelength = max (8.0, max (nr, nc) / 4.0);
+        elev_octaves = 1;
+        while (elev_wavelength / (1 << elev_octaves) >= 1.0 && elev_octaves < 24)
+        {
+            elev_octaves++;
+        }
+        hole_wavelength = max (8.0, max (nr, nc) / 3.0);
+        if (missing >= 1.0)
+        {
+            level = 2.0;
+        }
+        else if (missing > 0.0)
+        {
+            find_level (nr, nc, missing);
+        }
+    }
+
+    // elevation of cell (i, j) in metres, from 200 to 1200
+    double elevation (int i, int j) const
+    {
+        return 200.0 + 1000.0 * synth_fractal (elev_seed, i, j, elev_wavelength, elev_octaves);
+    }
+
+    // true if cell (i, j) has no value
+    bool hole (int i, int j) const
+    {
+        return level >= 0.0 && hole_field (i, j) < level;
+    }
+
+private:
+    unsigned int elev_seed;
+    unsigned int hole_seed;
+    double elev_wavelength;
+    int elev_octaves;
+    double hole_wavelength;
+    double level;                   // the cells of the 'nodata' field below this have no value
+
+    double hole_field (int i, int j) const
+    {
+        return synth_fractal (hole_seed, i, j, hole_wavelength, 4);
+    }
+
+    // the level of the 'nodata' field with the proportion 'missing' of the cells below it
+    void find_level (int nr, int nc, double missing)
+    {
+        vector<long long> count (synth_levels, 0);
+        #pragma omp parallel
+        {
+            vector<long long> mine (synth_levels, 0);
+            #pragma omp for schedule (static)
+            for (int i = 0; i < nr; i++)
+            {
+                for (int j = 0; j < nc; j++)
+                {
+                    mine[min (synth_levels - 1, (int) (hole_field (i, j) * synth_levels))]++;
+                }
+            }
+            #pragma omp critical
+            for (int b = 0; b < synth_levels; b++)
+            {
+                count[b] += mine[b];
+            }
+        }
+        const long long want = (long long) (missing * nr * nc + 0.5);
+        long long below = 0;
+        int b = 0;
+        while (b < synth_levels && below + count[b] / 2 < want)
+        {
+            below += count[b];
+            b++;
+        }
+        level = (double) b / synth_levels;
+    }
+};
+
+// -------------------------------------------------------------------------------
+// SYNTHETIC GRID FUNCTION: fills 'grid' with nr rows and nc columns of type t of synthetic
+// terrain for 'seed', with the proportion 'missing' of the cells 'nodata'. An input grid
+// (input = true) has its validity plane set and the cells without a value stored as zero, the
+// same as the readers leave it, otherwise the cells without a value are set to 'nodata', the
+// same as an output grid, ready to be written to a file.
+void synth_grid (raster_buffer &grid, cell_type t, int nr, int nc, unsigned int seed, double missing,
+                 double nodata, bool input)
+{
+    const synth_terrain terrain (seed, nr, nc, missing);
+    grid.allocate (t, nr, nc);
+    if (input)
+    {
+        grid.valid.allocate (nr, nc);
+    }
+    #pragma omp parallel
+    {
+        vector<double> row (nc);
+        #pragma omp for schedule (static)
+        for (int i = 0; i < nr; i++)
+        {
+            for (int j = 0; j < nc; j++)
+            {
+                row[j] = terrain.hole (i, j) ? nodata : terrain.elevation (i, j);
+            }
+            if (input)
+            {
+                grid.put_row (i, &row[0], nodata);
+            }
+            else
+            {
+                grid.put_row (i, &row[0]);
+            }
+        }
+    }
+    if (input)
+    {
+        grid.build_index ();
+    }
+}
@@ -0,0 +1,367 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Cache-blocked tile scheduling
+
+/*
+The sliding window for output cell (i, j) reads the leading and trailing edges of the
+filter circle, which span 2 * edge_guard + 1 input rows. Sweeping a whole row at a time,
+those input rows are pushed out of the cache long before the next output row comes back to
+them, so for large circles nearly every lookup is a trip to main memory. Instead, the
+output rows are split into blocks, and each block is calculated one stripe of columns at a
+time: every row of the block across the first stripe, then every row across the next stripe,
+and so on. A stripe is narrow enough that the input it touches (the window rows, across the
+stripe plus a halo of edge_guard columns on each side) stays in the cache while the next row
+of the block slides across it. The sliding state of each row is carried from one stripe to
+the next, so the results are exactly the same as sweeping whole rows. The rows that add up
+their windows afresh rather than sliding them down from the row above are fixed rows of the
+grid (see slide_anchor), so the blocks do not change the results either.
+
+The blocks are shared out by work stealing: each processor starts with an even share of the
+blocks and works through them from the front, and a processor that runs out takes half of
+the blocks left at the back of another processor's share. Processors mostly work on their
+own neighbouring rows, and there is no single shared counter for them all to queue on.
+
+The cache size is read from the operating system (half of the level 2 cache, leaving room
+for the mask, lookups and output rows), or it can be set with --tilecache=KB.
+Before a tile is calculated its footprint (the input its windows can reach) is looked up in
+the validity index of the input (see raster.hpp). If it has fewer values than a window needs,
+every output cell of the tile stays 'nodata' and the tile can be skipped. The mean and sum
+carry their running sums from one stripe to the next, they only skip a tile with no values at
+all: its windows are empty, and an empty window's sum is set to exactly zero while sliding
+too, so the rows go on into the next stripe from the same sums whether the tile was skipped
+or not. If the footprint has no 'nodata' cells the tile runs the kernel that does not count
+the values (see the nodata policies in tfil_mask.hpp).
+
+With --report or --progress (see tfil_probe.hpp) the schedule also times each processor from
+taking a tile to asking for the next one, and counts the tiles and cells it took and stole.
+*/
+
+// -------------------------------------------------------------------------------
+// CHUNK FUNCTION: the number of rows in each OpenMP chunk, this is normally CHUNKSIZE but it
+// is reduced for small blocks of rows (e.g. streaming) so every processor gets some work
+int row_chunk (int nrow)
+{
+    return max (1, min (CHUNKSIZE, nrow / (4 * omp_get_max_threads())));
+}
+
+// -------------------------------------------------------------------------------
+// SLIDE ANCHORS: the sliding sums (mean, sum, variance, ...) start each row from the window of
+// the row above, which rounds a float sum differently from adding up the whole window. So that
+// the output does not depend on how the rows are blocked for the processors, the window is
+// added up afresh on every slide_rows-th row from the first output row, and the blocks of these
+// kernels are whole multiples of slide_rows rows
+const int slide_rows = 16;
+
+// true if row i of a block that starts at row blk_st adds up its window afresh
+inline bool slide_anchor (int i, int blk_st)
+{
+    return (i - blk_st) % slide_rows == 0;
+}
+
+// the number of rows in each block of a sliding sum kernel: row_chunk, in whole anchors
+int slide_chunk (int nrow)
+{
+    return (row_chunk (nrow) + slide_rows - 1) / slide_rows * slide_rows;
+}
+
+// -------------------------------------------------------------------------------
+// CACHE FUNCTION: the number of bytes of input each stripe may touch
+size_t tile_cache_bytes ()
+{
+    if (tile_cache_kb > 0)
+    {
+        return (size_t) tile_cache_kb * 1024;
+    }
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long l2 = sysconf (_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0)
+    {
+        return (size_t) l2 / 2;
+    }
+#endif
+    return 256 * 1024;          // a safe guess for most processors
+}
+
+// -------------------------------------------------------------------------------
+// STRIPE FUNCTION: the number of columns in each stripe, for a grid 'width' columns wide
+int tile_stripe_cols (const filter_mask &m, size_t cell_bytes, int width)
+{
+    // The leading and trailing edges sweep the rows of the window, across the stripe plus
+    // the halo on each side, or across two separate strips if the stripe is narrower than
+    // the window
+    const double win_rows = 2.0 * m.edge_guard + 1.0;
+    const double halo = m.edge_guard_j;
+    const double cols = (double) tile_cache_bytes () / (win_rows * cell_bytes);
+    double stripe = (cols >= 4.0 * halo) ? cols - 2.0 * halo : cols / 2.0;
+
+    // Whole cache lines, and never so narrow that the loop overhead takes over
+    const int per_line = (int) (raster_align / cell_bytes);
+    int w = (int) (stripe / per_line) * per_line;
+    w = max (w, 4 * per_line);
+    return min (w, max (width, 1));
+}
+
+// -------------------------------------------------------------------------------
+// SLIDING STATE: what each row carries from one stripe to the next
+template <typename V>
+struct slide_state
+{
+    V val;                  // running sum
+    int nontoxic_cntr;      // number of good values in the window
+};
+
+// -------------------------------------------------------------------------------
+// TILE SCHEDULE: blocks of rows and stripes of columns, shared out by work stealing
+class tile_schedule
+{
+public:
+    int block_rows;         // rows in each block
+    int nblocks;
+    int stripe_cols;        // columns in each stripe
+    int nstripes;
+
+    // split rows i_lo to i_hi and columns j_lo to j_hi for a sliding sum kernel, in blocks of
+    // slide_chunk rows, each block is shared out with all of its stripes (see next_block)
+    tile_schedule (int i_lo, int i_hi, int j_lo, int j_hi, const filter_mask &m, size_t cell_bytes)
+        : watch (probe_on || probe_interval > 0.0), taken (0), t_made (omp_get_wtime()), t_line (t_made)
+    {
+        const int nrow = max (0, i_hi - i_lo);
+        const int ncol = max (0, j_hi - j_lo);
+        deal (i_lo, i_hi, j_lo, j_hi, slide_chunk (nrow), tile_stripe_cols (m, cell_bytes, ncol), false);
+    }
+
+    // split rows i_lo to i_hi into blocks of blk_rows and columns j_lo to j_hi into stripes of
+    // str_cols, each tile is shared out on its own (see next_tile)
+    tile_schedule (int i_lo, int i_hi, int j_lo, int j_hi, int blk_rows, int str_cols)
+        : watch (probe_on || probe_interval > 0.0), taken (0), t_made (omp_get_wtime()), t_line (t_made)
+    {
+        deal (i_lo, i_hi, j_lo, j_hi, blk_rows, str_cols, true);
+    }
+
+    ~tile_schedule ()
+    {
+        // The time and counts of each processor go into the report
+        const double wall = omp_get_wtime() - t_made;
+        for (size_t t = 0; probe_on && watch && t < shares.size() && t < probe_threads.size(); t++)
+        {
+            probe_thread &p = probe_threads[t];
+            p.cells += shares[t].cells;
+            p.tiles += shares[t].tiles;
+            p.steals += shares[t].steals;
+            p.busy += shares[t].busy;
+            p.wall += wall;
+        }
+        for (size_t t = 0; t < shares.size(); t++)
+        {
+            omp_destroy_lock (&shares[t].lock);
+        }
+    }
+
+    int stripe_start (int s) const { return col_lo + s * stripe_cols; }
+    int stripe_end (int s) const { return min (col_hi, col_lo + (s + 1) * stripe_cols); }
+
+    // take the next block for the calling processor, from its own share or stolen from
+    // another, returns false when every block is taken
+    bool next_block (int &blk_st, int &blk_end)
+    {
+        const int b = take ();
+        if (b < 0)
+        {
+            return false;
+        }
+        blk_st = row_lo + b * block_rows;
+        blk_end = min (row_hi, blk_st + block_rows);
+        if (watch)
+        {
+            took_cells ((long long) (blk_end - blk_st) * (col_hi - col_lo));
+        }
+        return true;
+    }
+
+    // take the next tile for the calling processor, returns false when every tile is taken
+    bool next_tile (int &blk_st, int &blk_end, int &str_st, int &str_end)
+    {
+        const int t = take ();
+        if (t < 0)
+        {
+            return false;
+        }
+        blk_st = row_lo + (t / nstripes) * block_rows;
+        blk_end = min (row_hi, blk_st + block_rows);
+        str_st = stripe_start (t % nstripes);
+        str_end = stripe_end (t % nstripes);
+        if (watch)
+        {
+            took_cells ((long long) (blk_end - blk_st) * (str_end - str_st));
+        }
+        return true;
+    }
+
+private:
+    struct share
+    {
+        omp_lock_t lock;
+        int next;           // next block from the front
+        int end;            // one past the last block
+        double started;     // when the processor took its current tile (0 = none), and what
+        double busy;        // it did, for the report (see tfil_probe.hpp)
+        long long tiles;
+        long long steals;
+        long long cells;
+        char pad[64];       // keep each share on its own cache line
+    };
+    vector<share> shares;
+    int row_lo, row_hi;
+    int col_lo, col_hi;
+    int nitems;             // blocks (or tiles) to share out
+    bool watch;             // true to time the processors and count their tiles
+    long long taken;        // tiles taken so far, for the progress line
+    double t_made;          // when the schedule was made
+    double t_line;          // when the last progress line was printed
+
+    // size the blocks and stripes, and start every processor with an even share of the
+    // blocks, or of the tiles
+    void deal (int i_lo, int i_hi, int j_lo, int j_hi, int blk_rows, int str_cols, bool by_tile)
+    {
+        row_lo = i_lo;
+        row_hi = i_hi;
+        col_lo = j_lo;
+        col_hi = j_hi;
+        const int nrow = max (0, i_hi - i_lo);
+        const int ncol = max (0, j_hi - j_lo);
+        block_rows = max (1, blk_rows);
+        nblocks = (nrow + block_rows - 1) / block_rows;
+        stripe_cols = max (1, str_cols);
+        nstripes = (ncol + stripe_cols - 1) / stripe_cols;
+        nitems = by_tile ? nblocks * nstripes : nblocks;
+
+        const int nshares = omp_get_max_threads();
+        shares.resize (nshares);
+        for (int t = 0; t < nshares; t++)
+        {
+            omp_init_lock (&shares[t].lock);
+            shares[t].next = (int) ((long long) nitems * t / nshares);
+            shares[t].end = (int) ((long long) nitems * (t + 1) / nshares);
+            shares[t].started = 0.0;
+            shares[t].busy = 0.0;
+            shares[t].tiles = 0;
+            shares[t].steals = 0;
+            shares[t].cells = 0;
+        }
+    }
+
+    // the next block (or tile) from the calling processor's own share, or stolen from another
+    // share if its own is empty, -1 if there are none left
+    int take ()
+    {
+        const int nshares = (int) shares.size();
+        const int self = omp_get_thread_num() % nshares;
+        share &mine = shares[self];
+        if (watch && mine.started > 0.0)
+        {
+            mine.busy += omp_get_wtime() - mine.started;       // the last tile is finished
+            mine.started = 0.0;
+        }
+        int b = take_front (mine);
+        bool stolen = false;
+        for (int k = 1; b < 0 && k < nshares; k++)
+        {
+            b = steal_half (shares[(self + k) % nshares], mine);
+            stolen = (b >= 0);
+        }
+        if (watch && b >= 0)
+        {
+            mine.started = omp_get_wtime();
+            mine.tiles++;
+            mine.steals += stolen;
+            long long done;
+            #pragma omp atomic capture
+            done = ++taken;
+            if (probe_interval > 0.0 && omp_get_thread_num() == 0)
+            {
+                probe_progress (done, nitems, t_made, t_line);
+            }
+        }
+        return b;
+    }
+
+    // counts the output cells of the tile the calling processor just took
+    void took_cells (long long n)
+    {
+        shares[omp_get_thread_num() % shares.size()].cells += n;
+    }
+
+    int take_front (share &sh)
+    {
+        int b = -1;
+        omp_set_lock (&sh.lock);
+        if (sh.next < sh.end)
+        {
+            b = sh.next++;
+        }
+        omp_unset_lock (&sh.lock);
+        return b;
+    }
+
+    // move the back half of the victim's blocks to the thief's share, and take the first
+    int steal_half (share &victim, share &thief)
+    {
+        int first = -1, last = -1;
+        omp_set_lock (&victim.lock);
+        const int left = victim.end - victim.next;
+        if (left > 0)
+        {
+            last = victim.end;
+            first = victim.end - (left + 1) / 2;
+            victim.end = first;
+        }
+        omp_unset_lock (&victim.lock);
+        if (first < 0)
+        {
+            return -1;
+        }
+        omp_set_lock (&thief.lock);
+        thief.next = first + 1;
+        thief.end = last;
+        omp_unset_lock (&thief.lock);
+        return first;
+    }
+
+    tile_schedule (const tile_schedule &);          // owns the locks: no copies
+    tile_schedule & operator= (const tile_schedule &);
+};
+
+// -------------------------------------------------------------------------------
+// FOOTPRINT FUNCTION: what the output cells of rows i0 to i1 - 1 and columns j0 to j1 - 1 need,
+// from the tiles of the validity index their windows reach (with the column before, which a
+// sliding window takes out on its first step)
+enum footprint_kind
+{
+    footprint_empty,        // fewer values than a window needs: the cells stay 'nodata'
+    footprint_full,         // no 'nodata' cells
+    footprint_mixed
+};
+
+template <typename T>
+footprint_kind tile_footprint (raster_view<T> in, const filter_mask &m, int req_valcount, int i0, int i1,
+                               int j0, int j1)
+{
+    if (in.index == NULL)
+    {
+        return footprint_mixed;
+    }
+    const int r0 = i0 - m.edge_guard;
+    const int r1 = i1 + m.edge_guard;
+    const int c0 = j0 - m.edge_guard_j - 1;
+    const int c1 = j1 + m.edge_guard_j;
+    if (req_valcount > 0 && in.index->values (r0, r1, c0, c1) < req_valcount)
+    {
+        probe_count (&probe_thread::skipped_cells, (long long) (i1 - i0) * (j1 - j0));
+        return footprint_empty;
+    }
+    if (in.index->full (r0, r1, c0, c1))
+    {
+        return footprint_full;
+    }
+    probe_count (&probe_thread::nodata_cells, (long long) (i1 - i0) * (j1 - j0));
+    return footprint_mixed;
+}
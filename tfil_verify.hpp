@@ -0,0 +1,339 @@
+// Generic filter program for performing 'focal statistics' in parallel with OpenMP
+// Reference filter and --verify
+
+/*
+The calculation modules never look at a whole window: they slide it with the trailing and
+leading lookups, start rows from the row above, keep running sums, sliding extremes and
+histograms, and skip tiles by their footprints. Any slip in that bookkeeping changes the
+output without any other sign. The reference here does it the slow and obvious way: for each
+focal cell it reads every cell of the filter mask (the 'fil' array itself, not the lookups),
+collects the values and works the statistic out from them directly, in doubles, with the
+rules the modules are meant to follow:
+
+- a cell closer to the edge of the grid than the radius is 'nodata', or with --edges=partial
+  its window is the part inside the grid, and the nontoxic proportion is of that part;
+- a window needs at least one value, and at least the nontoxic proportion of its cells;
+- the variance is of the whole population (two passes: the mean, then the squares around it),
+  of integer cells it is worked out exactly from whole number sums, and rounded halves up;
+- the median is the mean of the two middle values of an even number, a percentile is the
+  nearest rank, the majority and minority are the smallest of equally common values.
+
+With --verify the outputs are checked against the reference once they are calculated, on a
+sample of 10000 cells spread over the grid (--verify=N for N cells, --verify=full for every
+cell), before they are written. For each output the largest absolute and relative errors, the
+cells where one has a value and the other is 'nodata', and the cells that differ by more than
+1e-6 of their value (or 1e-6 for values under 1) are reported. If any cell does not match,
+the program says so and exits with status 11 once the outputs are written. The reference
+value is stored the same way as the output before it is compared (rounded, and held to the
+range of an integer cell), the error of an integer cell is how far it is beyond the rounding
+of the reference.
+*/
+
+// -------------------------------------------------------------------------------
+// VERIFY SETTINGS
+long long verify_cells = 0;             // cells to check (0 = no check, the whole grid or more = every cell)
+const long long verify_sample = 10000;  // cells checked by --verify
+const double verify_tolerance = 1e-6;   // largest difference, relative to the value (or 1)
+
+// -------------------------------------------------------------------------------
+// VERIFY RESULT: how one output compares with the reference
+struct verify_result
+{
+    long long cells;                    // cells checked
+    long long nodata_mismatch;          // cells with a value in one and 'nodata' in the other
+    long long beyond;                   // cells that differ by more than the tolerance
+    double max_abs;                     // largest absolute error
+    double max_rel;                     // largest relative error (of the values that are not 0)
+    int first_i;                        // the first cell that does not match (-1 for none)
+    int first_j;
+    double first_fast;                  // its value in the output and the reference, NaN for
+    double first_ref;                   // 'nodata'
+
+    verify_result () : cells (0), nodata_mismatch (0), beyond (0), max_abs (0.0), max_rel (0.0), first_i (-1),
+                       first_j (-1), first_fast (0.0), first_ref (0.0) {}
+
+    bool passed () const { return nodata_mismatch == 0 && beyond == 0; }
+
+    // adds what another thread found
+    void merge (const verify_result &r)
+    {
+        cells += r.cells;
+        nodata_mismatch += r.nodata_mismatch;
+        beyond += r.beyond;
+        max_abs = max (max_abs, r.max_abs);
+        max_rel = max (max_rel, r.max_rel);
+        if (r.first_i >= 0 && (first_i < 0 || r.first_i < first_i || (r.first_i == first_i && r.first_j < first_j)))
+        {
+            first_i = r.first_i;
+            first_j = r.first_j;
+            first_fast = r.first_fast;
+            first_ref = r.first_ref;
+        }
+    }
+};
+
+// -------------------------------------------------------------------------------
+// REFERENCE FUNCTIONS
+
+// collects the values of the window of focal cell (i, j) into 'vals', returns false if the cell
+// is 'nodata' whatever its window holds: it is too close to the edge, or its window has no
+// values or fewer than the nontoxic proportion
+template <typename T>
+bool reference_window (raster_view<T> in, const filter_mask &m, const filter_spec &f, int i, int j,
+                       vector<double> &vals)
+{
+    const int nr = in.nrows;
+    const int nc = in.ncols;
+    if (!f.edge_partial && (i < m.edge_guard || i >= nr - m.edge_guard || j < m.edge_guard_j
+                            || j >= nc - m.edge_guard_j))
+    {
+        return false;
+    }
+    vals.clear ();
+    int cells = 0;              // cells of the window inside the grid
+    for (int a = 0; a < m.filsize; a++)
+    {
+        const int i_in = i + a - m.cen_i;
+        for (int b = 0; b < m.filsize; b++)
+        {
+            const int j_in = j + b - m.cen_j;
+            if (!m.fil[a][b] || i_in < 0 || i_in >= nr || j_in < 0 || j_in >= nc)
+            {
+                continue;
+            }
+            cells++;
+            if (in.has (i_in, j_in))
+            {
+                vals.push_back ((double) in[i_in][j_in]);
+            }
+        }
+    }
+    const int n = (int) vals.size();
+    return n > 0 && n >= (int) ceil (f.nontoxic_frac * cells);
+}
+
+// statistic s of filter f of the values 'vals' (sorted here if the statistic needs them in order),
+// 'whole' for the values of integer cells, whose variance is returned already rounded (a half is
+// not left to the rounding of a double)
+double reference_value (vector<double> &vals, const filter_spec &f, size_t s, bool whole)
+{
+    const int n = (int) vals.size();
+    double sum = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+        sum += vals[k];
+    }
+    const double mean = sum / n;
+    switch (f.stats[s])
+    {
+        case stat_mean: return mean;
+        case stat_sum: return sum;
+        case stat_count: return n;
+        case stat_min: return *min_element (vals.begin(), vals.end());
+        case stat_max: return *max_element (vals.begin(), vals.end());
+        case stat_range: return *max_element (vals.begin(), vals.end()) - *min_element (vals.begin(), vals.end());
+        case stat_var:
+        case stat_std:
+        {
+            if (whole)
+            {
+                long long isum = 0;
+                unsigned long long isq = 0;
+                for (int k = 0; k < n; k++)
+                {
+                    isum += (long long) vals[k];
+                    isq += int_square ((long long) vals[k]);
+                }
+                const int_variance exact = exact_variance (isum, isq, n);
+                return (f.stats[s] == stat_var) ? exact.rounded () : sqrt (exact.value ());
+            }
+            double sq = 0.0;
+            for (int k = 0; k < n; k++)
+            {
+                sq += (vals[k] - mean) * (vals[k] - mean);
+            }
+            return (f.stats[s] == stat_var) ? sq / n : sqrt (sq / n);
+        }
+        default: break;
+    }
+
+    // The statistics of the values in order
+    sort (vals.begin(), vals.end());
+    if (f.stats[s] == stat_median)
+    {
+        return 0.5 * (vals[(n + 1) / 2 - 1] + vals[n / 2]);
+    }
+    if (f.stats[s] == stat_percentile)
+    {
+        int k = (int) ceil (f.percentiles[s] * n / 100.0 - 1e-9);
+        k = max (1, min (n, k));
+        return vals[k - 1];
+    }
+
+    // The majority, minority and variety, from the runs of equal values
+    double best = vals[0];
+    int best_run = -1;
+    int variety = 0;
+    for (int k = 0; k < n; )
+    {
+        int e = k;
+        while (e < n && vals[e] == vals[k])
+        {
+            e++;
+        }
+        const int run = e - k;
+        variety++;
+        const bool better = (f.stats[s] == stat_majority) ? (run > best_run) : (best_run < 0 || run < best_run);
+        if (better)                 // the first of equally common values is the smallest
+        {
+            best = vals[k];
+            best_run = run;
+        }
+        k = e;
+    }
+    return (f.stats[s] == stat_variety) ? variety : best;
+}
+
+// -------------------------------------------------------------------------------
+// CELL FUNCTION: the k-th of 'count' cells checked on a grid of 'ncells' cells: every cell, or
+// cells spread over the grid at random (the same ones every run)
+inline long long verify_cell (long long k, long long count, long long ncells)
+{
+    if (count >= ncells)
+    {
+        return k;
+    }
+    unsigned long long h = (unsigned long long) k * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 30;               // splitmix64 finaliser
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return (long long) (h % (unsigned long long) ncells);
+}
+
+// -------------------------------------------------------------------------------
+// COMPARE FUNCTION: checks 'count' cells of output 'out' of statistic s of filter f (with mask m)
+// against the reference, 'nodata_cell' is the 'nodata' value as it is stored in the output
+template <typename T>
+verify_result verify_output (raster_view<T> in, raster_view<T> out, const filter_mask &m, const filter_spec &f,
+                             size_t s, double nodata_cell, long long count)
+{
+    const long long ncells = (long long) in.nrows * in.ncols;
+    count = min (count, ncells);
+    verify_result all;
+    #pragma omp parallel
+    {
+        verify_result mine;
+        vector<double> vals;
+        #pragma omp for schedule (dynamic, CHUNKSIZE)
+        for (long long k = 0; k < count; k++)
+        {
+            const long long c = verify_cell (k, count, ncells);
+            const int i = (int) (c / in.ncols);
+            const int j = (int) (c % in.ncols);
+            const double fast = (double) out[i][j];
+            const bool has_fast = (fast != nodata_cell) && (fast == fast || nodata_cell == nodata_cell);  // a NaN flag
+            const bool has_ref = reference_window (in, m, f, i, j, vals);
+            const double exact = has_ref ? reference_value (vals, f, s, numeric_limits<T>::is_integer) : 0.0;
+            const double ref = (double) cell_traits<T>::from_double (exact);
+
+            bool match = (has_fast == has_ref);
+            if (!match)
+            {
+                mine.nodata_mismatch++;
+            }
+            else if (has_ref)
+            {
+                // integer cells: the error beyond the rounding, a value that is a half either way
+                // can round either way, and none if both are held to the largest or smallest cell
+                double err = fabs (fast - ref);
+                if (numeric_limits<T>::is_integer)
+                {
+                    err = min (err, max (0.0, fabs (fast - exact) - 0.5));
+                }
+                if (!(err <= verify_tolerance * max (1.0, fabs (ref))))     // NaN never matches
+                {
+                    mine.beyond++;
+                    match = false;
+                }
+                mine.max_abs = max (mine.max_abs, (err == err) ? err : numeric_limits<double>::infinity());
+                if (ref != 0.0)
+                {
+                    mine.max_rel = max (mine.max_rel, (err == err) ? err / fabs (ref) : numeric_limits<double>::infinity());
+                }
+            }
+            mine.cells++;
+            if (!match && (mine.first_i < 0 || i < mine.first_i || (i == mine.first_i && j < mine.first_j)))
+            {
+                mine.first_i = i;
+                mine.first_j = j;
+                mine.first_fast = has_fast ? fast : numeric_limits<double>::quiet_NaN();
+                mine.first_ref = has_ref ? ref : numeric_limits<double>::quiet_NaN();
+            }
+        }
+        #pragma omp critical
+        all.merge (mine);
+    }
+    return all;
+}
+
+verify_result verify_rows (const raster_buffer &src, const raster_buffer &dst, const filter_mask &m,
+                           const filter_spec &f, size_t s, long long count)
+{
+    const double nodata_cell = dst.stored (nodataflag);
+    switch (src.type)
+    {
+        case cell_int16: return verify_output (src.view<short>(), dst.view<short>(), m, f, s, nodata_cell, count);
+        case cell_int32: return verify_output (src.view<int>(), dst.view<int>(), m, f, s, nodata_cell, count);
+        case cell_float32: return verify_output (src.view<float>(), dst.view<float>(), m, f, s, nodata_cell, count);
+        default: return verify_output (src.view<double>(), dst.view<double>(), m, f, s, nodata_cell, count);
+    }
+}
+
+// -------------------------------------------------------------------------------
+// VERIFY FUNCTION: checks the outputs of the command line against the reference, outs[k * nstat
+// + s] is the output of radius k and statistic s (as in a batch, see tfil_batch.hpp), on
+// 'count' cells (at least the whole grid for every cell). Prints what it finds and adds it to
+// 'json' (a JSON array), returns true if every output matches.
+bool verify_tfil (const vector<raster_buffer *> &outs, long long count, string &json)
+{
+    const filter_spec f = command_line_spec ();
+    const size_t nstat = outs.size() / radii.size();
+    const bool every = (count >= (long long) nrows * ncols);
+    cout << "-------------------------------------------------------------" << endl;
+    cout << "Verifying " << (every ? "every cell" : "a sample of the cells") << " against the reference . . ." << endl;
+    bool passed = true;
+    ostringstream js;
+    js << "[";
+    for (size_t k = 0; k < radii.size(); k++)
+    {
+        filter_mask m;
+        int req_valcount = 0;
+        setup_tfil (m, req_valcount, radii[k]);
+        for (size_t s = 0; s < nstat; s++)
+        {
+            const double t_start = omp_get_wtime();
+            const verify_result r = verify_rows (in, *outs[k * nstat + s], m, f, s, count);
+            passed = passed && r.passed();
+            cout << stat_name (f.stats[s], f.percentiles[s]) << ", radius " << radii[k] << ": " << r.cells
+                 << " cells, max abs error " << r.max_abs << ", max rel error " << r.max_rel << ", "
+                 << r.nodata_mismatch << " nodata mismatches, " << r.beyond << " cells beyond " << verify_tolerance
+                 << " (" << omp_get_wtime() - t_start << " s)" << endl;
+            if (r.first_i >= 0)
+            {
+                cout << "  first mismatch at row " << r.first_i << ", column " << r.first_j << ": output "
+                     << r.first_fast << ", reference " << r.first_ref << " (nan = nodata)" << endl;
+            }
+            js << (k + s > 0 ? ", " : "") << "{\"statistic\": \"" << stat_tag (f.stats[s], f.percentiles[s])
+               << "\", \"radius\": " << radii[k] << ", \"cells\": " << r.cells << ", \"max_abs_error\": "
+               << r.max_abs << ", \"max_rel_error\": " << r.max_rel << ", \"nodata_mismatches\": "
+               << r.nodata_mismatch << ", \"beyond_tolerance\": " << r.beyond << "}";
+        }
+    }
+    js << "]";
+    json = js.str();
+    cout << (passed ? "VERIFY PASSED" : "VERIFY FAILED: the output does not match the reference") << endl;
+    cout << "-------------------------------------------------------------" << endl;
+    return passed;
+}